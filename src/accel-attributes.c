@@ -10,6 +10,11 @@
 
 #include "accel-attributes.h"
 
+/* How much slower than the normal rate to poll a device lying still.
+ * A rotation is only noticed on the next poll, so this keeps the delay
+ * under 1.5 seconds at the usual 700 ms rate */
+#define DEFAULT_IDLE_BACKOFF 2
+
 AccelLocation
 setup_accel_location (GUdevDevice *device)
 {
@@ -95,3 +100,19 @@ get_accel_scale (GUdevDevice *device,
 	reset_accel_scale (scale_vec);
 	return TRUE;
 }
+
+guint
+get_accel_poll_max_interval (GUdevDevice *device,
+			     guint        min_interval)
+{
+	int interval;
+
+	interval = g_udev_device_get_property_as_int (device, "ACCEL_POLL_MAX_INTERVAL");
+	if (interval > 0) {
+		g_debug ("Polling at most every %d ms when still, from ACCEL_POLL_MAX_INTERVAL",
+			 interval);
+		return MAX ((guint) interval, min_interval);
+	}
+
+	return min_interval * DEFAULT_IDLE_BACKOFF;
+}
@@ -8,6 +8,8 @@
  *
  */
 
+#pragma once
+
 #include <glib.h>
 #include <gudev/gudev.h>
 
@@ -24,3 +26,6 @@ gboolean parse_accel_location (const char    *location,
                                AccelLocation *value);
 
 gboolean get_accel_scale (GUdevDevice *device, AccelScale *scale_vec);
+
+guint get_accel_poll_max_interval (GUdevDevice *device,
+                                   guint        min_interval);
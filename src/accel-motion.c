@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "accel-motion.h"
+
+/* Variance of the magnitude, in (m/s²)², under which the device
+ * is considered to be lying still */
+#define STILL_VARIANCE 0.01
+/* Change on any axis between two readings, in m/s², that snaps
+ * polling back to the fastest rate */
+#define SNAP_DELTA     1.0
+
+static void
+reset_window (AccelMotion *motion)
+{
+	motion->n_magnitudes = 0;
+	motion->pos = 0;
+}
+
+/**
+ * accel_motion_init:
+ * @motion: the motion detector
+ * @min_interval: the polling interval, in milliseconds, when moving
+ * @max_interval: the longest polling interval, in milliseconds, when still
+ *
+ * Sets up a detector that tells accelerometer drivers how often to
+ * poll, backing off exponentially while the device is not moving.
+ **/
+void
+accel_motion_init (AccelMotion *motion,
+		   guint        min_interval,
+		   guint        max_interval)
+{
+	g_return_if_fail (motion != NULL);
+
+	memset (motion, 0, sizeof (AccelMotion));
+	motion->min_interval = min_interval;
+	motion->max_interval = MAX (min_interval, max_interval);
+	motion->interval = min_interval;
+}
+
+/**
+ * accel_motion_add_samples:
+ * @motion: the motion detector
+ * @accel: @n_samples readings in m/s², as consecutive x, y, z triplets
+ * @n_samples: the number of readings
+ *
+ * Feeds readings, in the order they were taken, to the detector.
+ **/
+void
+accel_motion_add_samples (AccelMotion  *motion,
+			  const double *accel,
+			  guint         n_samples)
+{
+	guint i;
+
+	g_return_if_fail (motion != NULL);
+
+	for (i = 0; i < n_samples * 3; i += 3) {
+		const double *sample = accel + i;
+
+		if (motion->has_last &&
+		    (fabs (sample[0] - motion->last[0]) > SNAP_DELTA ||
+		     fabs (sample[1] - motion->last[1]) > SNAP_DELTA ||
+		     fabs (sample[2] - motion->last[2]) > SNAP_DELTA)) {
+			motion->moved = TRUE;
+			reset_window (motion);
+		}
+
+		motion->last[0] = sample[0];
+		motion->last[1] = sample[1];
+		motion->last[2] = sample[2];
+		motion->has_last = TRUE;
+
+		motion->magnitudes[motion->pos] = sqrt (sample[0] * sample[0] +
+							sample[1] * sample[1] +
+							sample[2] * sample[2]);
+		motion->pos = (motion->pos + 1) % ACCEL_MOTION_WINDOW;
+		if (motion->n_magnitudes < ACCEL_MOTION_WINDOW)
+			motion->n_magnitudes++;
+	}
+}
+
+static gboolean
+is_still (AccelMotion *motion)
+{
+	double mean = 0.0, variance = 0.0;
+	guint i;
+
+	if (motion->n_magnitudes < ACCEL_MOTION_WINDOW)
+		return FALSE;
+
+	for (i = 0; i < ACCEL_MOTION_WINDOW; i++)
+		mean += motion->magnitudes[i];
+	mean /= ACCEL_MOTION_WINDOW;
+
+	for (i = 0; i < ACCEL_MOTION_WINDOW; i++)
+		variance += (motion->magnitudes[i] - mean) * (motion->magnitudes[i] - mean);
+	variance /= ACCEL_MOTION_WINDOW;
+
+	return variance < STILL_VARIANCE;
+}
+
+/**
+ * accel_motion_next_interval:
+ * @motion: the motion detector
+ *
+ * Returns: the interval, in milliseconds, until the next poll. It
+ * doubles, up to the maximum, each time the device is found to be
+ * still, and goes straight back to the minimum on any movement.
+ **/
+guint
+accel_motion_next_interval (AccelMotion *motion)
+{
+	g_return_val_if_fail (motion != NULL, 0);
+
+	if (motion->moved || !is_still (motion))
+		motion->interval = motion->min_interval;
+	else
+		motion->interval = MIN (motion->interval * 2, motion->max_interval);
+	motion->moved = FALSE;
+
+	return motion->interval;
+}
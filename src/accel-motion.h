@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#define ACCEL_MOTION_WINDOW 16
+
+typedef struct {
+	double   magnitudes[ACCEL_MOTION_WINDOW];
+	guint    n_magnitudes;
+	guint    pos;
+
+	double   last[3];
+	gboolean has_last;
+	gboolean moved;
+
+	guint    interval;
+	guint    min_interval;
+	guint    max_interval;
+} AccelMotion;
+
+void  accel_motion_init          (AccelMotion  *motion,
+				  guint         min_interval,
+				  guint         max_interval);
+void  accel_motion_add_samples   (AccelMotion  *motion,
+				  const double *accel,
+				  guint         n_samples);
+guint accel_motion_next_interval (AccelMotion  *motion);
@@ -87,6 +87,62 @@ setup_mount_matrix (GUdevDevice *device)
 	return ret;
 }
 
+static AccelVec3 *
+setup_sensor_mount_matrix (GUdevDevice       *device,
+			   const char        *property,
+			   const char * const attrs[3],
+			   const char        *sensor)
+{
+	AccelVec3 *ret = NULL;
+	const char *mount_matrix;
+	guint i;
+
+	mount_matrix = g_udev_device_get_property (device, property);
+	if (mount_matrix) {
+		if (parse_mount_matrix (mount_matrix, &ret))
+			return ret;
+
+		g_warning ("Failed to parse %s ('%s') from udev",
+			   property, mount_matrix);
+		g_clear_pointer (&ret, g_free);
+	}
+
+	for (i = 0; i < 3; i++) {
+		mount_matrix = g_udev_device_get_sysfs_attr (device, attrs[i]);
+		if (!mount_matrix)
+			continue;
+		if (parse_mount_matrix (mount_matrix, &ret))
+			return ret;
+
+		g_warning ("Failed to parse %s ('%s') from sysfs",
+			   attrs[i], mount_matrix);
+		g_clear_pointer (&ret, g_free);
+	}
+
+	g_debug ("Failed to auto-detect %s mount matrix, falling back to identity", sensor);
+	parse_mount_matrix (NULL, &ret);
+	return ret;
+}
+
+/* Same as setup_mount_matrix(), for magnetometers, so that
+ * their readings are in the same frame as the accelerometer's */
+AccelVec3 *
+setup_magn_mount_matrix (GUdevDevice *device)
+{
+	const char * const attrs[] = { "in_magn_mount_matrix", "mount_matrix", "in_mount_matrix" };
+
+	return setup_sensor_mount_matrix (device, "MAGN_MOUNT_MATRIX", attrs, "magnetometer");
+}
+
+/* And for gyroscopes */
+AccelVec3 *
+setup_gyro_mount_matrix (GUdevDevice *device)
+{
+	const char * const attrs[] = { "in_anglvel_mount_matrix", "mount_matrix", "in_mount_matrix" };
+
+	return setup_sensor_mount_matrix (device, "GYRO_MOUNT_MATRIX", attrs, "gyroscope");
+}
+
 gboolean
 parse_mount_matrix (const char *mtx,
 		    AccelVec3  *vecs[3])
@@ -147,3 +203,71 @@ apply_mount_matrix (const AccelVec3  vecs[3],
 
 	return TRUE;
 }
+
+/**
+ * setup_accel_transform:
+ * @transform: the transform to fill in
+ * @vecs: the mount matrix, as returned by setup_mount_matrix()
+ * @scale: the scale of the raw readings, per raw axis
+ *
+ * Precomputes the combined mount matrix and scale for a device,
+ * so that each column of the mount matrix is multiplied by the
+ * scale of the raw axis it applies to.
+ **/
+void
+setup_accel_transform (AccelTransform  *transform,
+		       const AccelVec3  vecs[3],
+		       AccelScale       scale)
+{
+	guint i;
+
+	g_return_if_fail (transform != NULL);
+	g_return_if_fail (vecs != NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (transform->m); i++) {
+		transform->m[i][0] = vecs[i].x * scale.x;
+		transform->m[i][1] = vecs[i].y * scale.y;
+		transform->m[i][2] = vecs[i].z * scale.z;
+	}
+}
+
+void
+apply_accel_transform (const AccelTransform *transform,
+		       const int             raw[3],
+		       double                out[3])
+{
+	apply_accel_transform_n (transform, raw, out, 1);
+}
+
+/**
+ * apply_accel_transform_n:
+ * @transform: a transform set up with setup_accel_transform()
+ * @raw: @n_samples raw readings, as consecutive x, y, z triplets
+ * @out: storage for @n_samples corrected readings in m/s², same layout
+ * @n_samples: the number of readings
+ *
+ * Converts a batch of raw readings. The loop body has no branches
+ * and works on contiguous arrays so that the compiler can vectorise it.
+ **/
+void
+apply_accel_transform_n (const AccelTransform *transform,
+			 const int            *raw,
+			 double               *out,
+			 guint                 n_samples)
+{
+	const double (*m)[3];
+	guint i;
+
+	g_return_if_fail (transform != NULL);
+
+	m = transform->m;
+	for (i = 0; i < n_samples * 3; i += 3) {
+		double x = raw[i];
+		double y = raw[i + 1];
+		double z = raw[i + 2];
+
+		out[i]     = x * m[0][0] + y * m[0][1] + z * m[0][2];
+		out[i + 1] = x * m[1][0] + y * m[1][1] + z * m[1][2];
+		out[i + 2] = x * m[2][0] + y * m[2][1] + z * m[2][2];
+	}
+}
@@ -7,19 +7,44 @@
  *
  */
 
+#pragma once
+
 #include <glib.h>
 #include <gudev/gudev.h>
 
+#include "accel-scale.h"
+
 typedef struct {
 	float x;
 	float y;
 	float z;
 } AccelVec3;
 
+/* Mount matrix with the per-axis scale folded in, so that a raw
+ * reading becomes a corrected reading in m/s² in a single pass */
+typedef struct {
+	double m[3][3];
+} AccelTransform;
+
 AccelVec3 *setup_mount_matrix (GUdevDevice *device);
+AccelVec3 *setup_magn_mount_matrix (GUdevDevice *device);
+AccelVec3 *setup_gyro_mount_matrix (GUdevDevice *device);
 
 gboolean parse_mount_matrix (const char *mtx,
                              AccelVec3  *vecs[3]);
 
 gboolean apply_mount_matrix (const AccelVec3  vecs[3],
                              AccelVec3       *accel);
+
+void setup_accel_transform (AccelTransform  *transform,
+                            const AccelVec3  vecs[3],
+                            AccelScale       scale);
+
+void apply_accel_transform (const AccelTransform *transform,
+                            const int             raw[3],
+                            double                out[3]);
+
+void apply_accel_transform_n (const AccelTransform *transform,
+                              const int            *raw,
+                              double               *out,
+                              guint                 n_samples);
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+/*
+ * Runs the daemon for the benchmarks, on the private bus of a GTestDBus,
+ * against the umockdev testbed of the benchmark.
+ */
+
+#include <signal.h>
+
+#include "bench-daemon.h"
+
+/* The daemon built along with the benchmark */
+char *
+bench_daemon_get_path (const char *argv0)
+{
+	g_autofree char *dir = NULL;
+
+	dir = g_path_get_dirname (argv0);
+	return g_build_filename (dir, "iio-sensor-proxy", NULL);
+}
+
+/**
+ * bench_daemon_launcher_new:
+ * @bus_address: the address of the test bus
+ *
+ * Creates a launcher for the daemon, which puts it on the test bus as its
+ * system bus. The environment is copied from the benchmark when this is
+ * called, so the umockdev testbed needs to be created first.
+ *
+ * Returns: a new #GSubprocessLauncher
+ **/
+GSubprocessLauncher *
+bench_daemon_launcher_new (const char *bus_address)
+{
+	GSubprocessLauncher *launcher;
+
+	launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+	g_subprocess_launcher_setenv (launcher, "DBUS_SYSTEM_BUS_ADDRESS", bus_address, TRUE);
+	return launcher;
+}
+
+GDBusConnection *
+bench_daemon_connect (const char  *bus_address,
+		      GError     **error)
+{
+	return g_dbus_connection_new_for_address_sync (bus_address,
+						       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+						       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+						       NULL, NULL, error);
+}
+
+void
+bench_daemon_stop (GSubprocess *daemon)
+{
+	g_subprocess_send_signal (daemon, SIGTERM);
+	g_subprocess_wait (daemon, NULL, NULL);
+}
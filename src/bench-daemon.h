@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define SENSOR_PROXY_DBUS_NAME "net.hadess.SensorProxy"
+#define SENSOR_PROXY_DBUS_PATH "/net/hadess/SensorProxy"
+
+char                *bench_daemon_get_path     (const char  *argv0);
+GSubprocessLauncher *bench_daemon_launcher_new (const char  *bus_address);
+GDBusConnection     *bench_daemon_connect      (const char  *bus_address,
+						GError     **error);
+void                 bench_daemon_stop         (GSubprocess *daemon);
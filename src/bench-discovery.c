@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+/*
+ * Times the start-up of the daemon against a umockdev testbed with a
+ * growing number of iio, input and platform devices, from it being
+ * launched to it owning its name on the bus, and to it sending the first
+ * PropertiesChanged signal, once the accelerometer has been opened.
+ *
+ * The daemon runs on a private bus, as in bench-latency.
+ *
+ * Needs to be run under umockdev-wrapper, and outputs tab-separated
+ * "devices name-seconds signal-seconds" lines suitable for gnuplot:
+ * $ umockdev-wrapper ./bench-discovery --max-devices 4096 > discovery.dat
+ * $ gnuplot -p -e "plot 'discovery.dat' using 1:2 with linespoints, '' using 1:3 with linespoints"
+ */
+
+#include <umockdev.h>
+
+#include "bench-daemon.h"
+
+/* How long to wait for the daemon to start, or stop, in ms */
+#define STARTUP_TIMEOUT 30000
+
+typedef struct {
+	GMainLoop *loop;
+	gboolean   has_owner;
+	gboolean   has_signal;
+	/* µs, monotonic, 0 until it happens */
+	gint64     launch_time;
+	gint64     name_time;
+	gint64     signal_time;
+} Bench;
+
+static Bench bench;
+
+static void
+name_appeared (GDBusConnection *connection,
+	       const gchar     *name,
+	       const gchar     *name_owner,
+	       gpointer         user_data)
+{
+	bench.has_owner = TRUE;
+	if (bench.launch_time != 0 && bench.name_time == 0)
+		bench.name_time = g_get_monotonic_time ();
+	g_main_loop_quit (bench.loop);
+}
+
+static void
+name_vanished (GDBusConnection *connection,
+	       const gchar     *name,
+	       gpointer         user_data)
+{
+	bench.has_owner = FALSE;
+	g_main_loop_quit (bench.loop);
+}
+
+static void
+properties_changed (GDBusConnection *connection,
+		    const gchar     *sender_name,
+		    const gchar     *object_path,
+		    const gchar     *interface_name,
+		    const gchar     *signal_name,
+		    GVariant        *parameters,
+		    gpointer         user_data)
+{
+	if (bench.launch_time == 0 || bench.has_signal)
+		return;
+	bench.has_signal = TRUE;
+	bench.signal_time = g_get_monotonic_time ();
+	g_main_loop_quit (bench.loop);
+}
+
+static gboolean
+startup_timeout (gpointer user_data)
+{
+	guint *id = user_data;
+
+	*id = 0;
+	g_main_loop_quit (bench.loop);
+	return G_SOURCE_REMOVE;
+}
+
+/* Runs the main loop until @flag is @value, or the timeout */
+static gboolean
+wait_for (gboolean *flag,
+	  gboolean  value)
+{
+	guint id;
+
+	id = g_timeout_add (STARTUP_TIMEOUT, startup_timeout, &id);
+	while (*flag != value && id != 0)
+		g_main_loop_run (bench.loop);
+	g_clear_handle_id (&id, g_source_remove);
+
+	return *flag == value;
+}
+
+static void
+add_decoys (UMockdevTestbed *testbed,
+	    guint            n_devices)
+{
+	guint i;
+
+	for (i = 0; i < n_devices; i++) {
+		g_autofree char *name = NULL;
+		g_autofree char *parent = NULL;
+		g_autofree char *input = NULL;
+		g_autofree char *event = NULL;
+		g_autofree char *devname = NULL;
+
+		switch (i % 3) {
+		case 0:
+			/* Buffered accelerometers without a trigger make
+			 * iio-buffer-accel look for one, and fall through */
+			name = g_strdup_printf ("iio:device%u", i);
+			g_free (umockdev_testbed_add_device (testbed, "iio", name, NULL,
+							     "name", "accel_3d",
+							     "in_accel_x_raw", "0",
+							     "in_accel_y_raw", "0",
+							     "in_accel_z_raw", "0",
+							     NULL,
+							     "IIO_SENSOR_PROXY_TYPE", "iio-buffer-accel",
+							     NULL));
+			/* And some unrelated triggers */
+			g_free (name);
+			name = g_strdup_printf ("trigger%u", i);
+			g_free (umockdev_testbed_add_device (testbed, "iio", name, NULL,
+							     "name", "gyro_3d-dev9999",
+							     NULL,
+							     NULL));
+			break;
+		case 1:
+			/* Joypad accelerometers make input-accel look for siblings */
+			name = g_strdup_printf ("joypad%u", i);
+			parent = umockdev_testbed_add_device (testbed, "platform", name, NULL,
+							      NULL,
+							      NULL);
+			input = g_strdup_printf ("input%u", i);
+			g_free (umockdev_testbed_add_device (testbed, "input", input, parent,
+							     "name", "Joypad",
+							     NULL,
+							     "ID_INPUT_JOYSTICK", "1",
+							     NULL));
+			event = g_strdup_printf ("event%u", i);
+			devname = g_strdup_printf ("/dev/input/event%u", i);
+			g_free (umockdev_testbed_add_device (testbed, "input", event, parent,
+							     NULL,
+							     "DEVNAME", devname,
+							     "IIO_SENSOR_PROXY_TYPE", "input-accel",
+							     NULL));
+			break;
+		case 2:
+			name = g_strdup_printf ("dock-port%u", i);
+			g_free (umockdev_testbed_add_device (testbed, "platform", name, NULL,
+							     NULL,
+							     NULL));
+			break;
+		default:
+			g_assert_not_reached ();
+		}
+	}
+}
+
+static void
+add_sensor (UMockdevTestbed *testbed)
+{
+	g_free (umockdev_testbed_add_device (testbed, "iio", "iio:device99999", NULL,
+					     "name", "accel_3d",
+					     "in_accel_x_raw", "0",
+					     "in_accel_y_raw", "256",
+					     "in_accel_z_raw", "0",
+					     "in_accel_scale", "0.038",
+					     NULL,
+					     "IIO_SENSOR_PROXY_TYPE", "iio-poll-accel",
+					     NULL));
+}
+
+/* Launches the daemon against a testbed with @n_devices, and returns
+ * whether it published its sensor in time */
+static gboolean
+time_startup (const char *daemon_path,
+	      const char *address,
+	      int         n_devices)
+{
+	g_autoptr(UMockdevTestbed) testbed = NULL;
+	g_autoptr(GSubprocessLauncher) launcher = NULL;
+	g_autoptr(GSubprocess) daemon = NULL;
+	g_autoptr(GError) error = NULL;
+	gboolean ret = FALSE;
+
+	testbed = umockdev_testbed_new ();
+	add_decoys (testbed, n_devices);
+	/* Last, so that all the decoys get looked at first */
+	add_sensor (testbed);
+
+	launcher = bench_daemon_launcher_new (address);
+	bench.has_signal = FALSE;
+	bench.name_time = bench.signal_time = 0;
+	bench.launch_time = g_get_monotonic_time ();
+	daemon = g_subprocess_launcher_spawn (launcher, &error, daemon_path, NULL);
+	if (!daemon) {
+		g_printerr ("Could not start %s: %s\n", daemon_path, error->message);
+		bench.launch_time = 0;
+		return FALSE;
+	}
+
+	/* The name is always acquired before the first signal */
+	if (!wait_for (&bench.has_owner, TRUE))
+		g_printerr ("Daemon did not appear on the bus with %d devices\n", n_devices);
+	else if (!wait_for (&bench.has_signal, TRUE))
+		g_printerr ("Daemon did not publish its sensor with %d devices\n", n_devices);
+	else
+		ret = TRUE;
+
+	if (ret) {
+		g_print ("%d\t%lf\t%lf\n", n_devices,
+			 (bench.name_time - bench.launch_time) / (double) G_USEC_PER_SEC,
+			 (bench.signal_time - bench.launch_time) / (double) G_USEC_PER_SEC);
+	}
+	bench.launch_time = 0;
+
+	/* So that the next one doesn't get this one's name */
+	bench_daemon_stop (daemon);
+	if (!wait_for (&bench.has_owner, FALSE)) {
+		g_printerr ("Daemon did not leave the bus\n");
+		return FALSE;
+	}
+
+	return ret;
+}
+
+int main (int argc, char **argv)
+{
+	g_autoptr(GOptionContext) option_context = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GTestDBus) test_bus = NULL;
+	g_autoptr(GDBusConnection) connection = NULL;
+	g_autofree char *daemon_path = NULL;
+	const char *address;
+	guint subscription_id, watch_id;
+	int max_devices = 2048;
+	int min_devices = 16;
+	int n_devices;
+	int ret = 1;
+	const GOptionEntry options[] = {
+		{ "min-devices", 0, 0, G_OPTION_ARG_INT, &min_devices, "Smallest number of devices", NULL },
+		{ "max-devices", 0, 0, G_OPTION_ARG_INT, &max_devices, "Largest number of devices", NULL },
+		{ "daemon", 0, 0, G_OPTION_ARG_FILENAME, &daemon_path, "Path to iio-sensor-proxy", NULL },
+		{ NULL}
+	};
+
+	option_context = g_option_context_new ("");
+	g_option_context_add_main_entries (option_context, options, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+		g_print ("Failed to parse arguments: %s\n", error->message);
+		return 1;
+	}
+
+	if (!umockdev_in_mock_environment ()) {
+		g_printerr ("Needs to be run under umockdev-wrapper\n");
+		return 1;
+	}
+
+	if (daemon_path == NULL)
+		daemon_path = bench_daemon_get_path (argv[0]);
+
+	test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_test_dbus_up (test_bus);
+	address = g_test_dbus_get_bus_address (test_bus);
+
+	connection = bench_daemon_connect (address, &error);
+	if (!connection) {
+		g_printerr ("Could not connect to test bus: %s\n", error->message);
+		goto out;
+	}
+
+	bench.loop = g_main_loop_new (NULL, FALSE);
+	watch_id = g_bus_watch_name_on_connection (connection, SENSOR_PROXY_DBUS_NAME,
+						   G_BUS_NAME_WATCHER_FLAGS_NONE,
+						   name_appeared, name_vanished,
+						   NULL, NULL);
+	subscription_id = g_dbus_connection_signal_subscribe (connection,
+							      SENSOR_PROXY_DBUS_NAME,
+							      "org.freedesktop.DBus.Properties",
+							      "PropertiesChanged",
+							      SENSOR_PROXY_DBUS_PATH,
+							      NULL,
+							      G_DBUS_SIGNAL_FLAGS_NONE,
+							      properties_changed,
+							      NULL, NULL);
+
+	g_print ("# devices\tname seconds\tsignal seconds\n");
+	for (n_devices = MAX (min_devices, 1); n_devices <= max_devices; n_devices *= 2) {
+		if (!time_startup (daemon_path, address, n_devices))
+			break;
+	}
+	ret = n_devices > max_devices ? 0 : 1;
+
+	g_dbus_connection_signal_unsubscribe (connection, subscription_id);
+	g_bus_unwatch_name (watch_id);
+	g_clear_pointer (&bench.loop, g_main_loop_unref);
+
+out:
+	g_clear_object (&connection);
+	g_test_dbus_down (test_bus);
+
+	return ret;
+}
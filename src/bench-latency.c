@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+/*
+ * Measures the time between a reading being made by a fake sensor, and
+ * clients receiving the PropertiesChanged signal for it.
+ *
+ * The daemon runs on a private bus, against a umockdev testbed with only a
+ * power button, which the fake light and a replayed accelerometer attach to.
+ * The fake light sends the time of its readings as the light level. The
+ * accelerometer trace flips between two orientations at a known pace from
+ * the first claim, so its latencies also include the time the claim takes
+ * to reach the daemon.
+ *
+ * Needs to be run under umockdev-wrapper:
+ * $ umockdev-wrapper ./bench-latency --clients 50 --duration 30
+ */
+
+#include <umockdev.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench-daemon.h"
+#include "sensor-trace.h"
+
+/* How often the replayed accelerometer changes orientation, in ms */
+#define FLIP_INTERVAL 200
+#define ONEG          256
+
+/* How long to wait for the daemon to find its sensors, in ms */
+#define STARTUP_TIMEOUT 10000
+
+typedef struct {
+	GDBusConnection *connection;
+	guint            subscription_id;
+	char            *orientation;
+	/* The next trace sample to cause an orientation change */
+	guint            next_sample;
+} Client;
+
+typedef struct {
+	GMainLoop       *loop;
+	gint64           claim_time;
+	guint            pending_claims;
+	GArray          *light_latencies;
+	GArray          *accel_latencies;
+} Bench;
+
+static Bench bench;
+
+static gboolean
+write_trace (const char  *path,
+	     int          duration,
+	     GError     **error)
+{
+	SensorTraceHeader header = { 0, };
+	SensorTraceWriter *writer;
+	guint i, n_samples;
+
+	header.type = DRIVER_TYPE_ACCEL;
+	header.location = ACCEL_LOCATION_DISPLAY;
+	header.n_channels = 3;
+	header.sampling_frequency = 1000.0 / FLIP_INTERVAL;
+	g_strlcpy (header.channels[0], "in_accel_x", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	g_strlcpy (header.channels[1], "in_accel_y", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	g_strlcpy (header.channels[2], "in_accel_z", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	header.scales[0] = header.scales[1] = header.scales[2] = 9.81 / ONEG;
+	header.mount_matrix[0].x = 1.0;
+	header.mount_matrix[1].y = 1.0;
+	header.mount_matrix[2].z = 1.0;
+
+	writer = sensor_trace_writer_new (path, &header, error);
+	if (!writer)
+		return FALSE;
+
+	/* "normal" for even samples, "left-up" for odd ones */
+	n_samples = duration * 1000 / FLIP_INTERVAL + 1;
+	for (i = 0; i < n_samples; i++) {
+		gint64 timestamp = i * (gint64) FLIP_INTERVAL * 1000;
+		int values[3] = { 0, 0, 0 };
+
+		if (i % 2 == 0)
+			values[1] = -ONEG;
+		else
+			values[0] = ONEG;
+		sensor_trace_writer_add (writer, &timestamp, values, 1);
+	}
+
+	sensor_trace_writer_free (writer);
+	return TRUE;
+}
+
+static void
+add_latency (GArray *latencies,
+	     gint64  injected,
+	     gint64  received)
+{
+	gint64 latency = received - injected;
+
+	g_array_append_val (latencies, latency);
+}
+
+static void
+orientation_changed (Client     *client,
+		     const char *orientation,
+		     gint64      now)
+{
+	guint sample;
+
+	if (g_strcmp0 (orientation, client->orientation) == 0)
+		return;
+	g_free (client->orientation);
+	client->orientation = g_strdup (orientation);
+
+	if (g_str_equal (orientation, "normal"))
+		sample = client->next_sample + (client->next_sample % 2);
+	else if (g_str_equal (orientation, "left-up"))
+		sample = client->next_sample + 1 - (client->next_sample % 2);
+	else
+		return;
+
+	add_latency (bench.accel_latencies,
+		     bench.claim_time + sample * (gint64) FLIP_INTERVAL * 1000, now);
+	client->next_sample = sample + 1;
+}
+
+static void
+properties_changed (GDBusConnection *connection,
+		    const gchar     *sender_name,
+		    const gchar     *object_path,
+		    const gchar     *interface_name,
+		    const gchar     *signal_name,
+		    GVariant        *parameters,
+		    gpointer         user_data)
+{
+	Client *client = user_data;
+	g_autoptr(GVariant) changed = NULL;
+	const char *orientation;
+	gint64 now;
+	gdouble level;
+
+	now = g_get_monotonic_time ();
+	if (bench.claim_time == 0)
+		return;
+
+	changed = g_variant_get_child_value (parameters, 1);
+
+	/* The light level is the time of the reading, in ms */
+	if (g_variant_lookup (changed, "LightLevel", "d", &level) &&
+	    level * 1000 >= bench.claim_time)
+		add_latency (bench.light_latencies, level * 1000, now);
+
+	if (g_variant_lookup (changed, "AccelerometerOrientation", "&s", &orientation))
+		orientation_changed (client, orientation, now);
+}
+
+static void
+claim_done (GObject      *source_object,
+	    GAsyncResult *res,
+	    gpointer      user_data)
+{
+	g_autoptr(GVariant) ret = NULL;
+	g_autoptr(GError) error = NULL;
+
+	ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+	if (!ret)
+		g_printerr ("Claim failed: %s\n", error->message);
+	bench.pending_claims--;
+}
+
+static void
+claim (Client     *client,
+       const char *method)
+{
+	g_dbus_connection_call (client->connection, SENSOR_PROXY_DBUS_NAME, SENSOR_PROXY_DBUS_PATH,
+				SENSOR_PROXY_DBUS_NAME, method, NULL, NULL,
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, claim_done, NULL);
+	bench.pending_claims++;
+}
+
+static Client *
+client_new (const char  *address,
+	    GError     **error)
+{
+	Client *client;
+	GDBusConnection *connection;
+
+	connection = bench_daemon_connect (address, error);
+	if (!connection)
+		return NULL;
+
+	client = g_new0 (Client, 1);
+	client->connection = connection;
+	client->subscription_id = g_dbus_connection_signal_subscribe (connection,
+								      SENSOR_PROXY_DBUS_NAME,
+								      "org.freedesktop.DBus.Properties",
+								      "PropertiesChanged",
+								      SENSOR_PROXY_DBUS_PATH,
+								      NULL,
+								      G_DBUS_SIGNAL_FLAGS_NONE,
+								      properties_changed,
+								      client, NULL);
+	return client;
+}
+
+static void
+client_free (Client *client)
+{
+	g_dbus_connection_signal_unsubscribe (client->connection, client->subscription_id);
+	g_object_unref (client->connection);
+	g_free (client->orientation);
+	g_free (client);
+}
+
+/* Once the daemon has opened the fake light and the replayed accelerometer */
+static gboolean
+wait_for_sensors (GDBusConnection *connection)
+{
+	gint64 deadline;
+
+	deadline = g_get_monotonic_time () + STARTUP_TIMEOUT * 1000;
+	while (g_get_monotonic_time () < deadline) {
+		g_autoptr(GVariant) ret = NULL;
+		g_autoptr(GVariant) props = NULL;
+		gboolean has_accel = FALSE, has_als = FALSE;
+
+		ret = g_dbus_connection_call_sync (connection, SENSOR_PROXY_DBUS_NAME, SENSOR_PROXY_DBUS_PATH,
+						   "org.freedesktop.DBus.Properties", "GetAll",
+						   g_variant_new ("(s)", SENSOR_PROXY_DBUS_NAME),
+						   G_VARIANT_TYPE ("(a{sv})"),
+						   G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+		if (ret) {
+			props = g_variant_get_child_value (ret, 0);
+			g_variant_lookup (props, "HasAccelerometer", "b", &has_accel);
+			g_variant_lookup (props, "HasAmbientLight", "b", &has_als);
+			if (has_accel && has_als)
+				return TRUE;
+		}
+
+		g_usleep (100 * 1000);
+	}
+
+	return FALSE;
+}
+
+/* In seconds, from /proc/PID/stat */
+static gboolean
+get_cpu_time (const char *pid,
+	      double     *user,
+	      double     *system)
+{
+	g_autofree char *path = NULL;
+	g_autofree char *contents = NULL;
+	g_auto(GStrv) fields = NULL;
+	const char *end;
+
+	path = g_strdup_printf ("/proc/%s/stat", pid);
+	if (!g_file_get_contents (path, &contents, NULL, NULL))
+		return FALSE;
+
+	/* The fields after the command name, the first being the state */
+	end = strrchr (contents, ')');
+	if (!end)
+		return FALSE;
+	fields = g_strsplit (end + 2, " ", -1);
+	if (g_strv_length (fields) < 13)
+		return FALSE;
+
+	*user = (double) g_ascii_strtoull (fields[11], NULL, 10) / sysconf (_SC_CLK_TCK);
+	*system = (double) g_ascii_strtoull (fields[12], NULL, 10) / sysconf (_SC_CLK_TCK);
+	return TRUE;
+}
+
+static int
+compare_latencies (gconstpointer a,
+		   gconstpointer b)
+{
+	gint64 la = *(const gint64 *) a;
+	gint64 lb = *(const gint64 *) b;
+
+	return (la > lb) - (la < lb);
+}
+
+/* Nearest-rank percentile, of sorted latencies */
+static double
+percentile (GArray *latencies,
+	    double  p)
+{
+	guint rank;
+
+	rank = MAX ((guint) (p * latencies->len + 0.999999), 1);
+	return g_array_index (latencies, gint64, rank - 1) / 1000.0;
+}
+
+static void
+print_latencies (const char *name,
+		 GArray     *latencies)
+{
+	if (latencies->len == 0) {
+		g_print ("%s: no signals received\n", name);
+		return;
+	}
+
+	g_array_sort (latencies, compare_latencies);
+	g_print ("%s: %u signals, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", name,
+		 latencies->len, percentile (latencies, 0.50), percentile (latencies, 0.99),
+		 g_array_index (latencies, gint64, latencies->len - 1) / 1000.0);
+}
+
+static gboolean
+stop_bench (gpointer user_data)
+{
+	g_main_loop_quit (bench.loop);
+	return G_SOURCE_REMOVE;
+}
+
+int main (int argc, char **argv)
+{
+	g_autoptr(GOptionContext) option_context = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(UMockdevTestbed) testbed = NULL;
+	g_autoptr(GTestDBus) test_bus = NULL;
+	g_autoptr(GSubprocessLauncher) launcher = NULL;
+	g_autoptr(GSubprocess) daemon = NULL;
+	g_autoptr(GPtrArray) clients = NULL;
+	g_autofree char *daemon_path = NULL;
+	g_autofree char *trace_dir = NULL;
+	g_autofree char *trace_path = NULL;
+	const char *address;
+	double user_start = 0.0, system_start = 0.0, user_end = 0.0, system_end = 0.0;
+	int n_clients = 10;
+	int duration = 10;
+	int ret = 1;
+	int i;
+	const GOptionEntry options[] = {
+		{ "clients", 0, 0, G_OPTION_ARG_INT, &n_clients, "Number of clients", NULL },
+		{ "duration", 0, 0, G_OPTION_ARG_INT, &duration, "Duration of the run, in seconds", NULL },
+		{ "daemon", 0, 0, G_OPTION_ARG_FILENAME, &daemon_path, "Path to iio-sensor-proxy", NULL },
+		{ NULL}
+	};
+
+	option_context = g_option_context_new ("");
+	g_option_context_add_main_entries (option_context, options, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+		g_print ("Failed to parse arguments: %s\n", error->message);
+		return 1;
+	}
+
+	if (!umockdev_in_mock_environment ()) {
+		g_printerr ("Needs to be run under umockdev-wrapper\n");
+		return 1;
+	}
+
+	if (daemon_path == NULL)
+		daemon_path = bench_daemon_get_path (argv[0]);
+
+	/* The device the fake sensors attach to, and nothing else */
+	testbed = umockdev_testbed_new ();
+	g_free (umockdev_testbed_add_device (testbed, "input", "input1", NULL,
+					     "name", "Power Button",
+					     NULL,
+					     "NAME", "\"Power Button\"",
+					     NULL));
+
+	trace_dir = g_dir_make_tmp ("iio-sensor-proxy-XXXXXX", &error);
+	if (!trace_dir) {
+		g_printerr ("%s\n", error->message);
+		return 1;
+	}
+	trace_path = g_build_filename (trace_dir, "flips.trace", NULL);
+	if (!write_trace (trace_path, duration, &error)) {
+		g_printerr ("%s\n", error->message);
+		goto out;
+	}
+
+	test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_test_dbus_up (test_bus);
+	address = g_test_dbus_get_bus_address (test_bus);
+
+	launcher = bench_daemon_launcher_new (address);
+	g_subprocess_launcher_setenv (launcher, "FAKE_LIGHT_SENSOR", "timestamps", TRUE);
+	daemon = g_subprocess_launcher_spawn (launcher, &error, daemon_path,
+					      "--replay-trace", trace_path, NULL);
+	if (!daemon) {
+		g_printerr ("Could not start %s: %s\n", daemon_path, error->message);
+		goto out;
+	}
+
+	bench.loop = g_main_loop_new (NULL, FALSE);
+	bench.light_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+	bench.accel_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+	clients = g_ptr_array_new_with_free_func ((GDestroyNotify) client_free);
+	for (i = 0; i < MAX (n_clients, 1); i++) {
+		Client *client;
+
+		client = client_new (address, &error);
+		if (!client) {
+			g_printerr ("Could not connect to test bus: %s\n", error->message);
+			goto out;
+		}
+		g_ptr_array_add (clients, client);
+	}
+
+	if (!wait_for_sensors (((Client *) g_ptr_array_index (clients, 0))->connection)) {
+		g_printerr ("Daemon did not find the fake sensors\n");
+		goto out;
+	}
+
+	get_cpu_time (g_subprocess_get_identifier (daemon), &user_start, &system_start);
+
+	bench.claim_time = g_get_monotonic_time ();
+	for (i = 0; i < (int) clients->len; i++) {
+		claim (g_ptr_array_index (clients, i), "ClaimAccelerometer");
+		claim (g_ptr_array_index (clients, i), "ClaimLight");
+	}
+
+	g_timeout_add_seconds (duration, stop_bench, NULL);
+	g_main_loop_run (bench.loop);
+
+	get_cpu_time (g_subprocess_get_identifier (daemon), &user_end, &system_end);
+
+	g_print ("%u clients, %d seconds\n", clients->len, duration);
+	print_latencies ("Light", bench.light_latencies);
+	print_latencies ("Accelerometer", bench.accel_latencies);
+	g_print ("Daemon CPU time: %.3f s user, %.3f s system\n",
+		 user_end - user_start, system_end - system_start);
+	if (bench.pending_claims > 0)
+		g_print ("%u claims not replied to\n", bench.pending_claims);
+
+	ret = 0;
+
+out:
+	g_clear_pointer (&clients, g_ptr_array_unref);
+	if (daemon)
+		bench_daemon_stop (daemon);
+	if (test_bus)
+		g_test_dbus_down (test_bus);
+	g_remove (trace_path);
+	g_rmdir (trace_dir);
+
+	return ret;
+}
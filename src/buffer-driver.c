@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+/*
+ * The parts common to all the buffered IIO drivers: finding the trigger,
+ * setting up the buffer and its channels, reading it with the capture group
+ * and decoding the scans. The drivers themselves are a BufferDriverSpec
+ * and the conversion of the channel values to readings.
+ */
+
+#include "buffer-driver.h"
+#include "capture-group.h"
+#include "time-source.h"
+
+#include <errno.h>
+#include <string.h>
+
+gboolean
+buffer_driver_discover (const BufferDriverSpec *spec,
+			GUdevDevice            *device)
+{
+	g_autofree char *trigger_name = NULL;
+
+	if (!drv_check_udev_sensor_type (device, spec->udev_type, NULL))
+		return FALSE;
+
+	/* If we can't find an associated trigger, or create one, fallback
+	 * to the polling driver. If the device doesn't accept the one we
+	 * create, opening fails, and the polling driver is used instead */
+	trigger_name = get_trigger_name (device, spec->trigger_prefix);
+	if (!trigger_name &&
+	    (spec->needs_trigger || !hrtimer_trigger_available (device)))
+		return FALSE;
+
+	g_debug ("Found %s at %s", spec->driver->name, g_udev_device_get_sysfs_path (device));
+	return TRUE;
+}
+
+static gboolean
+find_channels (BufferDriver *driver)
+{
+	const BufferDriverSpec *spec = driver->spec;
+	guint i, j;
+
+	for (i = 0; i < BUFFER_DRIVER_MAX_CHANNELS && spec->channels[i][0] != NULL; i++) {
+		const char *name = NULL;
+
+		for (j = 0; j < BUFFER_DRIVER_MAX_ALTERNATIVES && spec->channels[i][j] != NULL && !name; j++)
+			name = buffer_drv_data_find_channel (driver->buffer_data, spec->channels[i][j]);
+
+		if (!name) {
+			g_warning ("No %s channel in buffer for %s", spec->channels[i][0],
+				   g_udev_device_get_sysfs_path (driver->dev));
+			return FALSE;
+		}
+
+		driver->channel_names[i] = name;
+		driver->channels[i] = buffer_drv_data_get_channel_index (driver->buffer_data, name);
+		buffer_drv_data_get_scale (driver->buffer_data, name, &driver->scales[i]);
+		g_debug ("Using channel %s for %s", name, spec->driver->name);
+	}
+
+	driver->n_channels = i;
+	return TRUE;
+}
+
+/* Traces have the raw channel values, and what's needed to turn
+ * them into readings, see sensor-trace.c */
+static void
+start_trace (BufferDriver *driver)
+{
+	SensorTraceHeader header = { 0, };
+	guint i;
+
+	header.type = driver->spec->driver->type;
+	header.location = setup_accel_location (driver->dev);
+	header.n_channels = driver->n_channels;
+	header.sampling_frequency = driver->sampling_frequency;
+	for (i = 0; i < driver->n_channels; i++) {
+		g_strlcpy (header.channels[i], driver->channel_names[i], SENSOR_TRACE_CHANNEL_NAME_LEN);
+		header.scales[i] = driver->scales[i];
+	}
+	if (driver->mount_matrix) {
+		memcpy (header.mount_matrix, driver->mount_matrix, sizeof (header.mount_matrix));
+	} else {
+		header.mount_matrix[0].x = 1.0;
+		header.mount_matrix[1].y = 1.0;
+		header.mount_matrix[2].z = 1.0;
+	}
+
+	driver->trace = sensor_trace_start_recording (driver->dev, &header);
+}
+
+static void
+free_driver (BufferDriver *driver)
+{
+	g_clear_pointer (&driver->trace, sensor_trace_writer_free);
+	g_clear_pointer (&driver->buffer_data, buffer_drv_data_free);
+	g_clear_object (&driver->dev);
+	g_free (driver->values);
+	g_free (driver->timestamps);
+	g_free (driver->mount_matrix);
+	g_free (driver->priv);
+	g_free (driver);
+}
+
+BufferDriver *
+buffer_driver_open (const BufferDriverSpec *spec,
+		    GUdevDevice            *device,
+		    ReadingsUpdateFunc      callback_func,
+		    gpointer                user_data)
+{
+	g_autofree char *trigger_name = NULL;
+	BufferDriver *driver;
+
+	/* Get the trigger name, and build the channels from that,
+	 * or use a software trigger */
+	trigger_name = get_trigger_name (device, spec->trigger_prefix);
+	if (!trigger_name && spec->needs_trigger)
+		return NULL;
+
+	if (spec->sampling_frequency > 0)
+		iio_raise_sampling_frequency (device, spec->sampling_frequency);
+
+	driver = g_new0 (BufferDriver, 1);
+	driver->spec = spec;
+	driver->dev = g_object_ref (device);
+	driver->name = g_udev_device_get_property (device, "NAME");
+	if (!driver->name)
+		driver->name = g_udev_device_get_name (device);
+	driver->callback_func = callback_func;
+	driver->user_data = user_data;
+	if (spec->priv_size > 0)
+		driver->priv = g_malloc0 (spec->priv_size);
+
+	driver->buffer_data = buffer_drv_data_new (device, trigger_name);
+	if (!driver->buffer_data ||
+	    !find_channels (driver)) {
+		free_driver (driver);
+		return NULL;
+	}
+
+	driver->sampling_frequency = buffer_drv_data_get_sampling_frequency (driver->buffer_data);
+	driver->timestamp_channel = spec->timestamps ? driver->buffer_data->timestamp_channel : -1;
+
+	if (spec->open && !spec->open (driver, device)) {
+		free_driver (driver);
+		return NULL;
+	}
+
+	start_trace (driver);
+
+	return driver;
+}
+
+static void
+get_timestamps (BufferDriver *driver,
+		const char   *scans,
+		guint         n_scans)
+{
+	gint64 now, period;
+	guint i;
+
+	if (driver->timestamp_channel >= 0) {
+		process_scan_timestamps (scans, n_scans, driver->buffer_data,
+					 driver->timestamp_channel, driver->timestamps);
+		for (i = 0; i < n_scans; i++)
+			driver->timestamps[i] /= 1000;
+		return;
+	}
+
+	/* The last scan is from around now, and the others are
+	 * spaced out before it at the sampling frequency */
+	now = time_source_get_time ();
+	period = G_USEC_PER_SEC / driver->sampling_frequency;
+	for (i = 0; i < n_scans; i++)
+		driver->timestamps[i] = now - (n_scans - 1 - i) * period;
+}
+
+static void
+scans_read (IIOSensorData data,
+	    gpointer      user_data)
+{
+	BufferDriver *driver = user_data;
+	const char *scans;
+	guint n_scans;
+
+	if (data.read_size < 0) {
+		g_warning ("Couldn't read from device '%s': %s", driver->name, g_strerror (errno));
+		return;
+	}
+
+	n_scans = data.read_size / driver->buffer_data->scan_size;
+	if (n_scans == 0) {
+		g_debug ("Not enough data to read from '%s' (read_size: %d scan_size: %d)", driver->name,
+			 (int) data.read_size, driver->buffer_data->scan_size);
+		return;
+	}
+
+	scans = data.data;
+	if (driver->spec->latest_only) {
+		scans += driver->buffer_data->scan_size * (n_scans - 1);
+		n_scans = 1;
+	}
+
+	if (n_scans > driver->max_scans) {
+		driver->values = g_renew (int, driver->values, n_scans * driver->n_channels);
+		if (driver->spec->timestamps || driver->trace)
+			driver->timestamps = g_renew (gint64, driver->timestamps, n_scans);
+		driver->max_scans = n_scans;
+	}
+
+	process_scans (scans, n_scans, driver->buffer_data,
+		       driver->channels, driver->n_channels, driver->values);
+	if (driver->spec->timestamps || driver->trace)
+		get_timestamps (driver, scans, n_scans);
+	if (driver->trace)
+		sensor_trace_writer_add (driver->trace, driver->timestamps, driver->values, n_scans);
+	driver->spec->process (driver, driver->values, n_scans);
+}
+
+/* Returns FALSE if the buffer couldn't be enabled, in which
+ * case the sensor is left stopped */
+gboolean
+buffer_driver_set_polling (BufferDriver *driver,
+			   gboolean      state)
+{
+	if (driver->buffer_data->enabled == state)
+		return TRUE;
+
+	if (!state) {
+		capture_group_leave (driver->buffer_data);
+		if (driver->spec->set_polling)
+			driver->spec->set_polling (driver, FALSE);
+		return TRUE;
+	}
+
+	if (driver->spec->set_polling)
+		driver->spec->set_polling (driver, TRUE);
+
+	/* Read along with the other sensors on the same chip,
+	 * with a first reading as soon as there is one */
+	if (!capture_group_join (driver->buffer_data, driver->spec->interval, scans_read, driver)) {
+		g_warning ("Could not enable buffer for '%s'", driver->name);
+		if (driver->spec->set_polling)
+			driver->spec->set_polling (driver, FALSE);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Changes how often the buffer is read, while polling */
+void
+buffer_driver_set_interval (BufferDriver *driver,
+			    guint         interval)
+{
+	capture_group_set_interval (driver->buffer_data, interval);
+}
+
+void
+buffer_driver_send (BufferDriver *driver,
+		    gpointer      readings)
+{
+	//FIXME report errors
+	driver->callback_func (driver->spec->driver, readings, driver->user_data);
+}
+
+/* Gets the values of the driver's channels in @scan, one of the scans
+ * read by the driver's capture group, see capture_group_add_tuple_func() */
+void
+buffer_driver_decode_scan (BufferDriver *driver,
+			   const char   *scan,
+			   int          *values)
+{
+	process_scans (scan, 1, driver->buffer_data,
+		       driver->channels, driver->n_channels, values);
+}
+
+void
+buffer_driver_close (BufferDriver *driver)
+{
+	buffer_driver_set_polling (driver, FALSE);
+	if (driver->spec->close)
+		driver->spec->close (driver);
+	free_driver (driver);
+}
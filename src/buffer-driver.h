@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include "drivers.h"
+#include "iio-buffer-utils.h"
+#include "accel-mount-matrix.h"
+#include "sensor-trace.h"
+
+#define BUFFER_DRIVER_MAX_CHANNELS     3
+#define BUFFER_DRIVER_MAX_ALTERNATIVES 4
+
+typedef struct BufferDriver BufferDriver;
+
+/* Describes a buffered IIO sensor, the engine taking care of the trigger,
+ * the buffer, reading it along with the other sensors on the same chip,
+ * and decoding the scans */
+typedef struct {
+	SensorDriver *driver;
+	/* The IIO_SENSOR_PROXY_TYPE udev property */
+	const char   *udev_type;
+	/* The prefix of the device's own trigger, eg. "accel_3d" */
+	const char   *trigger_prefix;
+	/* Don't fall back to an hrtimer trigger */
+	gboolean      needs_trigger;
+	/* The channels, with their alternatives in order of preference, as
+	 * found by buffer_drv_data_find_channel(), in the order their values
+	 * are passed to process() */
+	const char   *channels[BUFFER_DRIVER_MAX_CHANNELS][BUFFER_DRIVER_MAX_ALTERNATIVES];
+	/* Only the most recent scan is decoded and processed */
+	gboolean      latest_only;
+	/* Also get the time of each scan, in BufferDriver's timestamps */
+	gboolean      timestamps;
+	/* The lowest rate the device should sample at, in Hz, or 0 */
+	int           sampling_frequency;
+	/* How often to read the buffer, in ms */
+	guint         interval;
+	/* The size of BufferDriver's priv */
+	gsize         priv_size;
+
+	/* All optional, except process() */
+	gboolean    (*open)        (BufferDriver *driver,
+				    GUdevDevice  *device);
+	void        (*set_polling) (BufferDriver *driver,
+				    gboolean      state);
+	void        (*process)     (BufferDriver *driver,
+				    const int    *values,
+				    guint         n_scans);
+	void        (*close)       (BufferDriver *driver);
+} BufferDriverSpec;
+
+struct BufferDriver {
+	const BufferDriverSpec *spec;
+	ReadingsUpdateFunc      callback_func;
+	gpointer                user_data;
+
+	GUdevDevice            *dev;
+	const char             *name;
+	BufferDrvData          *buffer_data;
+	guint                   n_channels;
+	const char             *channel_names[BUFFER_DRIVER_MAX_CHANNELS];
+	int                     channels[BUFFER_DRIVER_MAX_CHANNELS];
+	gdouble                 scales[BUFFER_DRIVER_MAX_CHANNELS];
+	int                    *values;
+	guint                   max_scans;
+	/* In µs, on the g_get_monotonic_time() clock */
+	gint64                 *timestamps;
+	int                     timestamp_channel;
+	float                   sampling_frequency;
+	/* Set by open() for sensors with a mount matrix, for traces */
+	AccelVec3              *mount_matrix;
+	SensorTraceWriter      *trace;
+
+	/* The sensor's own data */
+	gpointer                priv;
+};
+
+gboolean      buffer_driver_discover     (const BufferDriverSpec *spec,
+					  GUdevDevice            *device);
+BufferDriver *buffer_driver_open         (const BufferDriverSpec *spec,
+					  GUdevDevice            *device,
+					  ReadingsUpdateFunc      callback_func,
+					  gpointer                user_data);
+gboolean      buffer_driver_set_polling  (BufferDriver           *driver,
+					  gboolean                state);
+void          buffer_driver_set_interval (BufferDriver           *driver,
+					  guint                   interval);
+void          buffer_driver_send         (BufferDriver           *driver,
+					  gpointer                readings);
+void          buffer_driver_close        (BufferDriver           *driver);
+void          buffer_driver_decode_scan  (BufferDriver           *driver,
+					  const char             *scan,
+					  int                    *values);
+
+/* In drv-iio-buffer-accel.c */
+gboolean      iio_buffer_accel_get_gravity (BufferDrvData        *buffer_data,
+					    const char           *scan,
+					    double                gravity[3]);
@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+/*
+ * Buffered sensors on the same chip or sensor hub are grouped, so that
+ * they tick on a single trigger and get read in the same wakeup, rather
+ * than each with its own trigger and timer. Consumers that need samples
+ * from several sensors at the same time, such as a tilt-compensated
+ * compass, can get them as tuples.
+ */
+
+#include "capture-group.h"
+#include "scan-pairing.h"
+#include "wakeup-scheduler.h"
+#include "time-source.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+#define CAPTURE_MAX_SCANS 127
+#define CAPTURE_GROUP     "IIO_SENSOR_PROXY_CAPTURE_GROUP"
+
+typedef struct {
+	BufferDrvData    *buffer_data;
+	guint             interval;
+	CaptureScansFunc  func;
+	gpointer          user_data;
+	gboolean          shares_trigger;
+
+	/* The time between two scans, in µs */
+	gint64            period;
+
+	/* The scans read in the current wakeup, and their
+	 * timestamps, in µs, if the device has them */
+	char             *data;
+	ssize_t           read_size;
+	gint64           *timestamps;
+} CaptureMember;
+
+typedef struct {
+	guint             id;
+	CaptureTupleFunc  func;
+	gpointer          user_data;
+} CaptureListener;
+
+typedef struct {
+	char             *key;
+	GPtrArray        *members;
+	GPtrArray        *listeners;
+	char             *trigger_name;
+	guint             interval;
+	guint             timeout_id;
+	guint             first_read_id;
+} CaptureGroup;
+
+/* Only used from the main thread: drivers join groups in set_polling(),
+ * and must not register tuple functions from open(), which runs in a
+ * worker thread */
+static GHashTable *groups = NULL;
+static guint next_listener_id = 1;
+
+static gboolean
+is_hid_sensor (GUdevDevice *parent)
+{
+	return g_str_has_prefix (g_udev_device_get_name (parent), "HID-SENSOR-");
+}
+
+/* Sensors in a combo chip are siblings, whereas HID sensor hubs
+ * have a platform device per sensor, under the hub itself */
+static char *
+get_group_key (GUdevDevice *device)
+{
+	g_autoptr(GUdevDevice) parent = NULL;
+	const char *key;
+
+	key = g_udev_device_get_property (device, CAPTURE_GROUP);
+	if (key != NULL)
+		return g_strdup (key);
+
+	parent = g_udev_device_get_parent (device);
+	if (parent == NULL)
+		return g_strdup (g_udev_device_get_sysfs_path (device));
+
+	if (is_hid_sensor (parent)) {
+		g_autoptr(GUdevDevice) hub = NULL;
+
+		hub = g_udev_device_get_parent (parent);
+		if (hub != NULL)
+			return g_strdup (g_udev_device_get_sysfs_path (hub));
+	}
+
+	return g_strdup (g_udev_device_get_sysfs_path (parent));
+}
+
+static void
+capture_member_free (CaptureMember *member)
+{
+	g_free (member->data);
+	g_free (member->timestamps);
+	g_free (member);
+}
+
+static void
+capture_group_free (CaptureGroup *group)
+{
+	g_clear_handle_id (&group->timeout_id, wakeup_scheduler_remove);
+	g_clear_handle_id (&group->first_read_id, time_source_remove);
+	g_ptr_array_free (group->members, TRUE);
+	g_ptr_array_free (group->listeners, TRUE);
+	g_free (group->trigger_name);
+	g_free (group->key);
+	g_free (group);
+}
+
+static CaptureGroup *
+get_group (GUdevDevice *device)
+{
+	CaptureGroup *group;
+	char *key;
+
+	if (groups == NULL)
+		groups = g_hash_table_new_full (g_str_hash, g_str_equal,
+						NULL, (GDestroyNotify) capture_group_free);
+
+	key = get_group_key (device);
+	group = g_hash_table_lookup (groups, key);
+	if (group != NULL) {
+		g_free (key);
+		return group;
+	}
+
+	group = g_new0 (CaptureGroup, 1);
+	group->key = key;
+	group->members = g_ptr_array_new_with_free_func ((GDestroyNotify) capture_member_free);
+	group->listeners = g_ptr_array_new_with_free_func (g_free);
+	g_hash_table_insert (groups, group->key, group);
+
+	return group;
+}
+
+static void
+maybe_free_group (CaptureGroup *group)
+{
+	if (group->members->len > 0 || group->listeners->len > 0)
+		return;
+	g_hash_table_remove (groups, group->key);
+}
+
+static CaptureMember *
+find_member (BufferDrvData  *buffer_data,
+	     CaptureGroup  **group_out)
+{
+	GHashTableIter iter;
+	CaptureGroup *group;
+
+	if (groups == NULL)
+		return NULL;
+
+	g_hash_table_iter_init (&iter, groups);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &group)) {
+		guint i;
+
+		for (i = 0; i < group->members->len; i++) {
+			CaptureMember *member = g_ptr_array_index (group->members, i);
+
+			if (member->buffer_data != buffer_data)
+				continue;
+			if (group_out)
+				*group_out = group;
+			return member;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+read_member (CaptureMember *member)
+{
+	BufferDrvData *buffer_data = member->buffer_data;
+
+	member->read_size = read (buffer_data->dev_fd, member->data,
+				  CAPTURE_MAX_SCANS * buffer_data->scan_size);
+	if (member->read_size < 0 && errno == EAGAIN) {
+		g_debug ("No new data available on %s", buffer_data->dev_dir_name);
+		member->read_size = 0;
+	} else if (member->read_size < 0) {
+		g_warning ("Couldn't read from %s: %s", buffer_data->dev_dir_name, g_strerror (errno));
+		member->read_size = 0;
+	}
+}
+
+/* Whether the member samples when the group's trigger ticks. HID sensor
+ * hubs push scans from their own reports, whatever the trigger is */
+static gboolean
+samples_on_group_trigger (CaptureGroup  *group,
+			  BufferDrvData *buffer_data)
+{
+	g_autoptr(GUdevDevice) parent = NULL;
+
+	parent = g_udev_device_get_parent (buffer_data->device);
+	if (parent != NULL && is_hid_sensor (parent))
+		return FALSE;
+
+	return (buffer_data->shared_trigger_name != NULL ||
+		g_strcmp0 (group->trigger_name, buffer_data->trigger_name) == 0);
+}
+
+static gboolean
+group_shares_trigger (CaptureGroup *group)
+{
+	guint i;
+
+	for (i = 0; i < group->members->len; i++) {
+		CaptureMember *member = g_ptr_array_index (group->members, i);
+
+		if (!member->shares_trigger)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Sensors that don't sample on the group's trigger, such as the sensors
+ * of HID sensor hubs, are matched by the time of their scans */
+static gboolean
+get_timestamps (CaptureGroup *group,
+		gint64       *max_skew)
+{
+	guint i;
+
+	*max_skew = 0;
+	for (i = 0; i < group->members->len; i++) {
+		CaptureMember *member = g_ptr_array_index (group->members, i);
+		BufferDrvData *buffer_data = member->buffer_data;
+		int n_scans, j;
+
+		if (member->timestamps == NULL)
+			return FALSE;
+
+		n_scans = member->read_size / buffer_data->scan_size;
+		process_scan_timestamps (member->data, n_scans, buffer_data,
+					 buffer_data->timestamp_channel, member->timestamps);
+		for (j = 0; j < n_scans; j++)
+			member->timestamps[j] /= 1000;
+
+		/* The closest scans are at most half a period apart */
+		*max_skew = MAX (*max_skew, member->period / 2);
+	}
+
+	return TRUE;
+}
+
+static void
+send_tuples (CaptureGroup *group)
+{
+	g_autofree BufferDrvData **buffers = NULL;
+	g_autofree const char **scans = NULL;
+	g_autofree guint *n_scans = NULL;
+	g_autofree const gint64 **timestamps = NULL;
+	g_autofree guint *tuples = NULL;
+	guint n_members = group->members->len;
+	guint n_tuples;
+	gint64 max_skew;
+	gboolean lockstep, aligned;
+	guint i, j, k;
+
+	buffers = g_new0 (BufferDrvData *, n_members);
+	scans = g_new0 (const char *, n_members);
+	n_scans = g_new0 (guint, n_members);
+	timestamps = g_new0 (const gint64 *, n_members);
+	for (i = 0; i < n_members; i++) {
+		CaptureMember *member = g_ptr_array_index (group->members, i);
+
+		buffers[i] = member->buffer_data;
+		n_scans[i] = member->read_size / member->buffer_data->scan_size;
+		timestamps[i] = member->timestamps;
+	}
+
+	lockstep = group_shares_trigger (group);
+	if (lockstep || !get_timestamps (group, &max_skew)) {
+		g_clear_pointer (&timestamps, g_free);
+		max_skew = 0;
+	}
+
+	tuples = g_new0 (guint, MAX (n_scans[0], 1) * n_members);
+	n_tuples = scan_pairing_match (n_scans, timestamps, n_members,
+				       lockstep, max_skew, tuples, &aligned);
+
+	for (k = 0; k < n_tuples; k++) {
+		for (i = 0; i < n_members; i++) {
+			CaptureMember *member = g_ptr_array_index (group->members, i);
+
+			scans[i] = member->data + tuples[k * n_members + i] * member->buffer_data->scan_size;
+		}
+
+		for (j = 0; j < group->listeners->len; j++) {
+			CaptureListener *listener = g_ptr_array_index (group->listeners, j);
+
+			listener->func (buffers, scans, n_members, aligned, listener->user_data);
+		}
+	}
+}
+
+static void
+capture (CaptureGroup *group)
+{
+	guint i;
+
+	/* Read everything first, so that the scans are as close
+	 * as possible to each other */
+	for (i = 0; i < group->members->len; i++)
+		read_member (g_ptr_array_index (group->members, i));
+
+	/* Before the members' own scans, so that they can use the
+	 * other members' scans from the same time when processing them */
+	if (group->listeners->len > 0)
+		send_tuples (group);
+
+	for (i = 0; i < group->members->len; i++) {
+		CaptureMember *member = g_ptr_array_index (group->members, i);
+		IIOSensorData data;
+
+		if (member->read_size == 0)
+			continue;
+		data.data = member->data;
+		data.read_size = member->read_size;
+		member->func (data, member->user_data);
+	}
+}
+
+static gboolean
+capture_timeout (gpointer user_data)
+{
+	capture (user_data);
+	return G_SOURCE_CONTINUE;
+}
+
+/* The buffers might only just have been enabled, give them time
+ * to fill up before taking the first reading */
+static gboolean
+first_read (gpointer user_data)
+{
+	CaptureGroup *group = user_data;
+
+	group->first_read_id = 0;
+	capture (group);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* The group wakes up as often as its most demanding member needs */
+static void
+update_timeout (CaptureGroup *group)
+{
+	guint interval = G_MAXUINT;
+	guint i;
+
+	for (i = 0; i < group->members->len; i++) {
+		CaptureMember *member = g_ptr_array_index (group->members, i);
+
+		interval = MIN (interval, member->interval);
+	}
+
+	if (group->members->len == 0) {
+		g_clear_handle_id (&group->timeout_id, wakeup_scheduler_remove);
+		g_clear_handle_id (&group->first_read_id, time_source_remove);
+		group->interval = 0;
+		return;
+	}
+
+	if (group->timeout_id != 0 && interval == group->interval)
+		return;
+
+	group->interval = interval;
+	if (group->timeout_id != 0) {
+		wakeup_scheduler_set_interval (group->timeout_id, interval);
+	} else {
+		group->timeout_id = wakeup_scheduler_add (interval, WAKEUP_DEFAULT_TOLERANCE (interval),
+							  capture_timeout, group,
+							  "[capture_group] capture_timeout");
+	}
+	g_debug ("Capturing group %s every %u ms", group->key, interval);
+}
+
+/**
+ * capture_group_join:
+ * @buffer_data: the buffer data for the device
+ * @interval: how often to read the buffer, in ms
+ * @func: the function to call with the scans read
+ * @user_data: data to pass to @func
+ *
+ * Enables the buffer, on the same trigger as the other sensors in the
+ * device's group if possible, and starts reading it with the rest of
+ * the group.
+ *
+ * Returns: %TRUE if the buffer could be enabled
+ **/
+gboolean
+capture_group_join (BufferDrvData    *buffer_data,
+		    guint             interval,
+		    CaptureScansFunc  func,
+		    gpointer          user_data)
+{
+	CaptureGroup *group;
+	CaptureMember *member;
+
+	g_return_val_if_fail (find_member (buffer_data, NULL) == NULL, FALSE);
+
+	group = get_group (buffer_data->device);
+
+	/* Not all devices accept other devices' triggers */
+	if (group->trigger_name != NULL &&
+	    g_strcmp0 (group->trigger_name, buffer_data->trigger_name) != 0) {
+		buffer_data->shared_trigger_name = g_strdup (group->trigger_name);
+		if (!buffer_drv_data_set_enabled (buffer_data, TRUE)) {
+			g_debug ("Could not use trigger %s for %s, using its own",
+				 group->trigger_name, buffer_data->dev_dir_name);
+			g_clear_pointer (&buffer_data->shared_trigger_name, g_free);
+		}
+	}
+
+	if (!buffer_drv_data_set_enabled (buffer_data, TRUE)) {
+		maybe_free_group (group);
+		return FALSE;
+	}
+
+	member = g_new0 (CaptureMember, 1);
+	member->buffer_data = buffer_data;
+	member->interval = interval;
+	member->func = func;
+	member->user_data = user_data;
+	member->period = G_USEC_PER_SEC / buffer_drv_data_get_sampling_frequency (buffer_data);
+	member->data = g_malloc (CAPTURE_MAX_SCANS * buffer_data->scan_size);
+	if (buffer_data->timestamp_channel >= 0)
+		member->timestamps = g_new (gint64, CAPTURE_MAX_SCANS);
+
+	if (group->trigger_name == NULL)
+		group->trigger_name = g_strdup (buffer_data->trigger_name);
+	member->shares_trigger = samples_on_group_trigger (group, buffer_data);
+	g_ptr_array_add (group->members, member);
+
+	g_debug ("Added %s to capture group %s (%u members, %s trigger %s)",
+		 buffer_data->dev_dir_name, group->key, group->members->len,
+		 member->shares_trigger ? "shared" : "own",
+		 member->shares_trigger ? group->trigger_name : buffer_data->trigger_name);
+
+	update_timeout (group);
+
+	if (group->first_read_id == 0) {
+		group->first_read_id = time_source_timeout_add (BUFFER_FIRST_READ_DELAY, first_read, group);
+		time_source_set_name (group->first_read_id, "[capture_group_join] first_read");
+	}
+
+	return TRUE;
+}
+
+/* Puts the members that used the group's trigger back on their own, and
+ * makes the first member's trigger the group's, for the next to join */
+static void
+move_to_own_triggers (CaptureGroup *group)
+{
+	CaptureMember *first;
+	guint i;
+
+	g_clear_pointer (&group->trigger_name, g_free);
+	if (group->members->len == 0)
+		return;
+
+	first = g_ptr_array_index (group->members, 0);
+	group->trigger_name = g_strdup (first->buffer_data->trigger_name);
+	for (i = 0; i < group->members->len; i++) {
+		CaptureMember *member = g_ptr_array_index (group->members, i);
+		BufferDrvData *buffer_data = member->buffer_data;
+
+		if (buffer_data->shared_trigger_name != NULL) {
+			buffer_drv_data_set_enabled (buffer_data, FALSE);
+			g_clear_pointer (&buffer_data->shared_trigger_name, g_free);
+			if (!buffer_drv_data_set_enabled (buffer_data, TRUE))
+				g_warning ("Could not re-enable buffer for %s on its own trigger %s",
+					   buffer_data->dev_dir_name, buffer_data->trigger_name);
+			else
+				g_debug ("Moved %s to its own trigger %s",
+					 buffer_data->dev_dir_name, buffer_data->trigger_name);
+		}
+		member->shares_trigger = samples_on_group_trigger (group, buffer_data);
+	}
+}
+
+/**
+ * capture_group_leave:
+ * @buffer_data: the buffer data for the device
+ *
+ * Stops reading the buffer and disables it.
+ **/
+void
+capture_group_leave (BufferDrvData *buffer_data)
+{
+	CaptureGroup *group;
+	CaptureMember *member;
+
+	member = find_member (buffer_data, &group);
+	if (member == NULL)
+		return;
+
+	g_ptr_array_remove (group->members, member);
+	buffer_drv_data_set_enabled (buffer_data, FALSE);
+
+	/* The group's trigger goes away with its owner, or stops ticking
+	 * once the owner's buffer is disabled */
+	if (buffer_data->shared_trigger_name == NULL &&
+	    g_strcmp0 (group->trigger_name, buffer_data->trigger_name) == 0)
+		move_to_own_triggers (group);
+	g_clear_pointer (&buffer_data->shared_trigger_name, g_free);
+
+	update_timeout (group);
+	maybe_free_group (group);
+}
+
+void
+capture_group_set_interval (BufferDrvData *buffer_data,
+			    guint          interval)
+{
+	CaptureGroup *group;
+	CaptureMember *member;
+
+	member = find_member (buffer_data, &group);
+	g_return_if_fail (member != NULL);
+
+	member->interval = interval;
+	update_timeout (group);
+}
+
+/**
+ * capture_group_add_tuple_func:
+ * @device: a device in the group
+ * @func: the function to call with each tuple of scans
+ * @user_data: data to pass to @func
+ *
+ * Returns: an ID to pass to capture_group_remove_tuple_func()
+ **/
+guint
+capture_group_add_tuple_func (GUdevDevice      *device,
+			      CaptureTupleFunc  func,
+			      gpointer          user_data)
+{
+	CaptureGroup *group;
+	CaptureListener *listener;
+
+	group = get_group (device);
+	listener = g_new0 (CaptureListener, 1);
+	listener->id = next_listener_id++;
+	listener->func = func;
+	listener->user_data = user_data;
+	g_ptr_array_add (group->listeners, listener);
+
+	return listener->id;
+}
+
+void
+capture_group_remove_tuple_func (GUdevDevice *device,
+				 guint        id)
+{
+	CaptureGroup *group;
+	guint i;
+
+	group = get_group (device);
+	for (i = 0; i < group->listeners->len; i++) {
+		CaptureListener *listener = g_ptr_array_index (group->listeners, i);
+
+		if (listener->id != id)
+			continue;
+		g_ptr_array_remove_index (group->listeners, i);
+		break;
+	}
+	maybe_free_group (group);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include "iio-buffer-utils.h"
+
+/* Called with all the scans read from a member's buffer in one wakeup */
+typedef void (*CaptureScansFunc) (IIOSensorData  data,
+				  gpointer       user_data);
+
+/* Called with one scan per member, @buffers and @scans in the order the
+ * members joined, before the members' CaptureScansFunc. Scans are from
+ * the same trigger tick, or the closest in time for members on their
+ * own triggers, when @aligned is set, otherwise they are the latest
+ * ones of each member */
+typedef void (*CaptureTupleFunc) (BufferDrvData **buffers,
+				  const char    **scans,
+				  guint           n_members,
+				  gboolean        aligned,
+				  gpointer        user_data);
+
+gboolean capture_group_join               (BufferDrvData    *buffer_data,
+					   guint             interval,
+					   CaptureScansFunc  func,
+					   gpointer          user_data);
+void     capture_group_leave              (BufferDrvData    *buffer_data);
+void     capture_group_set_interval       (BufferDrvData    *buffer_data,
+					   guint             interval);
+
+guint    capture_group_add_tuple_func     (GUdevDevice      *device,
+					   CaptureTupleFunc  func,
+					   gpointer          user_data);
+void     capture_group_remove_tuple_func  (GUdevDevice      *device,
+					   guint             id);
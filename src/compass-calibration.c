@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2020 Evangelos Ribeiro Tzaras <devrtz@fortysixandtwo.eu>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "compass-calibration.h"
+#include "time-source.h"
+
+/* The device needs to have been turned around enough for every axis to
+ * have seen at least this share of the widest axis' range, and the field
+ * to have changed by more than the noise, for the extents to be trusted */
+#define MIN_RANGE_RATIO		0.5
+#define MIN_RANGE		16
+/* How often the extents are saved while they're still growing, and
+ * how long they need to go without jumping to be saved at all */
+#define SAVE_INTERVAL		(60 * G_USEC_PER_SEC)
+/* Once calibrated, readings further than this from the centre, relative
+ * to the average range, are transients, like the lid's magnet or a
+ * speaker, and don't make the extents grow */
+#define OUTLIER_RATIO		1.5
+/* Unless there are that many in a row, in which case the magnetic
+ * environment changed, and the calibration starts over */
+#define MAX_OUTLIERS		100
+/* An extent growing by more than this share of its range in one go
+ * is a jump */
+#define JUMP_RATIO		0.25
+/* Extents shrink by this share of their range every interval, so that
+ * the ones inflated by a transient converge back as the device is used */
+#define DECAY_RATIO		0.02
+#define DECAY_INTERVAL		(5 * 60 * G_USEC_PER_SEC)
+
+#define STATE_DIR		"/var/lib/iio-sensor-proxy"
+#define STATE_GROUP		"Calibration"
+
+static void
+reset (CompassCalibration *calibration)
+{
+	calibration->x_min = calibration->y_min = calibration->z_min = G_MAXINT;
+	calibration->x_max = calibration->y_max = calibration->z_max = G_MININT;
+	calibration->is_calibrated = FALSE;
+}
+
+static void
+check_calibrated (CompassCalibration *calibration)
+{
+	gint64 range_x, range_y, range_z, max_range;
+
+	if (calibration->x_min > calibration->x_max ||
+	    calibration->y_min > calibration->y_max ||
+	    calibration->z_min > calibration->z_max) {
+		calibration->is_calibrated = FALSE;
+		return;
+	}
+
+	range_x = (gint64) calibration->x_max - calibration->x_min;
+	range_y = (gint64) calibration->y_max - calibration->y_min;
+	range_z = (gint64) calibration->z_max - calibration->z_min;
+	max_range = MAX (range_x, MAX (range_y, range_z));
+
+	calibration->is_calibrated = max_range >= MIN_RANGE &&
+				     range_x >= max_range * MIN_RANGE_RATIO &&
+				     range_y >= max_range * MIN_RANGE_RATIO &&
+				     range_z >= max_range * MIN_RANGE_RATIO;
+}
+
+static char *
+get_state_path (const char *device_id)
+{
+	g_autofree char *checksum = NULL;
+	g_autofree char *filename = NULL;
+	const char *state_dir;
+
+	/* Set by systemd's StateDirectory= */
+	state_dir = g_getenv ("STATE_DIRECTORY");
+	if (!state_dir)
+		state_dir = STATE_DIR;
+
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, device_id, -1);
+	filename = g_strdup_printf ("%s.compass", checksum);
+	return g_build_filename (state_dir, filename, NULL);
+}
+
+static void
+load (CompassCalibration *calibration)
+{
+	g_autoptr(GKeyFile) keyfile = NULL;
+	g_autoptr(GError) error = NULL;
+	gint *extents;
+	gsize len;
+
+	keyfile = g_key_file_new ();
+	if (!g_key_file_load_from_file (keyfile, calibration->state_path, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_debug ("Could not load compass calibration from %s: %s",
+				 calibration->state_path, error->message);
+		return;
+	}
+
+	extents = g_key_file_get_integer_list (keyfile, STATE_GROUP, "Extents", &len, NULL);
+	if (extents == NULL || len != 6) {
+		g_debug ("Ignoring invalid compass calibration in %s", calibration->state_path);
+		g_free (extents);
+		return;
+	}
+
+	calibration->x_min = extents[0];
+	calibration->x_max = extents[1];
+	calibration->y_min = extents[2];
+	calibration->y_max = extents[3];
+	calibration->z_min = extents[4];
+	calibration->z_max = extents[5];
+	g_free (extents);
+
+	check_calibrated (calibration);
+	g_debug ("Loaded %s compass calibration from %s",
+		 calibration->is_calibrated ? "complete" : "partial",
+		 calibration->state_path);
+}
+
+/**
+ * compass_calibration_init:
+ * @calibration: the calibration data to initialise
+ * @device_id: a stable identifier for the magnetometer, such as its sysfs path
+ *
+ * Loads the calibration saved for the device, if any, otherwise starts
+ * with no calibration, the raw readings being used until the device
+ * has been turned around enough.
+ **/
+void
+compass_calibration_init (CompassCalibration *calibration,
+			  const char         *device_id)
+{
+	memset (calibration, 0, sizeof (CompassCalibration));
+	reset (calibration);
+
+	calibration->state_path = get_state_path (device_id);
+	calibration->last_save = time_source_get_time ();
+	calibration->last_decay = calibration->last_save;
+	load (calibration);
+}
+
+/* Saves the calibration if it changed, and frees the state */
+void
+compass_calibration_clear (CompassCalibration *calibration)
+{
+	compass_calibration_save (calibration);
+	g_clear_pointer (&calibration->state_path, g_free);
+}
+
+void
+compass_calibration_save (CompassCalibration *calibration)
+{
+	g_autoptr(GKeyFile) keyfile = NULL;
+	g_autoptr(GError) error = NULL;
+	gint extents[6];
+
+	gint64 now;
+
+	if (!calibration->dirty || !calibration->state_path)
+		return;
+
+	/* Only extents that settled survive restarts */
+	now = time_source_get_time ();
+	if (calibration->last_jump != 0 &&
+	    now - calibration->last_jump < SAVE_INTERVAL)
+		return;
+
+	calibration->dirty = FALSE;
+	calibration->last_save = now;
+
+	extents[0] = calibration->x_min;
+	extents[1] = calibration->x_max;
+	extents[2] = calibration->y_min;
+	extents[3] = calibration->y_max;
+	extents[4] = calibration->z_min;
+	extents[5] = calibration->z_max;
+
+	keyfile = g_key_file_new ();
+	g_key_file_set_integer_list (keyfile, STATE_GROUP, "Extents", extents, G_N_ELEMENTS (extents));
+	if (!g_key_file_save_to_file (keyfile, calibration->state_path, &error))
+		g_debug ("Could not save compass calibration to %s: %s",
+			 calibration->state_path, error->message);
+}
+
+static gboolean
+update_extent (int       value,
+	       gint     *min,
+	       gint     *max,
+	       gboolean *jumped)
+{
+	gint64 range = (gint64) *max - *min;
+	gboolean changed = FALSE;
+
+	if (value < *min) {
+		*min = value;
+		changed = TRUE;
+	}
+	if (value > *max) {
+		*max = value;
+		changed = TRUE;
+	}
+
+	if (changed && range > 0 &&
+	    (gint64) *max - *min - range > range * JUMP_RATIO)
+		*jumped = TRUE;
+	return changed;
+}
+
+static void
+shrink_extent (gint *min,
+	       gint *max)
+{
+	gint64 shrink;
+
+	if (*min > *max)
+		return;
+
+	shrink = ((gint64) *max - *min) * DECAY_RATIO / 2;
+	*min += shrink;
+	*max -= shrink;
+}
+
+static gboolean
+is_outlier (const CompassCalibration *calibration,
+	    int                       magn_x,
+	    int                       magn_y,
+	    int                       magn_z)
+{
+	double out[3], radius;
+
+	compass_calibration_apply (calibration, magn_x, magn_y, magn_z, out);
+	radius = ((gint64) calibration->x_max - calibration->x_min +
+		  (gint64) calibration->y_max - calibration->y_min +
+		  (gint64) calibration->z_max - calibration->z_min) / 6.0;
+	radius *= OUTLIER_RATIO;
+
+	return out[0] * out[0] + out[1] * out[1] + out[2] * out[2] > radius * radius;
+}
+
+/* Forgets the extents, including the saved ones */
+static void
+restart (CompassCalibration *calibration)
+{
+	reset (calibration);
+	calibration->n_outliers = 0;
+	calibration->last_jump = 0;
+	calibration->dirty = FALSE;
+	if (calibration->state_path)
+		g_remove (calibration->state_path);
+}
+
+/* Grows the extents to include the reading, unless it's an outlier,
+ * in constant time and without keeping any history */
+void
+compass_calibration_add_sample (CompassCalibration *calibration,
+				int                 magn_x,
+				int                 magn_y,
+				int                 magn_z)
+{
+	gboolean changed = FALSE;
+	gboolean jumped = FALSE;
+	gint64 now;
+
+	if (calibration->is_calibrated) {
+		if (!is_outlier (calibration, magn_x, magn_y, magn_z)) {
+			calibration->n_outliers = 0;
+		} else if (++calibration->n_outliers < MAX_OUTLIERS) {
+			return;
+		} else {
+			g_debug ("Compass readings keep falling outside the calibration, starting over");
+			restart (calibration);
+		}
+	}
+
+	now = time_source_get_time ();
+	if (now - calibration->last_decay >= DECAY_INTERVAL) {
+		shrink_extent (&calibration->x_min, &calibration->x_max);
+		shrink_extent (&calibration->y_min, &calibration->y_max);
+		shrink_extent (&calibration->z_min, &calibration->z_max);
+		calibration->last_decay = now;
+		changed = TRUE;
+	}
+
+	changed |= update_extent (magn_x, &calibration->x_min, &calibration->x_max, &jumped);
+	changed |= update_extent (magn_y, &calibration->y_min, &calibration->y_max, &jumped);
+	changed |= update_extent (magn_z, &calibration->z_min, &calibration->z_max, &jumped);
+
+	if (!changed)
+		return;
+
+	if (jumped && calibration->is_calibrated)
+		calibration->last_jump = now;
+
+	calibration->dirty = TRUE;
+	if (!calibration->is_calibrated) {
+		check_calibrated (calibration);
+		if (calibration->is_calibrated)
+			g_debug ("Compass calibration complete");
+	}
+
+	if (now - calibration->last_save >= SAVE_INTERVAL)
+		compass_calibration_save (calibration);
+}
+
+/* Removes the hard-iron offset, and scales the axes to their average range */
+void
+compass_calibration_apply (const CompassCalibration *calibration,
+			   int                       magn_x,
+			   int                       magn_y,
+			   int                       magn_z,
+			   double                    out[3])
+{
+	double avg_delta_x, avg_delta_y, avg_delta_z, avg_delta;
+
+	if (!calibration->is_calibrated) {
+		out[0] = magn_x;
+		out[1] = magn_y;
+		out[2] = magn_z;
+		return;
+	}
+
+	avg_delta_x = (calibration->x_max - calibration->x_min) / 2.0;
+	avg_delta_y = (calibration->y_max - calibration->y_min) / 2.0;
+	avg_delta_z = (calibration->z_max - calibration->z_min) / 2.0;
+	avg_delta = (avg_delta_x + avg_delta_y + avg_delta_z) / 3;
+
+	out[0] = (magn_x - (calibration->x_min + calibration->x_max) / 2) * avg_delta / avg_delta_x;
+	out[1] = (magn_y - (calibration->y_min + calibration->y_max) / 2) * avg_delta / avg_delta_y;
+	out[2] = (magn_z - (calibration->z_min + calibration->z_max) / 2) * avg_delta / avg_delta_z;
+}
+
+/**
+ * compass_calibration_get_readings:
+ * @calibration: the calibration data for the magnetometer
+ * @mount_matrix: the mount matrix, as returned by setup_magn_mount_matrix()
+ * @magn_x: raw X axis reading
+ * @magn_y: raw Y axis reading
+ * @magn_z: raw Z axis reading
+ * @readings: (out): the readings to send
+ *
+ * Fills in the calibrated field, in the accelerometer's frame, and the
+ * heading as if the device was lying flat, see compass_fusion_get_heading()
+ * for when it isn't.
+ **/
+void
+compass_calibration_get_readings (const CompassCalibration *calibration,
+				  const AccelVec3          *mount_matrix,
+				  int                       magn_x,
+				  int                       magn_y,
+				  int                       magn_z,
+				  CompassReadings          *readings)
+{
+	double corrected[3];
+	AccelVec3 field;
+
+	compass_calibration_apply (calibration, magn_x, magn_y, magn_z, corrected);
+
+	field.x = corrected[0];
+	field.y = corrected[1];
+	field.z = corrected[2];
+	apply_mount_matrix (mount_matrix, &field);
+
+	readings->has_field = TRUE;
+	readings->field_x = field.x;
+	readings->field_y = field.y;
+	readings->field_z = field.z;
+	readings->has_gravity = FALSE;
+
+	/* In the same 0 to 360 degrees range as compass_fusion_get_heading() */
+	readings->heading = atan2 (field.x, field.y) * 180 / G_PI;
+	if (readings->heading < 0.0)
+		readings->heading += 360.0;
+}
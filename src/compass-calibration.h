@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2020 Evangelos Ribeiro Tzaras <devrtz@fortysixandtwo.eu>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "drivers.h"
+#include "accel-mount-matrix.h"
+
+/* The extent of the raw magnetometer readings on each axis, used to
+ * remove the hard-iron offset and scale the axes to the same range.
+ * It grows as the device gets turned around, slowly shrinks back so
+ * that transients don't stick, and is saved per device */
+typedef struct {
+	gint     x_max;
+	gint     x_min;
+	gint     y_max;
+	gint     y_min;
+	gint     z_max;
+	gint     z_min;
+	gboolean is_calibrated;
+	guint    n_outliers;
+	gint64   last_decay;
+	gint64   last_jump;
+
+	char    *state_path;
+	gboolean dirty;
+	gint64   last_save;
+} CompassCalibration;
+
+void    compass_calibration_init         (CompassCalibration       *calibration,
+					  const char               *device_id);
+void    compass_calibration_clear        (CompassCalibration       *calibration);
+void    compass_calibration_add_sample   (CompassCalibration       *calibration,
+					  int                       magn_x,
+					  int                       magn_y,
+					  int                       magn_z);
+void    compass_calibration_save         (CompassCalibration       *calibration);
+void    compass_calibration_apply        (const CompassCalibration *calibration,
+					  int                       magn_x,
+					  int                       magn_y,
+					  int                       magn_z,
+					  double                    out[3]);
+void    compass_calibration_get_readings (const CompassCalibration *calibration,
+					  const AccelVec3          *mount_matrix,
+					  int                       magn_x,
+					  int                       magn_y,
+					  int                       magn_z,
+					  CompassReadings          *readings);
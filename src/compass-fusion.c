@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <math.h>
+
+#include "compass-fusion.h"
+
+/* Readings shorter than this can't be used to tell directions,
+ * the device is in free fall, or the field is along gravity */
+#define MIN_NORM 0.1
+
+static void
+cross (const double a[3],
+       const double b[3],
+       double       out[3])
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static gboolean
+normalize (double v[3])
+{
+	double norm;
+
+	norm = sqrt (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (norm < MIN_NORM)
+		return FALSE;
+	v[0] /= norm;
+	v[1] /= norm;
+	v[2] /= norm;
+	return TRUE;
+}
+
+/**
+ * compass_fusion_get_heading:
+ * @gravity: an accelerometer reading, pointing down, with the mount matrix
+ *   applied, as sent by the accelerometer drivers
+ * @field: a calibrated magnetometer reading, in the same frame as @gravity
+ * @heading: (out): the heading in degrees, clockwise from magnetic North
+ *
+ * Projects the magnetic field on the horizontal plane, so that the heading
+ * is correct whatever the tilt of the device. When the device lies flat,
+ * the heading is the direction the top of the screen points to, when it's
+ * held up, the direction the back of the device faces.
+ *
+ * Returns: %FALSE if the heading can't be computed from the readings
+ **/
+gboolean
+compass_fusion_get_heading (const double  gravity[3],
+			    const double  field[3],
+			    double       *heading)
+{
+	double down[3] = { gravity[0], gravity[1], gravity[2] };
+	double east[3], north[3];
+	double pointing[3] = { 0.0, 1.0, 0.0 };
+	double angle;
+
+	if (!normalize (down))
+		return FALSE;
+
+	/* Perpendicular to both gravity and the field, so horizontal */
+	cross (down, field, east);
+	if (!normalize (east))
+		return FALSE;
+	cross (east, down, north);
+
+	/* Upright, the top of the device points to the sky */
+	if (fabs (down[2]) < sqrt (down[0] * down[0] + down[1] * down[1])) {
+		pointing[1] = 0.0;
+		pointing[2] = -1.0;
+	}
+
+	angle = atan2 (east[0] * pointing[0] + east[1] * pointing[1] + east[2] * pointing[2],
+		       north[0] * pointing[0] + north[1] * pointing[1] + north[2] * pointing[2]);
+	angle = angle * 180.0 / G_PI;
+	if (angle < 0.0)
+		angle += 360.0;
+
+	*heading = angle;
+	return TRUE;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#include "device-index.h"
+
+/* All the devices of the subsystems we care about, enumerated once at
+ * startup, and kept up-to-date with hotplug events, so that drivers can
+ * look up triggers and siblings without enumerating whole subsystems.
+ *
+ * Drivers are opened in threads, so lookups are locked, and only read
+ * what was already read from udev when indexing, but the index is only
+ * modified, and its devices list walked, in the main thread */
+struct DeviceIndex {
+	GMutex      lock;
+	GQueue      devices;   /* in enumeration order */
+	GHashTable *by_path;   /* sysfs path → GUdevDevice */
+	GHashTable *by_parent; /* parent sysfs path → GPtrArray of GUdevDevice */
+	GHashTable *by_name;   /* "name" sysfs attribute → GUdevDevice */
+};
+
+static DeviceIndex *default_index = NULL;
+
+static const char *
+get_parent_path (GUdevDevice *device)
+{
+	g_autoptr(GUdevDevice) parent = NULL;
+
+	parent = g_udev_device_get_parent (device);
+	if (!parent)
+		return NULL;
+	return g_intern_string (g_udev_device_get_sysfs_path (parent));
+}
+
+DeviceIndex *
+device_index_new (GUdevClient        *client,
+		  const char * const *subsystems)
+{
+	DeviceIndex *index;
+	guint i;
+
+	index = g_new0 (DeviceIndex, 1);
+	g_mutex_init (&index->lock);
+	g_queue_init (&index->devices);
+	index->by_path = g_hash_table_new_full (g_str_hash, g_str_equal,
+						NULL, g_object_unref);
+	index->by_parent = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  NULL, (GDestroyNotify) g_ptr_array_unref);
+	index->by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
+	for (i = 0; subsystems[i] != NULL; i++) {
+		GList *devices, *l;
+
+		devices = g_udev_client_query_by_subsystem (client, subsystems[i]);
+		for (l = devices; l != NULL; l = l->next)
+			device_index_add (index, l->data);
+		g_list_free_full (devices, g_object_unref);
+	}
+
+	g_debug ("Indexed %u devices", g_queue_get_length (&index->devices));
+
+	return index;
+}
+
+void
+device_index_free (DeviceIndex *index)
+{
+	if (!index)
+		return;
+
+	if (default_index == index)
+		default_index = NULL;
+
+	g_queue_clear (&index->devices);
+	g_hash_table_destroy (index->by_name);
+	g_hash_table_destroy (index->by_parent);
+	g_hash_table_destroy (index->by_path);
+	g_mutex_clear (&index->lock);
+	g_free (index);
+}
+
+void
+device_index_add (DeviceIndex *index,
+		  GUdevDevice *device)
+{
+	const char *path, *parent_path, *name;
+	GPtrArray *siblings;
+
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	path = g_udev_device_get_sysfs_path (device);
+	locker = g_mutex_locker_new (&index->lock);
+	if (g_hash_table_contains (index->by_path, path))
+		return;
+
+	g_hash_table_insert (index->by_path, (gpointer) path, g_object_ref (device));
+	g_queue_push_tail (&index->devices, device);
+
+	/* Cached now for device_index_get_sibling() */
+	g_udev_device_get_subsystem (device);
+
+	parent_path = get_parent_path (device);
+	if (parent_path) {
+		siblings = g_hash_table_lookup (index->by_parent, parent_path);
+		if (!siblings) {
+			siblings = g_ptr_array_new ();
+			g_hash_table_insert (index->by_parent, (gpointer) parent_path, siblings);
+		}
+		g_ptr_array_add (siblings, device);
+	}
+
+	/* Only IIO devices and triggers have unique names, the first one wins
+	 * for the others */
+	name = g_udev_device_get_sysfs_attr (device, "name");
+	if (name && !g_hash_table_contains (index->by_name, name))
+		g_hash_table_insert (index->by_name, (gpointer) name, device);
+}
+
+void
+device_index_remove (DeviceIndex *index,
+		     GUdevDevice *device)
+{
+	GUdevDevice *indexed;
+	const char *parent_path, *name;
+	GPtrArray *siblings;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	locker = g_mutex_locker_new (&index->lock);
+	indexed = g_hash_table_lookup (index->by_path, g_udev_device_get_sysfs_path (device));
+	if (!indexed)
+		return;
+
+	name = g_udev_device_get_sysfs_attr (indexed, "name");
+	if (name && g_hash_table_lookup (index->by_name, name) == indexed)
+		g_hash_table_remove (index->by_name, name);
+
+	parent_path = get_parent_path (indexed);
+	if (parent_path) {
+		siblings = g_hash_table_lookup (index->by_parent, parent_path);
+		if (siblings) {
+			g_ptr_array_remove_fast (siblings, indexed);
+			if (siblings->len == 0)
+				g_hash_table_remove (index->by_parent, parent_path);
+		}
+	}
+
+	g_queue_remove (&index->devices, indexed);
+	/* Drops the last reference */
+	g_hash_table_remove (index->by_path, g_udev_device_get_sysfs_path (indexed));
+}
+
+/* The returned list and devices are owned by the index */
+GList *
+device_index_get_devices (DeviceIndex *index)
+{
+	return index->devices.head;
+}
+
+GUdevDevice *
+device_index_lookup (DeviceIndex *index,
+		     const char  *sysfs_path)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	locker = g_mutex_locker_new (&index->lock);
+	return g_hash_table_lookup (index->by_path, sysfs_path);
+}
+
+GUdevDevice *
+device_index_lookup_name (DeviceIndex *index,
+			  const char  *name)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	locker = g_mutex_locker_new (&index->lock);
+	return g_hash_table_lookup (index->by_name, name);
+}
+
+/* Returns a reference to the first device of the given subsystem with
+ * the same parent as @device, which might be @device itself, or NULL */
+GUdevDevice *
+device_index_get_sibling (DeviceIndex *index,
+			  GUdevDevice *device,
+			  const char  *subsystem)
+{
+	g_autoptr(GUdevDevice) parent = NULL;
+	GPtrArray *siblings;
+	guint i;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	parent = g_udev_device_get_parent (device);
+	if (!parent)
+		return NULL;
+	locker = g_mutex_locker_new (&index->lock);
+	siblings = g_hash_table_lookup (index->by_parent, g_udev_device_get_sysfs_path (parent));
+	if (!siblings)
+		return NULL;
+
+	for (i = 0; i < siblings->len; i++) {
+		GUdevDevice *sibling = g_ptr_array_index (siblings, i);
+
+		if (g_strcmp0 (g_udev_device_get_subsystem (sibling), subsystem) == 0)
+			return g_object_ref (sibling);
+	}
+
+	return NULL;
+}
+
+DeviceIndex *
+device_index_get_default (void)
+{
+	return default_index;
+}
+
+void
+device_index_set_default (DeviceIndex *index)
+{
+	default_index = index;
+}
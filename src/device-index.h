@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gudev/gudev.h>
+
+typedef struct DeviceIndex DeviceIndex;
+
+DeviceIndex *device_index_new          (GUdevClient        *client,
+					const char * const *subsystems);
+void         device_index_free         (DeviceIndex        *index);
+
+void         device_index_add          (DeviceIndex        *index,
+					GUdevDevice        *device);
+void         device_index_remove       (DeviceIndex        *index,
+					GUdevDevice        *device);
+
+GList       *device_index_get_devices  (DeviceIndex        *index);
+GUdevDevice *device_index_lookup       (DeviceIndex        *index,
+					const char         *sysfs_path);
+GUdevDevice *device_index_lookup_name  (DeviceIndex        *index,
+					const char         *name);
+GUdevDevice *device_index_get_sibling  (DeviceIndex        *index,
+					GUdevDevice        *device,
+					const char         *subsystem);
+
+DeviceIndex *device_index_get_default  (void);
+void         device_index_set_default  (DeviceIndex        *index);
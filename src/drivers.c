@@ -27,3 +27,99 @@ gboolean drv_check_udev_sensor_type (GUdevDevice *device,
 		g_debug ("Found %s at %s", name, g_udev_device_get_sysfs_path (device));
 	return TRUE;
 }
+
+const SensorDriver * const drivers[] = {
+	&replay_accel,
+	&iio_buffer_accel,
+	&iio_poll_accel,
+	&input_accel,
+	&iio_buffer_accel_base,
+	&iio_poll_accel_base,
+	&iio_buffer_light,
+	&iio_poll_light,
+	&hwmon_light,
+	&fake_compass,
+	&fake_light,
+	&iio_buffer_compass,
+	&iio_buffer_compass_uncalibrated,
+	&iio_poll_compass_uncalibrated,
+	&iio_buffer_proximity,
+	&iio_poll_proximity,
+	&iio_buffer_gyro,
+	NULL
+};
+
+typedef struct {
+	SensorDriver       *driver;
+	char               *sysfs_path;
+	ReadingsUpdateFunc  callback_func;
+	gpointer            user_data;
+} OpenData;
+
+static void
+open_data_free (OpenData *open_data)
+{
+	g_free (open_data->sysfs_path);
+	g_free (open_data);
+}
+
+static void
+open_thread (GTask        *task,
+	     gpointer      source_object,
+	     gpointer      task_data,
+	     GCancellable *cancellable)
+{
+	OpenData *open_data = task_data;
+	g_autoptr(GUdevClient) client = NULL;
+	g_autoptr(GUdevDevice) device = NULL;
+
+	/* libudev contexts aren't thread-safe, and GUdevDevice fills its
+	 * caches lazily, so the driver gets its own copy of the device,
+	 * from a context that no other thread uses */
+	client = g_udev_client_new (NULL);
+	device = g_udev_client_query_by_sysfs_path (client, open_data->sysfs_path);
+	if (!device) {
+		g_task_return_boolean (task, FALSE);
+		return;
+	}
+
+	g_task_return_boolean (task, driver_open (open_data->driver,
+						  device,
+						  open_data->callback_func,
+						  open_data->user_data));
+}
+
+/* Runs the driver's open() in a worker thread, so that drivers doing
+ * a lot of sysfs I/O don't block the main loop. Drivers for the same
+ * device must not be opened concurrently, and open() must only use
+ * the device it's passed, and the locked device index, from udev. */
+void
+driver_open_async (SensorDriver        *driver,
+		   GUdevDevice         *device,
+		   ReadingsUpdateFunc   callback_func,
+		   gpointer             user_data,
+		   GAsyncReadyCallback  ready_callback,
+		   gpointer             ready_data)
+{
+	g_autoptr(GTask) task = NULL;
+	OpenData *open_data;
+
+	open_data = g_new0 (OpenData, 1);
+	open_data->driver = driver;
+	open_data->sysfs_path = g_strdup (g_udev_device_get_sysfs_path (device));
+	open_data->callback_func = callback_func;
+	open_data->user_data = user_data;
+
+	task = g_task_new (NULL, NULL, ready_callback, ready_data);
+	g_task_set_source_tag (task, driver_open_async);
+	g_task_set_task_data (task, open_data, (GDestroyNotify) open_data_free);
+	g_task_run_in_thread (task, open_thread);
+}
+
+gboolean
+driver_open_finish (GAsyncResult *result)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), NULL);
+}
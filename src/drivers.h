@@ -6,7 +6,10 @@
  * the Free Software Foundation.
  */
 
+#pragma once
+
 #include <glib.h>
+#include <gio/gio.h>
 #include <gudev/gudev.h>
 
 #include "accel-attributes.h"
@@ -17,14 +20,19 @@ typedef enum {
 	DRIVER_TYPE_LIGHT,
 	DRIVER_TYPE_COMPASS,
 	DRIVER_TYPE_PROXIMITY,
+	DRIVER_TYPE_GYRO,
+	DRIVER_TYPE_ACCEL_BASE,
 } DriverType;
 
+#define NUM_SENSOR_TYPES DRIVER_TYPE_ACCEL_BASE + 1
+
 /* Driver types */
 typedef guint DriverSpecificType;
 
 typedef enum {
 	DRIVER_TYPE_ACCEL_IIO,
-	DRIVER_TYPE_ACCEL_INPUT
+	DRIVER_TYPE_ACCEL_INPUT,
+	DRIVER_TYPE_ACCEL_REPLAY
 } DriverAccelType;
 
 typedef enum {
@@ -43,6 +51,10 @@ typedef enum {
   DRIVER_TYPE_PROXIMITY_IIO,
 } DriverTypeProximity;
 
+typedef enum {
+  DRIVER_TYPE_GYRO_IIO,
+} DriverTypeGyro;
+
 typedef enum {
   PROXIMITY_NEAR_ERROR = -1,
   PROXIMITY_NEAR_FALSE =  0,
@@ -51,11 +63,12 @@ typedef enum {
 
 typedef struct SensorDriver SensorDriver;
 
+/* Readings in m/s², with the mount matrix applied. Base accelerometers
+ * send the same readings as display ones when the device is opened flat */
 typedef struct {
-	int accel_x;
-	int accel_y;
-	int accel_z;
-	AccelScale scale;
+	gdouble accel_x;
+	gdouble accel_y;
+	gdouble accel_z;
 } AccelReadings;
 
 typedef struct {
@@ -63,14 +76,41 @@ typedef struct {
 	gboolean uses_lux;
 } LightReadings;
 
+/* Drivers for raw magnetometers also send the calibrated field, with the
+ * mount matrix applied, so that the heading can be tilt-compensated */
 typedef struct {
-	gdouble heading;
+	gdouble  heading;
+	gboolean has_field;
+	gdouble  field_x;
+	gdouble  field_y;
+	gdouble  field_z;
+	/* The accelerometer reading taken at the same time, if any */
+	gboolean has_gravity;
+	gdouble  gravity_x;
+	gdouble  gravity_y;
+	gdouble  gravity_z;
 } CompassReadings;
 
 typedef struct {
 	ProximityNear is_near;
 } ProximityReadings;
 
+/* Angular velocity in rad/s, with the mount matrix applied,
+ * and the time in µs on the g_get_monotonic_time() clock */
+typedef struct {
+	gint64  timestamp;
+	gdouble x;
+	gdouble y;
+	gdouble z;
+} GyroSample;
+
+/* Gyroscopes sample too fast for each reading to be sent on its own,
+ * so drivers send all the samples read in one go */
+typedef struct {
+	guint             n_samples;
+	const GyroSample *samples;
+} GyroReadings;
+
 typedef void (*ReadingsUpdateFunc) (SensorDriver *driver,
 				    gpointer      readings,
 				    gpointer      user_data);
@@ -99,10 +139,12 @@ driver_discover (SensorDriver *driver,
 	if (!driver->discover (device))
 		return FALSE;
 
-	if (driver->type != DRIVER_TYPE_ACCEL)
-		return TRUE;
+	if (driver->type == DRIVER_TYPE_ACCEL)
+		return (setup_accel_location (device) == ACCEL_LOCATION_DISPLAY);
+	if (driver->type == DRIVER_TYPE_ACCEL_BASE)
+		return (setup_accel_location (device) == ACCEL_LOCATION_BASE);
 
-	return (setup_accel_location (device) == ACCEL_LOCATION_DISPLAY);
+	return TRUE;
 }
 
 static inline gboolean
@@ -119,6 +161,14 @@ driver_open (SensorDriver       *driver,
 	return driver->open (device, callback_func, user_data);
 }
 
+void     driver_open_async  (SensorDriver        *driver,
+			     GUdevDevice         *device,
+			     ReadingsUpdateFunc   callback_func,
+			     gpointer             user_data,
+			     GAsyncReadyCallback  ready_callback,
+			     gpointer             ready_data);
+gboolean driver_open_finish (GAsyncResult        *result);
+
 static inline void
 driver_set_polling (SensorDriver *driver,
 		    gboolean      state)
@@ -142,6 +192,8 @@ driver_close (SensorDriver *driver)
 
 extern SensorDriver iio_buffer_accel;
 extern SensorDriver iio_poll_accel;
+extern SensorDriver iio_buffer_accel_base;
+extern SensorDriver iio_poll_accel_base;
 extern SensorDriver input_accel;
 extern SensorDriver fake_compass;
 extern SensorDriver fake_light;
@@ -149,7 +201,15 @@ extern SensorDriver iio_poll_light;
 extern SensorDriver hwmon_light;
 extern SensorDriver iio_buffer_light;
 extern SensorDriver iio_buffer_compass;
+extern SensorDriver iio_buffer_compass_uncalibrated;
 extern SensorDriver iio_poll_compass_uncalibrated;
+extern SensorDriver iio_buffer_proximity;
 extern SensorDriver iio_poll_proximity;
+extern SensorDriver iio_buffer_gyro;
+extern SensorDriver replay_accel;
+
+/* All the drivers, in order of preference when several can
+ * handle the same device, %NULL-terminated */
+extern const SensorDriver * const drivers[];
 
 gboolean drv_check_udev_sensor_type (GUdevDevice *device, const gchar *match, const char *name);
@@ -7,6 +7,7 @@
  */
 
 #include "drivers.h"
+#include "time-source.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -53,6 +54,8 @@ compass_changed (gpointer user_data)
 		heading = 0;
 	g_debug ("Changed heading to %f", heading);
 	readings.heading = heading;
+	readings.has_field = FALSE;
+	readings.has_gravity = FALSE;
 
 	drv_data->callback_func (&fake_compass, (gpointer) &readings, drv_data->user_data);
 
@@ -63,8 +66,8 @@ static gboolean
 first_values (gpointer user_data)
 {
 	compass_changed (NULL);
-	drv_data->timeout_id = g_timeout_add_seconds (1, (GSourceFunc) compass_changed, NULL);
-	g_source_set_name_by_id (drv_data->timeout_id, "[fake_compass_set_polling] compass_changed");
+	drv_data->timeout_id = time_source_timeout_add_seconds (1, (GSourceFunc) compass_changed, NULL);
+	time_source_set_name (drv_data->timeout_id, "[fake_compass_set_polling] compass_changed");
 	return G_SOURCE_REMOVE;
 }
 
@@ -89,13 +92,13 @@ fake_compass_set_polling (gboolean state)
 		return;
 
 	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
+		time_source_remove (drv_data->timeout_id);
 		drv_data->timeout_id = 0;
 	}
 
 	if (state) {
-		drv_data->timeout_id = g_idle_add (first_values, NULL);
-		g_source_set_name_by_id (drv_data->timeout_id, "[fake_compass_set_polling] first_values");
+		drv_data->timeout_id = time_source_idle_add (first_values, NULL);
+		time_source_set_name (drv_data->timeout_id, "[fake_compass_set_polling] first_values");
 	}
 }
 
@@ -7,6 +7,7 @@
  */
 
 #include "drivers.h"
+#include "time-source.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -16,9 +17,15 @@
 
 #include <linux/input.h>
 
+/* With FAKE_LIGHT_SENSOR=timestamps, the level is the time of the reading,
+ * in ms on the monotonic clock, so that the latency of the readings can be
+ * measured, see bench-latency.c */
+#define TIMESTAMPS_INTERVAL 100 /* ms */
+
 typedef struct DrvData {
 	ReadingsUpdateFunc callback_func;
 	gpointer           user_data;
+	gboolean           timestamps;
 
 	guint              timeout_id;
 } DrvData;
@@ -52,7 +59,10 @@ light_changed (gpointer user_data)
 	 * Might need to do something better here, like
 	 * replicate real readings from a device */
 	level += 1.0;
-	readings.level = level;
+	if (drv_data->timestamps)
+		readings.level = time_source_get_time () / 1000.0;
+	else
+		readings.level = level;
 	readings.uses_lux = TRUE;
 	drv_data->callback_func (&fake_light, (gpointer) &readings, drv_data->user_data);
 
@@ -63,8 +73,11 @@ static gboolean
 first_values (gpointer user_data)
 {
 	light_changed (NULL);
-	drv_data->timeout_id = g_timeout_add_seconds (1, (GSourceFunc) light_changed, NULL);
-	g_source_set_name_by_id (drv_data->timeout_id, "[fake_light_set_polling] light_changed");
+	if (drv_data->timestamps)
+		drv_data->timeout_id = time_source_timeout_add (TIMESTAMPS_INTERVAL, (GSourceFunc) light_changed, NULL);
+	else
+		drv_data->timeout_id = time_source_timeout_add_seconds (1, (GSourceFunc) light_changed, NULL);
+	time_source_set_name (drv_data->timeout_id, "[fake_light_set_polling] light_changed");
 	return G_SOURCE_REMOVE;
 }
 
@@ -76,6 +89,7 @@ fake_light_open (GUdevDevice        *device,
 	drv_data = g_new0 (DrvData, 1);
 	drv_data->callback_func = callback_func;
 	drv_data->user_data = user_data;
+	drv_data->timestamps = g_strcmp0 (g_getenv ("FAKE_LIGHT_SENSOR"), "timestamps") == 0;
 
 	return TRUE;
 }
@@ -89,13 +103,13 @@ fake_light_set_polling (gboolean state)
 		return;
 
 	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
+		time_source_remove (drv_data->timeout_id);
 		drv_data->timeout_id = 0;
 	}
 
 	if (state) {
-		drv_data->timeout_id = g_idle_add (first_values, NULL);
-		g_source_set_name_by_id (drv_data->timeout_id, "[fake_light_set_polling] first_values");
+		drv_data->timeout_id = time_source_idle_add (first_values, NULL);
+		time_source_set_name (drv_data->timeout_id, "[fake_light_set_polling] first_values");
 	}
 }
 
@@ -7,6 +7,7 @@
  */
 
 #include "drivers.h"
+#include "wakeup-scheduler.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -86,14 +87,12 @@ hwmon_light_set_polling (gboolean state)
 	if (drv_data->timeout_id == 0 && !state)
 		return;
 
-	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
-		drv_data->timeout_id = 0;
-	}
+	g_clear_handle_id (&drv_data->timeout_id, wakeup_scheduler_remove);
 
 	if (state) {
-		drv_data->timeout_id = g_timeout_add (DEFAULT_POLL_TIME, (GSourceFunc) light_changed, NULL);
-		g_source_set_name_by_id (drv_data->timeout_id, "[hwmon_light_set_polling] light_changed");
+		drv_data->timeout_id = wakeup_scheduler_add (DEFAULT_POLL_TIME, WAKEUP_DEFAULT_TOLERANCE (DEFAULT_POLL_TIME),
+							     (GSourceFunc) light_changed, NULL,
+							     "[hwmon_light_set_polling] light_changed");
 
 		/* And send a reading straight away */
 		light_changed (NULL);
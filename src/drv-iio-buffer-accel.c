@@ -7,194 +7,155 @@
  */
 
 #include "drivers.h"
-#include "iio-buffer-utils.h"
+#include "buffer-driver.h"
 #include "accel-mount-matrix.h"
+#include "accel-motion.h"
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <string.h>
-#include <errno.h>
+#define BUFFER_MAX_SCANS 127
+#define POLL_INTERVAL    700
 
 typedef struct {
-	guint              timeout_id;
-	ReadingsUpdateFunc callback_func;
-	gpointer           user_data;
-
-	GUdevDevice *dev;
-	const char *dev_path;
-	const char *name;
-	AccelVec3 *mount_matrix;
-	AccelLocation location;
-	int device_id;
-	BufferDrvData *buffer_data;
+	AccelTransform transform;
+	AccelMotion motion;
+	guint max_interval;
+	double accel[BUFFER_MAX_SCANS * 3];
 } DrvData;
 
-static DrvData *drv_data = NULL;
+static BufferDriver *drv_data = NULL;
+static BufferDriver *base_drv_data = NULL;
 
-static int
-process_scan (IIOSensorData data, DrvData *or_data)
+static gboolean
+accel_open (BufferDriver *driver,
+	    GUdevDevice  *device)
 {
-	int i;
-	int accel_x, accel_y, accel_z;
-	gboolean present_x, present_y, present_z;
-	AccelReadings readings;
-	AccelVec3 tmp;
+	DrvData *data = driver->priv;
 	AccelScale scale;
 
-	if (data.read_size < 0) {
-		g_warning ("Couldn't read from device '%s': %s", or_data->name, g_strerror (errno));
-		return 0;
-	}
-
-	/* Rather than read everything:
-	 * for (i = 0; i < data.read_size / or_data->scan_size; i++)...
-	 * Just read the last one */
-	i = (data.read_size / or_data->buffer_data->scan_size) - 1;
-	if (i < 0) {
-		g_debug ("Not enough data to read from '%s' (read_size: %d scan_size: %d)", or_data->name,
-			 (int) data.read_size, or_data->buffer_data->scan_size);
-		return 0;
-	}
-
-	process_scan_1(data.data + or_data->buffer_data->scan_size*i, or_data->buffer_data, "in_accel_x", &accel_x, &scale.x, &present_x);
-	process_scan_1(data.data + or_data->buffer_data->scan_size*i, or_data->buffer_data, "in_accel_y", &accel_y, &scale.y, &present_y);
-	process_scan_1(data.data + or_data->buffer_data->scan_size*i, or_data->buffer_data, "in_accel_z", &accel_z, &scale.z, &present_z);
-
-	g_debug ("Accel read from IIO on '%s': %d, %d, %d (scale %lf,%lf,%lf)", or_data->name,
-		 accel_x, accel_y, accel_z,
-		 scale.x, scale.y, scale.z);
-
-	tmp.x = accel_x;
-	tmp.y = accel_y;
-	tmp.z = accel_z;
-
-	if (!apply_mount_matrix (or_data->mount_matrix, &tmp))
-		g_warning ("Could not apply mount matrix");
-
-	//FIXME report errors
-	readings.accel_x = tmp.x;
-	readings.accel_y = tmp.y;
-	readings.accel_z = tmp.z;
-	copy_accel_scale (&readings.scale, scale);
-	or_data->callback_func (&iio_buffer_accel, (gpointer) &readings, or_data->user_data);
-
-	return 1;
+	driver->mount_matrix = setup_mount_matrix (device);
+	scale.x = driver->scales[0];
+	scale.y = driver->scales[1];
+	scale.z = driver->scales[2];
+	setup_accel_transform (&data->transform, driver->mount_matrix, scale);
+
+	data->max_interval = get_accel_poll_max_interval (device, POLL_INTERVAL);
+
+	return TRUE;
 }
 
 static void
-prepare_output (DrvData    *or_data,
-		const char *dev_dir_name,
-		const char *trigger_name)
+accel_set_polling (BufferDriver *driver,
+		   gboolean      state)
 {
-	IIOSensorData data;
+	DrvData *data = driver->priv;
 
-	int fp, buf_len = 127;
-
-	data.data = g_malloc(or_data->buffer_data->scan_size * buf_len);
-
-	/* Attempt to open non blocking to access dev */
-	fp = open (or_data->dev_path, O_RDONLY | O_NONBLOCK);
-	if (fp == -1) { /* If it isn't there make the node */
-		g_warning ("Failed to open '%s' at %s: %s", or_data->name, or_data->dev_path, g_strerror (errno));
-		goto bail;
-	}
+	if (state)
+		accel_motion_init (&data->motion, POLL_INTERVAL, data->max_interval);
+}
 
-	/* Actually read the data */
-	data.read_size = read (fp, data.data, buf_len * or_data->buffer_data->scan_size);
-	if (data.read_size == -1 && errno == EAGAIN) {
-		g_debug ("No new data available on '%s'", or_data->name);
-	} else {
-		process_scan(data, or_data);
-	}
+/* Back off while the device is lying still, see accel_motion_next_interval() */
+static void
+reschedule_poll (BufferDriver *driver)
+{
+	DrvData *data = driver->priv;
+	guint prev_interval, interval;
 
-	close(fp);
+	prev_interval = data->motion.interval;
+	interval = accel_motion_next_interval (&data->motion);
+	if (interval == prev_interval)
+		return;
 
-bail:
-	g_free(data.data);
+	g_debug ("Polling '%s' every %u ms", driver->name, interval);
+	buffer_driver_set_interval (driver, interval);
 }
 
-static char *
-get_trigger_name (GUdevDevice *device)
+static void
+accel_process (BufferDriver *driver,
+	       const int    *raw,
+	       guint         n_scans)
 {
-	GList *devices, *l;
-	GUdevClient *client;
-	gboolean has_trigger = FALSE;
-	char *trigger_name;
-	const gchar * const subsystems[] = { "iio", NULL };
-
-	client = g_udev_client_new (subsystems);
-	devices = g_udev_client_query_by_subsystem (client, "iio");
-
-	/* Find the associated trigger */
-	trigger_name = g_strdup_printf ("accel_3d-dev%s", g_udev_device_get_number (device));
-	for (l = devices; l != NULL; l = l->next) {
-		GUdevDevice *dev = l->data;
-
-		if (g_strcmp0 (trigger_name, g_udev_device_get_sysfs_attr (dev, "name")) == 0) {
-			g_debug ("Found associated trigger at %s", g_udev_device_get_sysfs_path (dev));
-			has_trigger = TRUE;
-			break;
-		}
-	}
-
-	g_list_free_full (devices, g_object_unref);
-	g_clear_object (&client);
-
-	if (has_trigger)
-		return trigger_name;
-
-	g_warning ("Could not find trigger name associated with %s",
-		   g_udev_device_get_sysfs_path (device));
-	g_free (trigger_name);
-	return NULL;
+	DrvData *data = driver->priv;
+	AccelReadings readings;
+	guint i;
+
+	/* Convert the whole batch in one go, and send the most recent reading */
+	n_scans = MIN (n_scans, BUFFER_MAX_SCANS);
+	apply_accel_transform_n (&data->transform, raw, data->accel, n_scans);
+	i = (n_scans - 1) * 3;
+
+	g_debug ("Accel read from IIO on '%s': %d, %d, %d (%lf, %lf, %lf m/s², %u scans)", driver->name,
+		 raw[i], raw[i + 1], raw[i + 2],
+		 data->accel[i], data->accel[i + 1], data->accel[i + 2],
+		 n_scans);
+
+	readings.accel_x = data->accel[i];
+	readings.accel_y = data->accel[i + 1];
+	readings.accel_z = data->accel[i + 2];
+	buffer_driver_send (driver, &readings);
+
+	/* All the scans since the last read tell whether the device moved */
+	accel_motion_add_samples (&data->motion, data->accel, n_scans);
+	reschedule_poll (driver);
 }
 
+static const BufferDriverSpec accel_spec = {
+	.driver = &iio_buffer_accel,
+	.udev_type = "iio-buffer-accel",
+	.trigger_prefix = "accel_3d",
+	.channels = { { "in_accel_x" }, { "in_accel_y" }, { "in_accel_z" } },
+	.interval = POLL_INTERVAL,
+	.priv_size = sizeof (DrvData),
+
+	.open = accel_open,
+	.set_polling = accel_set_polling,
+	.process = accel_process,
+};
 
-static gboolean
-read_orientation (gpointer user_data)
-{
-	DrvData *data = user_data;
-
-	prepare_output (data, data->buffer_data->dev_dir_name, data->buffer_data->trigger_name);
-
-	return G_SOURCE_CONTINUE;
-}
+/* The same, for the second accelerometer of 2-in-1s, in the base */
+static const BufferDriverSpec accel_base_spec = {
+	.driver = &iio_buffer_accel_base,
+	.udev_type = "iio-buffer-accel",
+	.trigger_prefix = "accel_3d",
+	.channels = { { "in_accel_x" }, { "in_accel_y" }, { "in_accel_z" } },
+	.interval = POLL_INTERVAL,
+	.priv_size = sizeof (DrvData),
+
+	.open = accel_open,
+	.set_polling = accel_set_polling,
+	.process = accel_process,
+};
 
-static gboolean
-iio_buffer_accel_discover (GUdevDevice *device)
+/**
+ * iio_buffer_accel_get_gravity:
+ * @buffer_data: the buffer a scan was read from
+ * @scan: the scan
+ * @gravity: (out): the reading, in m/s², with the mount matrix applied
+ *
+ * Decodes a scan of the display accelerometer, as paired with scans of
+ * other sensors by their capture group.
+ *
+ * Returns: %FALSE if @buffer_data isn't the display accelerometer's
+ **/
+gboolean
+iio_buffer_accel_get_gravity (BufferDrvData *buffer_data,
+			      const char    *scan,
+			      double         gravity[3])
 {
-	char *trigger_name;
-
-	if (!drv_check_udev_sensor_type (device, "iio-buffer-accel", NULL))
-	    return FALSE;
+	DrvData *data;
+	int raw[3];
 
-	/* If we can't find an associated trigger, fallback to the iio-poll-accel driver */
-	trigger_name = get_trigger_name (device);
-	if (!trigger_name)
+	if (drv_data == NULL || drv_data->buffer_data != buffer_data)
 		return FALSE;
-	g_free (trigger_name);
 
-	g_debug ("Found IIO buffer accelerometer at %s", g_udev_device_get_sysfs_path (device));
+	data = drv_data->priv;
+	buffer_driver_decode_scan (drv_data, scan, raw);
+	apply_accel_transform (&data->transform, raw, gravity);
 	return TRUE;
 }
 
-static void
-iio_buffer_accel_set_polling (gboolean state)
+static gboolean
+iio_buffer_accel_discover (GUdevDevice *device)
 {
-	if (drv_data->timeout_id > 0 && state)
-		return;
-	if (drv_data->timeout_id == 0 && !state)
-		return;
-
-	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
-		drv_data->timeout_id = 0;
-	}
-
-	if (state) {
-		drv_data->timeout_id = g_timeout_add (700, read_orientation, drv_data);
-		g_source_set_name_by_id (drv_data->timeout_id, "[iio_buffer_accel_set_polling] read_orientation");
-	}
+	return buffer_driver_discover (&accel_spec, device);
 }
 
 static gboolean
@@ -202,46 +163,20 @@ iio_buffer_accel_open (GUdevDevice        *device,
 		       ReadingsUpdateFunc  callback_func,
 		       gpointer            user_data)
 {
-	char *trigger_name;
-
-	drv_data = g_new0 (DrvData, 1);
-
-	/* Get the trigger name, and build the channels from that */
-	trigger_name = get_trigger_name (device);
-	if (!trigger_name) {
-		g_clear_pointer (&drv_data, g_free);
-		return FALSE;
-	}
-	drv_data->buffer_data = buffer_drv_data_new (device, trigger_name);
-	g_free (trigger_name);
-
-	if (!drv_data->buffer_data) {
-		g_clear_pointer (&drv_data, g_free);
-		return FALSE;
-	}
-
-	drv_data->mount_matrix = setup_mount_matrix (device);
-	drv_data->location = setup_accel_location (device);
-	drv_data->dev = g_object_ref (device);
-	drv_data->dev_path = g_udev_device_get_device_file (device);
-	drv_data->name = g_udev_device_get_property (device, "NAME");
-	if (!drv_data->name)
-		drv_data->name = g_udev_device_get_name (device);
-
-	drv_data->callback_func = callback_func;
-	drv_data->user_data = user_data;
+	drv_data = buffer_driver_open (&accel_spec, device, callback_func, user_data);
+	return drv_data != NULL;
+}
 
-	return TRUE;
+static void
+iio_buffer_accel_set_polling (gboolean state)
+{
+	buffer_driver_set_polling (drv_data, state);
 }
 
 static void
 iio_buffer_accel_close (void)
 {
-	iio_buffer_accel_set_polling (FALSE);
-	g_clear_pointer (&drv_data->buffer_data, buffer_drv_data_free);
-	g_clear_object (&drv_data->dev);
-	g_clear_pointer (&drv_data->mount_matrix, g_free);
-	g_clear_pointer (&drv_data, g_free);
+	g_clear_pointer (&drv_data, buffer_driver_close);
 }
 
 SensorDriver iio_buffer_accel = {
@@ -254,3 +189,41 @@ SensorDriver iio_buffer_accel = {
 	.set_polling = iio_buffer_accel_set_polling,
 	.close = iio_buffer_accel_close,
 };
+
+static gboolean
+iio_buffer_accel_base_discover (GUdevDevice *device)
+{
+	return buffer_driver_discover (&accel_base_spec, device);
+}
+
+static gboolean
+iio_buffer_accel_base_open (GUdevDevice        *device,
+			    ReadingsUpdateFunc  callback_func,
+			    gpointer            user_data)
+{
+	base_drv_data = buffer_driver_open (&accel_base_spec, device, callback_func, user_data);
+	return base_drv_data != NULL;
+}
+
+static void
+iio_buffer_accel_base_set_polling (gboolean state)
+{
+	buffer_driver_set_polling (base_drv_data, state);
+}
+
+static void
+iio_buffer_accel_base_close (void)
+{
+	g_clear_pointer (&base_drv_data, buffer_driver_close);
+}
+
+SensorDriver iio_buffer_accel_base = {
+	.name = "IIO Buffer base accelerometer",
+	.type = DRIVER_TYPE_ACCEL_BASE,
+	.specific_type = DRIVER_TYPE_ACCEL_IIO,
+
+	.discover = iio_buffer_accel_base_discover,
+	.open = iio_buffer_accel_base_open,
+	.set_polling = iio_buffer_accel_base_set_polling,
+	.close = iio_buffer_accel_base_close,
+};
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#include <string.h>
+
+#include "drivers.h"
+#include "buffer-driver.h"
+#include "capture-group.h"
+#include "compass-calibration.h"
+
+typedef struct {
+	CompassCalibration  calibration;
+	guint               tuple_id;
+
+	/* The latest scan read at the same time as an accelerometer
+	 * scan, in the current wakeup */
+	gboolean            has_pair;
+	int                 paired_magn[3];
+	double              paired_gravity[3];
+} DrvData;
+
+static BufferDriver *drv_data = NULL;
+
+static gboolean
+compass_open (BufferDriver *driver,
+	      GUdevDevice  *device)
+{
+	DrvData *data = driver->priv;
+
+	compass_calibration_init (&data->calibration, g_udev_device_get_sysfs_path (device));
+	driver->mount_matrix = setup_magn_mount_matrix (device);
+
+	return TRUE;
+}
+
+/* When the accelerometer is on the same chip, its scans are paired with
+ * ours, so that the tilt is compensated with the one at the same time */
+static void
+compass_tuple (BufferDrvData **buffers,
+	       const char    **scans,
+	       guint           n_members,
+	       gboolean        aligned,
+	       gpointer        user_data)
+{
+	BufferDriver *driver = user_data;
+	DrvData *data = driver->priv;
+	const char *magn_scan = NULL;
+	double gravity[3];
+	gboolean has_gravity = FALSE;
+	guint i;
+
+	if (!aligned)
+		return;
+
+	for (i = 0; i < n_members; i++) {
+		if (buffers[i] == driver->buffer_data)
+			magn_scan = scans[i];
+		else if (!has_gravity)
+			has_gravity = iio_buffer_accel_get_gravity (buffers[i], scans[i], gravity);
+	}
+	if (magn_scan == NULL || !has_gravity)
+		return;
+
+	/* Tuples come oldest first, so this ends up with the latest */
+	buffer_driver_decode_scan (driver, magn_scan, data->paired_magn);
+	memcpy (data->paired_gravity, gravity, sizeof (gravity));
+	data->has_pair = TRUE;
+}
+
+static void
+compass_set_polling (BufferDriver *driver,
+		     gboolean      state)
+{
+	DrvData *data = driver->priv;
+
+	if (state) {
+		data->tuple_id = capture_group_add_tuple_func (driver->dev, compass_tuple, driver);
+	} else {
+		if (data->tuple_id != 0) {
+			capture_group_remove_tuple_func (driver->dev, data->tuple_id);
+			data->tuple_id = 0;
+		}
+		data->has_pair = FALSE;
+		compass_calibration_save (&data->calibration);
+	}
+}
+
+static void
+compass_process (BufferDriver *driver,
+		 const int    *magn,
+		 guint         n_scans)
+{
+	DrvData *data = driver->priv;
+	CompassReadings readings;
+
+	compass_calibration_add_sample (&data->calibration, magn[0], magn[1], magn[2]);
+	if (data->has_pair) {
+		magn = data->paired_magn;
+		data->has_pair = FALSE;
+		compass_calibration_get_readings (&data->calibration, driver->mount_matrix,
+						  magn[0], magn[1], magn[2], &readings);
+		readings.has_gravity = TRUE;
+		readings.gravity_x = data->paired_gravity[0];
+		readings.gravity_y = data->paired_gravity[1];
+		readings.gravity_z = data->paired_gravity[2];
+	} else {
+		compass_calibration_get_readings (&data->calibration, driver->mount_matrix,
+						  magn[0], magn[1], magn[2], &readings);
+	}
+	g_debug ("Heading read from IIO on '%s': %f (%d, %d, %d%s)", driver->name,
+		 readings.heading, magn[0], magn[1], magn[2],
+		 readings.has_gravity ? ", with accelerometer scan" : "");
+
+	buffer_driver_send (driver, &readings);
+}
+
+static void
+compass_close (BufferDriver *driver)
+{
+	DrvData *data = driver->priv;
+
+	compass_calibration_clear (&data->calibration);
+}
+
+static const BufferDriverSpec compass_spec = {
+	.driver = &iio_buffer_compass_uncalibrated,
+	.udev_type = "iio-buffer-compass-uncalibrated",
+	.trigger_prefix = "magn_3d",
+	.channels = { { "in_magn_x" }, { "in_magn_y" }, { "in_magn_z" } },
+	.latest_only = TRUE,
+	.interval = 700,
+	.priv_size = sizeof (DrvData),
+
+	.open = compass_open,
+	.set_polling = compass_set_polling,
+	.process = compass_process,
+	.close = compass_close,
+};
+
+static gboolean
+iio_buffer_compass_uncalibrated_discover (GUdevDevice *device)
+{
+	return buffer_driver_discover (&compass_spec, device);
+}
+
+static gboolean
+iio_buffer_compass_uncalibrated_open (GUdevDevice        *device,
+				      ReadingsUpdateFunc  callback_func,
+				      gpointer            user_data)
+{
+	drv_data = buffer_driver_open (&compass_spec, device, callback_func, user_data);
+	return drv_data != NULL;
+}
+
+static void
+iio_buffer_compass_uncalibrated_set_polling (gboolean state)
+{
+	buffer_driver_set_polling (drv_data, state);
+}
+
+static void
+iio_buffer_compass_uncalibrated_close (void)
+{
+	g_clear_pointer (&drv_data, buffer_driver_close);
+}
+
+SensorDriver iio_buffer_compass_uncalibrated = {
+	.name = "IIO Buffer Uncalibrated Compass",
+	.type = DRIVER_TYPE_COMPASS,
+	.specific_type = DRIVER_TYPE_COMPASS_IIO_UNCALIBRATED,
+
+	.discover = iio_buffer_compass_uncalibrated_discover,
+	.open = iio_buffer_compass_uncalibrated_open,
+	.set_polling = iio_buffer_compass_uncalibrated_set_polling,
+	.close = iio_buffer_compass_uncalibrated_close,
+};
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#include "drivers.h"
+#include "buffer-driver.h"
+#include "accel-mount-matrix.h"
+
+#define BUFFER_MAX_SCANS   127
+/* Reading the buffer 20 times a second keeps the latency low,
+ * and the number of wake-ups independent of the sampling rate */
+#define POLL_INTERVAL      50
+#define SAMPLING_FREQUENCY 100 /* Hz */
+
+typedef struct {
+	AccelTransform transform;
+	double rates[BUFFER_MAX_SCANS * 3];
+	GyroSample samples[BUFFER_MAX_SCANS];
+} DrvData;
+
+static BufferDriver *drv_data = NULL;
+
+static gboolean
+gyro_open (BufferDriver *driver,
+	   GUdevDevice  *device)
+{
+	DrvData *data = driver->priv;
+	AccelScale scale;
+
+	/* The scale is to rad/s, the transform is only named after
+	 * the accelerometer it was written for */
+	driver->mount_matrix = setup_gyro_mount_matrix (device);
+	scale.x = driver->scales[0];
+	scale.y = driver->scales[1];
+	scale.z = driver->scales[2];
+	setup_accel_transform (&data->transform, driver->mount_matrix, scale);
+
+	g_debug ("Gyroscope '%s' sampling at %.0f Hz, %s kernel timestamps", driver->name,
+		 driver->sampling_frequency, driver->timestamp_channel >= 0 ? "with" : "without");
+
+	return TRUE;
+}
+
+static void
+gyro_process (BufferDriver *driver,
+	      const int    *raw,
+	      guint         n_scans)
+{
+	DrvData *data = driver->priv;
+	GyroReadings readings;
+	guint i;
+
+	n_scans = MIN (n_scans, BUFFER_MAX_SCANS);
+	apply_accel_transform_n (&data->transform, raw, data->rates, n_scans);
+
+	for (i = 0; i < n_scans; i++) {
+		data->samples[i].timestamp = driver->timestamps[i];
+		data->samples[i].x = data->rates[i * 3];
+		data->samples[i].y = data->rates[i * 3 + 1];
+		data->samples[i].z = data->rates[i * 3 + 2];
+	}
+
+	g_debug ("Gyro read from IIO on '%s': %u scans, last %lf, %lf, %lf rad/s", driver->name,
+		 n_scans, data->samples[n_scans - 1].x, data->samples[n_scans - 1].y,
+		 data->samples[n_scans - 1].z);
+
+	readings.n_samples = n_scans;
+	readings.samples = data->samples;
+	buffer_driver_send (driver, &readings);
+}
+
+static const BufferDriverSpec gyro_spec = {
+	.driver = &iio_buffer_gyro,
+	.udev_type = "iio-buffer-gyro",
+	.trigger_prefix = "gyro_3d",
+	.channels = { { "in_anglvel_x" }, { "in_anglvel_y" }, { "in_anglvel_z" } },
+	.timestamps = TRUE,
+	.sampling_frequency = SAMPLING_FREQUENCY,
+	.interval = POLL_INTERVAL,
+	.priv_size = sizeof (DrvData),
+
+	.open = gyro_open,
+	.process = gyro_process,
+};
+
+static gboolean
+iio_buffer_gyro_discover (GUdevDevice *device)
+{
+	return buffer_driver_discover (&gyro_spec, device);
+}
+
+static gboolean
+iio_buffer_gyro_open (GUdevDevice        *device,
+		      ReadingsUpdateFunc  callback_func,
+		      gpointer            user_data)
+{
+	drv_data = buffer_driver_open (&gyro_spec, device, callback_func, user_data);
+	return drv_data != NULL;
+}
+
+static void
+iio_buffer_gyro_set_polling (gboolean state)
+{
+	buffer_driver_set_polling (drv_data, state);
+}
+
+static void
+iio_buffer_gyro_close (void)
+{
+	g_clear_pointer (&drv_data, buffer_driver_close);
+}
+
+SensorDriver iio_buffer_gyro = {
+	.name = "IIO Buffer gyroscope",
+	.type = DRIVER_TYPE_GYRO,
+	.specific_type = DRIVER_TYPE_GYRO_IIO,
+
+	.discover = iio_buffer_gyro_discover,
+	.open = iio_buffer_gyro_open,
+	.set_polling = iio_buffer_gyro_set_polling,
+	.close = iio_buffer_gyro_close,
+};
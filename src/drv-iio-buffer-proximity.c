@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#include "drivers.h"
+#include "buffer-driver.h"
+#include "proximity.h"
+
+typedef struct {
+	gint near_level;
+	gint last_level;
+} DrvData;
+
+static BufferDriver *drv_data = NULL;
+
+static gboolean
+proximity_open (BufferDriver *driver,
+		GUdevDevice  *device)
+{
+	DrvData *data = driver->priv;
+
+	data->near_level = get_proximity_near_level (device);
+	return data->near_level != 0;
+}
+
+static void
+proximity_process (BufferDriver *driver,
+		   const int    *values,
+		   guint         n_scans)
+{
+	DrvData *data = driver->priv;
+	ProximityReadings readings;
+	int prox = values[0];
+
+	readings.is_near = get_proximity_near (prox, data->last_level, data->near_level);
+	g_debug ("Proximity read from IIO on '%s': %d/%d, near: %d", driver->name, prox, data->near_level, readings.is_near);
+	data->last_level = prox;
+
+	buffer_driver_send (driver, &readings);
+}
+
+static const BufferDriverSpec proximity_spec = {
+	.driver = &iio_buffer_proximity,
+	.udev_type = "iio-buffer-proximity",
+	.trigger_prefix = "prox",
+	.channels = { { "in_proximity" } },
+	/* Only the most recent state matters */
+	.latest_only = TRUE,
+	.interval = 700,
+	.priv_size = sizeof (DrvData),
+
+	.open = proximity_open,
+	.process = proximity_process,
+};
+
+static gboolean
+iio_buffer_proximity_discover (GUdevDevice *device)
+{
+	return buffer_driver_discover (&proximity_spec, device);
+}
+
+static gboolean
+iio_buffer_proximity_open (GUdevDevice        *device,
+			   ReadingsUpdateFunc  callback_func,
+			   gpointer            user_data)
+{
+	drv_data = buffer_driver_open (&proximity_spec, device, callback_func, user_data);
+	return drv_data != NULL;
+}
+
+static void
+iio_buffer_proximity_set_polling (gboolean state)
+{
+	buffer_driver_set_polling (drv_data, state);
+}
+
+static void
+iio_buffer_proximity_close (void)
+{
+	g_clear_pointer (&drv_data, buffer_driver_close);
+}
+
+SensorDriver iio_buffer_proximity = {
+	.name = "IIO Buffer proximity sensor",
+	.type = DRIVER_TYPE_PROXIMITY,
+	.specific_type = DRIVER_TYPE_PROXIMITY_IIO,
+
+	.discover = iio_buffer_proximity_discover,
+	.open = iio_buffer_proximity_open,
+	.set_polling = iio_buffer_proximity_set_polling,
+	.close = iio_buffer_proximity_close,
+};
@@ -9,6 +9,10 @@
 #include "drivers.h"
 #include "iio-buffer-utils.h"
 #include "accel-mount-matrix.h"
+#include "accel-motion.h"
+#include "wakeup-scheduler.h"
+#include "sensor-trace.h"
+#include "time-source.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -17,18 +21,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#define POLL_INTERVAL 700
+
 typedef struct DrvData {
+	SensorDriver       *driver;
 	guint               timeout_id;
 	ReadingsUpdateFunc  callback_func;
 	gpointer            user_data;
 	GUdevDevice        *dev;
 	const char         *name;
-	AccelVec3          *mount_matrix;
+	AccelTransform      transform;
 	AccelLocation       location;
-	AccelScale          scale;
+	AccelMotion         motion;
+	guint               max_interval;
+	SensorTraceWriter  *trace;
 } DrvData;
 
 static DrvData *drv_data = NULL;
+static DrvData *base_drv_data = NULL;
 
 static int
 sysfs_get_int (GUdevDevice *dev,
@@ -49,36 +59,62 @@ sysfs_get_int (GUdevDevice *dev,
 	return result;
 }
 
-static gboolean
-poll_orientation (gpointer user_data)
+static gboolean poll_orientation (gpointer user_data);
+
+/* Back off while the device is lying still, see accel_motion_next_interval() */
+static void
+reschedule_poll (DrvData *data)
 {
-	DrvData *data = user_data;
-	int accel_x, accel_y, accel_z;
+	guint prev_interval, interval;
+
+	prev_interval = data->motion.interval;
+	interval = accel_motion_next_interval (&data->motion);
+	if (interval == prev_interval)
+		return;
+
+	g_debug ("Polling '%s' every %u ms", data->name, interval);
+	wakeup_scheduler_set_interval (data->timeout_id, interval);
+}
+
+static void
+read_orientation (DrvData *data)
+{
+	int raw[3];
+	double accel[3];
 	AccelReadings readings;
-	AccelVec3 tmp;
 
-	accel_x = sysfs_get_int (data->dev, "in_accel_x_raw");
-	accel_y = sysfs_get_int (data->dev, "in_accel_y_raw");
-	accel_z = sysfs_get_int (data->dev, "in_accel_z_raw");
-	copy_accel_scale (&readings.scale, data->scale);
+	raw[0] = sysfs_get_int (data->dev, "in_accel_x_raw");
+	raw[1] = sysfs_get_int (data->dev, "in_accel_y_raw");
+	raw[2] = sysfs_get_int (data->dev, "in_accel_z_raw");
 
-	g_debug ("Accel read from IIO on '%s': %d, %d, %d (scale %lf,%lf,%lf)", data->name,
-		 accel_x, accel_y, accel_z,
-		 data->scale.x, data->scale.y, data->scale.z);
+	if (data->trace) {
+		gint64 now = time_source_get_time ();
+		sensor_trace_writer_add (data->trace, &now, raw, 1);
+	}
 
-	tmp.x = accel_x;
-	tmp.y = accel_y;
-	tmp.z = accel_z;
+	apply_accel_transform (&data->transform, raw, accel);
 
-	if (!apply_mount_matrix (drv_data->mount_matrix, &tmp))
-		g_warning ("Could not apply mount matrix");
+	g_debug ("Accel read from IIO on '%s': %d, %d, %d (%lf, %lf, %lf m/s²)", data->name,
+		 raw[0], raw[1], raw[2],
+		 accel[0], accel[1], accel[2]);
 
 	//FIXME report errors
-	readings.accel_x = tmp.x;
-	readings.accel_y = tmp.y;
-	readings.accel_z = tmp.z;
+	readings.accel_x = accel[0];
+	readings.accel_y = accel[1];
+	readings.accel_z = accel[2];
 
-	drv_data->callback_func (&iio_poll_accel, (gpointer) &readings, drv_data->user_data);
+	data->callback_func (data->driver, (gpointer) &readings, data->user_data);
+
+	accel_motion_add_samples (&data->motion, accel, 1);
+}
+
+static gboolean
+poll_orientation (gpointer user_data)
+{
+	DrvData *data = user_data;
+
+	read_orientation (data);
+	reschedule_poll (data);
 
 	return G_SOURCE_CONTINUE;
 }
@@ -96,51 +132,108 @@ iio_poll_accel_discover (GUdevDevice *device)
 }
 
 static void
-iio_poll_accel_set_polling (gboolean state)
+poll_accel_set_polling (DrvData  *data,
+			gboolean  state)
 {
-	if (drv_data->timeout_id > 0 && state)
+	if (data->timeout_id > 0 && state)
 		return;
-	if (drv_data->timeout_id == 0 && !state)
+	if (data->timeout_id == 0 && !state)
 		return;
 
-	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
-		drv_data->timeout_id = 0;
-	}
+	g_clear_handle_id (&data->timeout_id, wakeup_scheduler_remove);
 
 	if (state) {
-		drv_data->timeout_id = g_timeout_add (700, poll_orientation, drv_data);
-		g_source_set_name_by_id (drv_data->timeout_id, "[iio_poll_accel_set_polling] poll_orientation");
+		accel_motion_init (&data->motion, POLL_INTERVAL, data->max_interval);
+		data->timeout_id = wakeup_scheduler_add (POLL_INTERVAL, WAKEUP_DEFAULT_TOLERANCE (POLL_INTERVAL),
+							 poll_orientation, data,
+							 "[poll_accel_set_polling] poll_orientation");
+
+		/* And send a reading straight away */
+		read_orientation (data);
 	}
 }
 
+static void
+start_trace (DrvData          *data,
+	     const AccelVec3   mount_matrix[3],
+	     AccelScale        scale)
+{
+	SensorTraceHeader header = { 0, };
+
+	header.type = data->driver->type;
+	header.location = data->location;
+	header.n_channels = 3;
+	header.sampling_frequency = 1000.0 / POLL_INTERVAL;
+	g_strlcpy (header.channels[0], "in_accel_x", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	g_strlcpy (header.channels[1], "in_accel_y", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	g_strlcpy (header.channels[2], "in_accel_z", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	header.scales[0] = scale.x;
+	header.scales[1] = scale.y;
+	header.scales[2] = scale.z;
+	memcpy (header.mount_matrix, mount_matrix, sizeof (header.mount_matrix));
+
+	data->trace = sensor_trace_start_recording (data->dev, &header);
+}
+
+static DrvData *
+poll_accel_open (SensorDriver       *driver,
+		 GUdevDevice        *device,
+		 ReadingsUpdateFunc  callback_func,
+		 gpointer            user_data)
+{
+	DrvData *data;
+	AccelVec3 *mount_matrix;
+	AccelScale scale;
+
+	iio_fixup_sampling_frequency (device);
+
+	data = g_new0 (DrvData, 1);
+	data->driver = driver;
+	data->dev = g_object_ref (device);
+	data->name = g_udev_device_get_sysfs_attr (device, "name");
+	data->location = setup_accel_location (device);
+	data->max_interval = get_accel_poll_max_interval (device, POLL_INTERVAL);
+	data->callback_func = callback_func;
+	data->user_data = user_data;
+
+	mount_matrix = setup_mount_matrix (device);
+	if (!get_accel_scale (device, &scale))
+		reset_accel_scale (&scale);
+	setup_accel_transform (&data->transform, mount_matrix, scale);
+	start_trace (data, mount_matrix, scale);
+	g_free (mount_matrix);
+
+	return data;
+}
+
+static void
+poll_accel_close (DrvData *data)
+{
+	poll_accel_set_polling (data, FALSE);
+	g_clear_pointer (&data->trace, sensor_trace_writer_free);
+	g_clear_object (&data->dev);
+	g_free (data);
+}
+
+static void
+iio_poll_accel_set_polling (gboolean state)
+{
+	poll_accel_set_polling (drv_data, state);
+}
+
 static gboolean
 iio_poll_accel_open (GUdevDevice        *device,
 		     ReadingsUpdateFunc  callback_func,
 		     gpointer            user_data)
 {
-	iio_fixup_sampling_frequency (device);
-
-	drv_data = g_new0 (DrvData, 1);
-	drv_data->dev = g_object_ref (device);
-	drv_data->name = g_udev_device_get_sysfs_attr (device, "name");
-	drv_data->mount_matrix = setup_mount_matrix (device);
-	drv_data->location = setup_accel_location (device);
-	drv_data->callback_func = callback_func;
-	drv_data->user_data = user_data;
-	if (!get_accel_scale (device, &drv_data->scale))
-		reset_accel_scale (&drv_data->scale);
-
+	drv_data = poll_accel_open (&iio_poll_accel, device, callback_func, user_data);
 	return TRUE;
 }
 
 static void
 iio_poll_accel_close (void)
 {
-	iio_poll_accel_set_polling (FALSE);
-	g_clear_object (&drv_data->dev);
-	g_clear_pointer (&drv_data->mount_matrix, g_free);
-	g_clear_pointer (&drv_data, g_free);
+	g_clear_pointer (&drv_data, poll_accel_close);
 }
 
 SensorDriver iio_poll_accel = {
@@ -153,3 +246,36 @@ SensorDriver iio_poll_accel = {
 	.set_polling = iio_poll_accel_set_polling,
 	.close = iio_poll_accel_close,
 };
+
+/* The same, for the second accelerometer of 2-in-1s, in the base */
+static void
+iio_poll_accel_base_set_polling (gboolean state)
+{
+	poll_accel_set_polling (base_drv_data, state);
+}
+
+static gboolean
+iio_poll_accel_base_open (GUdevDevice        *device,
+			  ReadingsUpdateFunc  callback_func,
+			  gpointer            user_data)
+{
+	base_drv_data = poll_accel_open (&iio_poll_accel_base, device, callback_func, user_data);
+	return TRUE;
+}
+
+static void
+iio_poll_accel_base_close (void)
+{
+	g_clear_pointer (&base_drv_data, poll_accel_close);
+}
+
+SensorDriver iio_poll_accel_base = {
+	.name = "IIO Poll base accelerometer",
+	.type = DRIVER_TYPE_ACCEL_BASE,
+	.specific_type = DRIVER_TYPE_ACCEL_IIO,
+
+	.discover = iio_poll_accel_discover,
+	.open = iio_poll_accel_base_open,
+	.set_polling = iio_poll_accel_base_set_polling,
+	.close = iio_poll_accel_base_close,
+};
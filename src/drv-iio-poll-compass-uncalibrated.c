@@ -8,20 +8,11 @@
 
 #include "drivers.h"
 #include "iio-buffer-utils.h"
+#include "compass-calibration.h"
+#include "wakeup-scheduler.h"
 
 #include <string.h>
 #include <errno.h>
-#include <math.h>
-
-typedef struct {
-  gint               x_max;
-  gint               x_min;
-  gint               y_max;
-  gint               y_min;
-  gint               z_max;
-  gint               z_min;
-  gboolean           is_calibrated;
-} CalibrationData;
 
 typedef struct {
   guint               timeout_id;
@@ -32,7 +23,8 @@ typedef struct {
 	const char         *dev_path;
 	const char         *name;
 
-  CalibrationData    *calibration_data;
+  CompassCalibration  calibration;
+  AccelVec3          *mount_matrix;
 } DrvData;
 
 static DrvData *drv_data = NULL;
@@ -62,40 +54,14 @@ poll_heading (gpointer user_data)
 	DrvData *data = user_data;
   int magn_x, magn_y, magn_z;
   CompassReadings readings;
-  double avg_delta_x, avg_delta_y, avg_delta_z, avg_delta;
-  double offset_x, offset_y, offset_z;
-  double scale_x, scale_y, scale_z, corrected_x, corrected_y, corrected_z;
 
   magn_x = sysfs_get_int (data->dev, "in_magn_x_raw");
   magn_y = sysfs_get_int (data->dev, "in_magn_y_raw");
   magn_z = sysfs_get_int (data->dev, "in_magn_z_raw");
 
-  if (data->calibration_data->is_calibrated)
-    {
-      offset_x = (data->calibration_data->x_min + data->calibration_data->x_max) / 2;
-      offset_y = (data->calibration_data->y_min + data->calibration_data->y_max) / 2;
-      offset_z = (data->calibration_data->z_min + data->calibration_data->z_max) / 2;
-
-      avg_delta_x = (data->calibration_data->x_max - data->calibration_data->x_min) / 2;
-      avg_delta_y = (data->calibration_data->y_max - data->calibration_data->y_min) / 2;
-      avg_delta_z = (data->calibration_data->z_max - data->calibration_data->z_min) / 2;
-
-      avg_delta = (avg_delta_x + avg_delta_y + avg_delta_z) / 3;
-
-      scale_x = avg_delta / avg_delta_x;
-      scale_y = avg_delta / avg_delta_y;
-      scale_z = avg_delta / avg_delta_z;
-
-      corrected_x = (magn_x - offset_x) * scale_x;
-      corrected_y = (magn_y - offset_y) * scale_y;
-      //corrected_z = (magn_z - offset_z) * scale_z;
-
-      readings.heading = atan2 (corrected_x, corrected_y) * 180 / G_PI;
-    }
-  else
-    readings.heading = atan2 (magn_x, magn_y) * 180 / G_PI;
-
-  // Mount matrix?
+  compass_calibration_add_sample (&data->calibration, magn_x, magn_y, magn_z);
+  compass_calibration_get_readings (&data->calibration, data->mount_matrix,
+                                    magn_x, magn_y, magn_z, &readings);
 
   drv_data->callback_func (&iio_poll_compass_uncalibrated, (gpointer) &readings, drv_data->user_data);
 
@@ -114,14 +80,8 @@ gboolean iio_compass_open (GUdevDevice *device,
 {
   iio_fixup_sampling_frequency (device);
 	drv_data = g_new0 (DrvData, 1);
-  drv_data->calibration_data = g_new0 (CalibrationData, 1);
-  drv_data->calibration_data->x_min = -7912;
-  drv_data->calibration_data->x_max = -1648;
-  drv_data->calibration_data->y_min = -6554;
-  drv_data->calibration_data->y_max = -528;
-  drv_data->calibration_data->z_min = -3074;
-  drv_data->calibration_data->z_max = 2720;
-  drv_data->calibration_data->is_calibrated = TRUE;
+  compass_calibration_init (&drv_data->calibration, g_udev_device_get_sysfs_path (device));
+  drv_data->mount_matrix = setup_magn_mount_matrix (device);
 
 	drv_data->dev = g_object_ref (device);
 	drv_data->name = g_udev_device_get_sysfs_attr (device, "name");
@@ -139,22 +99,26 @@ void iio_compass_set_polling (gboolean state)
 	if (drv_data->timeout_id == 0 && !state)
 		return;
 
-	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
-		drv_data->timeout_id = 0;
-	}
+	g_clear_handle_id (&drv_data->timeout_id, wakeup_scheduler_remove);
 
 	if (state) {
-		drv_data->timeout_id = g_timeout_add (700, poll_heading, drv_data);
-		g_source_set_name_by_id (drv_data->timeout_id, "[iio_compass_set_polling] poll_heading");
+		drv_data->timeout_id = wakeup_scheduler_add (700, WAKEUP_DEFAULT_TOLERANCE (700),
+							     poll_heading, drv_data,
+							     "[iio_compass_set_polling] poll_heading");
+
+		/* And send a reading straight away */
+		poll_heading (drv_data);
+	} else {
+		compass_calibration_save (&drv_data->calibration);
 	}
 }
 
 void iio_compass_close (void)
 {
  	iio_compass_set_polling (FALSE);
+	compass_calibration_clear (&drv_data->calibration);
+	g_clear_pointer (&drv_data->mount_matrix, g_free);
 	g_clear_object (&drv_data->dev);
-  g_free (&drv_data->calibration_data);
 	g_clear_pointer (&drv_data, g_free);
 }
 
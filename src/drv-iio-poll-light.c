@@ -8,6 +8,8 @@
 
 #include "drivers.h"
 #include "iio-buffer-utils.h"
+#include "iio-events.h"
+#include "wakeup-scheduler.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -15,7 +17,12 @@
 #include <errno.h>
 #include <stdio.h>
 
+#include <glib-unix.h>
+
 #define DEFAULT_POLL_TIME 0.8
+/* Width of the threshold events window either side of the current
+ * level, as a ratio, so that it's the same in the log domain */
+#define EVENT_WINDOW      1.1
 
 typedef struct DrvData {
 	ReadingsUpdateFunc  callback_func;
@@ -26,6 +33,15 @@ typedef struct DrvData {
 	guint               timeout_id;
 
 	double              scale;
+
+	/* Threshold events, instead of polling */
+	GUdevDevice        *dev;
+	const char         *event_channel;
+	char               *raw_path;
+	int                 event_fd;
+	guint               event_id;
+	int                 event_low;
+	int                 event_high;
 } DrvData;
 
 static DrvData *drv_data = NULL;
@@ -36,6 +52,57 @@ iio_poll_light_discover (GUdevDevice *device)
 	return drv_check_udev_sensor_type (device, "iio-poll-als", "IIO poll als");
 }
 
+static gboolean
+set_threshold (const char *direction,
+	       int         value)
+{
+	if (!iio_events_set_threshold (drv_data->dev, drv_data->event_channel, direction, value))
+		return FALSE;
+	if (g_str_equal (direction, "falling"))
+		drv_data->event_low = value;
+	else
+		drv_data->event_high = value;
+	return TRUE;
+}
+
+/* Event thresholds are in raw units, whichever channel is read */
+static gboolean
+set_event_window (void)
+{
+	g_autofree char *contents = NULL;
+	gdouble level;
+	int low, high;
+
+	if (!g_file_get_contents (drv_data->raw_path, &contents, NULL, NULL))
+		return FALSE;
+	level = g_ascii_strtod (contents, NULL);
+
+	/* At least one step either way, or we'd never get out of 0 */
+	high = MAX (level * EVENT_WINDOW, level + 1);
+	low = MAX (MIN (level / EVENT_WINDOW, level - 1), 0);
+
+	g_debug ("Waiting for raw light level to leave %d-%d", low, high);
+
+	/* Move the threshold in the direction of travel first, so that
+	 * the falling one stays below the rising one all along */
+	if (high >= drv_data->event_high)
+		return set_threshold ("rising", high) && set_threshold ("falling", low);
+	return set_threshold ("falling", low) && set_threshold ("rising", high);
+}
+
+static gboolean light_changed (gpointer user_data);
+
+static void
+start_polling (void)
+{
+	drv_data->timeout_id = wakeup_scheduler_add (drv_data->interval,
+						     WAKEUP_DEFAULT_TOLERANCE (drv_data->interval),
+						     (GSourceFunc) light_changed, NULL,
+						     "[iio_poll_light_set_polling] light_changed");
+}
+
+static void stop_events (void);
+
 static gboolean
 light_changed (gpointer user_data)
 {
@@ -55,6 +122,14 @@ light_changed (gpointer user_data)
 	readings.level = level * drv_data->scale;
 	g_debug ("Light read from IIO: %lf, (scale %lf)", level, drv_data->scale);
 
+	/* Re-centre the window on the new level, or we'd never hear from
+	 * the sensor again */
+	if (drv_data->event_fd >= 0 && !set_event_window ()) {
+		g_warning ("Could not set light threshold events window, polling instead");
+		stop_events ();
+		start_polling ();
+	}
+
 	/* Even though the IIO kernel API declares in_intensity* values as unitless,
 	 * we use Microsoft's hid-sensors-usages.docx which mentions that Windows 8
 	 * compatible sensor proxies will be using Lux as the unit, and most sensors
@@ -89,6 +164,22 @@ get_illuminance_channel_path (GUdevDevice *device,
 	return NULL;
 }
 
+static const char *
+get_event_channel (GUdevDevice *device)
+{
+	const char *channels[] = {
+		"in_illuminance",
+		"in_illuminance0"
+	};
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (channels); i++) {
+		if (iio_events_has_threshold (device, channels[i]))
+			return channels[i];
+	}
+	return NULL;
+}
+
 static guint
 get_interval (GUdevDevice *device)
 {
@@ -108,24 +199,85 @@ out:
 	return (time * 1000);
 }
 
+static gboolean
+light_event (gint         fd,
+	     GIOCondition condition,
+	     gpointer     user_data)
+{
+	if (iio_events_drain (fd) < 0) {
+		drv_data->event_id = 0;
+		stop_events ();
+		start_polling ();
+		return G_SOURCE_REMOVE;
+	}
+
+	light_changed (NULL);
+	return drv_data->event_id > 0 ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/* Sleep until the light level leaves a window around the current
+ * level, rather than reading it every interval */
+static gboolean
+start_events (void)
+{
+	/* The window is set up from the current thresholds */
+	if (!iio_events_get_threshold (drv_data->dev, drv_data->event_channel, "falling", &drv_data->event_low) ||
+	    !iio_events_get_threshold (drv_data->dev, drv_data->event_channel, "rising", &drv_data->event_high) ||
+	    !set_event_window ())
+		return FALSE;
+
+	drv_data->event_fd = iio_events_open (drv_data->dev);
+	if (drv_data->event_fd < 0)
+		return FALSE;
+
+	if (!iio_events_enable_threshold (drv_data->dev, drv_data->event_channel, TRUE)) {
+		close (drv_data->event_fd);
+		drv_data->event_fd = -1;
+		return FALSE;
+	}
+
+	drv_data->event_id = g_unix_fd_add (drv_data->event_fd, G_IO_IN, light_event, NULL);
+	g_source_set_name_by_id (drv_data->event_id, "[iio_poll_light_set_polling] light_event");
+
+	/* Send the current level */
+	light_changed (NULL);
+
+	return TRUE;
+}
+
+static void
+stop_events (void)
+{
+	g_clear_handle_id (&drv_data->event_id, g_source_remove);
+	if (drv_data->event_fd < 0)
+		return;
+
+	iio_events_enable_threshold (drv_data->dev, drv_data->event_channel, FALSE);
+	close (drv_data->event_fd);
+	drv_data->event_fd = -1;
+}
+
 static void
 iio_poll_light_set_polling (gboolean state)
 {
-	if (drv_data->timeout_id > 0 && state)
+	if ((drv_data->timeout_id > 0 || drv_data->event_fd >= 0) && state)
 		return;
-	if (drv_data->timeout_id == 0 && !state)
+	if (drv_data->timeout_id == 0 && drv_data->event_fd < 0 && !state)
 		return;
 
-	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
-		drv_data->timeout_id = 0;
-	}
+	g_clear_handle_id (&drv_data->timeout_id, wakeup_scheduler_remove);
+	stop_events ();
 
 	if (state) {
-		drv_data->timeout_id = g_timeout_add (drv_data->interval,
-						      (GSourceFunc) light_changed,
-						      NULL);
-		g_source_set_name_by_id (drv_data->timeout_id, "[iio_poll_light_set_polling] light_changed");
+		if (drv_data->event_channel && start_events ()) {
+			g_debug ("Using threshold events for light sensor %s", drv_data->input_path);
+			return;
+		}
+
+		start_polling ();
+
+		/* And send a reading straight away */
+		light_changed (NULL);
 	}
 }
 
@@ -139,6 +291,9 @@ iio_poll_light_open (GUdevDevice        *device,
 	drv_data = g_new0 (DrvData, 1);
 	drv_data->callback_func = callback_func;
 	drv_data->user_data = user_data;
+	drv_data->dev = g_object_ref (device);
+	drv_data->event_channel = get_event_channel (device);
+	drv_data->event_fd = -1;
 
 	drv_data->interval = get_interval (device);
 	drv_data->input_path = get_illuminance_channel_path (device, "input");
@@ -147,6 +302,13 @@ iio_poll_light_open (GUdevDevice        *device,
 	if (!drv_data->input_path)
 		return FALSE;
 
+	drv_data->raw_path = get_illuminance_channel_path (device, "raw");
+	if (drv_data->event_channel && !drv_data->raw_path) {
+		g_debug ("No raw light level to set threshold events from for %s",
+			 g_udev_device_get_sysfs_path (device));
+		drv_data->event_channel = NULL;
+	}
+
 	if (g_str_has_prefix (drv_data->input_path, "in_illuminance0")) {
 		drv_data->scale = g_udev_device_get_sysfs_attr_as_double (device,
 									  "in_illuminance0_scale");
@@ -164,7 +326,9 @@ static void
 iio_poll_light_close (void)
 {
 	iio_poll_light_set_polling (FALSE);
+	g_clear_object (&drv_data->dev);
 	g_clear_pointer (&drv_data->input_path, g_free);
+	g_clear_pointer (&drv_data->raw_path, g_free);
 	g_clear_pointer (&drv_data, g_free);
 }
 
@@ -8,6 +8,9 @@
 
 #include "drivers.h"
 #include "iio-buffer-utils.h"
+#include "iio-events.h"
+#include "proximity.h"
+#include "wakeup-scheduler.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -16,10 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define PROXIMITY_NEAR_LEVEL "PROXIMITY_NEAR_LEVEL"
-
-#define PROXIMITY_WATER_MARK_LOW  0.9
-#define PROXIMITY_WATER_MARK_HIGH 1.1
+#include <glib-unix.h>
 
 typedef struct DrvData {
 	guint               timeout_id;
@@ -29,6 +29,11 @@ typedef struct DrvData {
 	const char         *name;
 	gint                near_level;
 	gint                last_level;
+
+	/* Threshold events, instead of polling */
+	gboolean            has_events;
+	int                 event_fd;
+	guint               event_id;
 } DrvData;
 
 static DrvData *drv_data = NULL;
@@ -58,14 +63,11 @@ poll_proximity (gpointer user_data)
 	DrvData *data = user_data;
 	ProximityReadings readings;
 	gint prox;
-	gdouble near_level = data->near_level;
 
 	/* g_udev_device_get_sysfs_attr_as_int does not update when there's no event */
 	prox = sysfs_get_int (data->dev, "in_proximity_raw");
-	/* Use a margin so we don't trigger too often */
-	near_level *=  (data->last_level > near_level) ? PROXIMITY_WATER_MARK_LOW : PROXIMITY_WATER_MARK_HIGH;
-	readings.is_near = (prox > near_level) ? PROXIMITY_NEAR_TRUE : PROXIMITY_NEAR_FALSE;
-	g_debug ("Proximity read from IIO on '%s': %d/%f, near: %d", data->name, prox, near_level, readings.is_near);
+	readings.is_near = get_proximity_near (prox, data->last_level, data->near_level);
+	g_debug ("Proximity read from IIO on '%s': %d/%d, near: %d", data->name, prox, data->near_level, readings.is_near);
 	data->last_level = prox;
 
 	drv_data->callback_func (&iio_poll_proximity, (gpointer) &readings, drv_data->user_data);
@@ -73,46 +75,105 @@ poll_proximity (gpointer user_data)
 	return G_SOURCE_CONTINUE;
 }
 
+static void
+start_polling (DrvData *data)
+{
+	data->timeout_id = wakeup_scheduler_add (700, WAKEUP_DEFAULT_TOLERANCE (700),
+						 poll_proximity, data,
+						 "[iio_poll_proximity_set_polling] poll_proximity");
+}
+
+static void stop_events (DrvData *data);
+
 static gboolean
 iio_poll_proximity_discover (GUdevDevice *device)
 {
 	return drv_check_udev_sensor_type (device, "iio-poll-proximity", "IIO poll proximity sensor");
 }
 
-static void
-iio_poll_proximity_set_polling (gboolean state)
+static gboolean
+proximity_event (gint         fd,
+		 GIOCondition condition,
+		 gpointer     user_data)
 {
-	if (drv_data->timeout_id > 0 && state)
-		return;
-	if (drv_data->timeout_id == 0 && !state)
-		return;
+	DrvData *data = user_data;
 
-	g_clear_handle_id (&drv_data->timeout_id, g_source_remove);
-	if (state) {
-		drv_data->timeout_id = g_timeout_add (700, poll_proximity, drv_data);
-		g_source_set_name_by_id (drv_data->timeout_id, "[iio_poll_proximity_set_polling] poll_proximity");
+	/* Fall back to polling, rather than never hearing from the sensor again */
+	if (iio_events_drain (fd) < 0) {
+		data->event_id = 0;
+		stop_events (data);
+		start_polling (data);
+		return G_SOURCE_REMOVE;
 	}
+
+	/* The event only tells us a threshold was crossed, read the new value */
+	poll_proximity (data);
+
+	return G_SOURCE_CONTINUE;
 }
 
-static gint
-get_near_level (GUdevDevice *device)
+/* The same hysteresis as poll_proximity(), but applied by the kernel,
+ * so that we only wake up when the near state might have changed */
+static gboolean
+start_events (DrvData *data)
 {
-	gint near_level;
-
-	near_level = g_udev_device_get_property_as_int (device, PROXIMITY_NEAR_LEVEL);
-	if (!near_level)
-		near_level = g_udev_device_get_sysfs_attr_as_int (device, "in_proximity_nearlevel");
+	data->event_fd = iio_events_open (data->dev);
+	if (data->event_fd < 0)
+		return FALSE;
 
-	if (!near_level) {
-		g_warning ("Found proximity sensor but no " PROXIMITY_NEAR_LEVEL " udev property");
-		g_warning ("See https://gitlab.freedesktop.org/hadess/iio-sensor-proxy/blob/master/README.md");
-		return 0;
+	if (!iio_events_set_threshold (data->dev, "in_proximity", "rising",
+				       data->near_level * PROXIMITY_WATER_MARK_HIGH) ||
+	    !iio_events_set_threshold (data->dev, "in_proximity", "falling",
+				       data->near_level * PROXIMITY_WATER_MARK_LOW) ||
+	    !iio_events_enable_threshold (data->dev, "in_proximity", TRUE)) {
+		close (data->event_fd);
+		data->event_fd = -1;
+		return FALSE;
 	}
 
-	g_debug ("Near level: %d", near_level);
-	return near_level;
+	data->event_id = g_unix_fd_add (data->event_fd, G_IO_IN, proximity_event, data);
+	g_source_set_name_by_id (data->event_id, "[iio_poll_proximity_set_polling] proximity_event");
+
+	/* Events only come when crossing a threshold, so send the current state */
+	poll_proximity (data);
+
+	return TRUE;
+}
+
+static void
+stop_events (DrvData *data)
+{
+	g_clear_handle_id (&data->event_id, g_source_remove);
+	if (data->event_fd < 0)
+		return;
+
+	iio_events_enable_threshold (data->dev, "in_proximity", FALSE);
+	close (data->event_fd);
+	data->event_fd = -1;
 }
 
+static void
+iio_poll_proximity_set_polling (gboolean state)
+{
+	if ((drv_data->timeout_id > 0 || drv_data->event_fd >= 0) && state)
+		return;
+	if (drv_data->timeout_id == 0 && drv_data->event_fd < 0 && !state)
+		return;
+
+	g_clear_handle_id (&drv_data->timeout_id, wakeup_scheduler_remove);
+	stop_events (drv_data);
+	if (state) {
+		if (drv_data->has_events && start_events (drv_data)) {
+			g_debug ("Using threshold events for proximity sensor '%s'", drv_data->name);
+			return;
+		}
+
+		start_polling (drv_data);
+
+		/* And send a reading straight away */
+		poll_proximity (drv_data);
+	}
+}
 
 static gboolean
 iio_poll_proximity_open (GUdevDevice        *device,
@@ -126,7 +187,9 @@ iio_poll_proximity_open (GUdevDevice        *device,
 	drv_data->name = g_udev_device_get_sysfs_attr (device, "name");
 	drv_data->callback_func = callback_func;
 	drv_data->user_data = user_data;
-	drv_data->near_level = get_near_level (device);
+	drv_data->near_level = get_proximity_near_level (device);
+	drv_data->has_events = iio_events_has_threshold (device, "in_proximity");
+	drv_data->event_fd = -1;
 
 	if (!drv_data->near_level) {
 		g_free (drv_data);
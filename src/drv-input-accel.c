@@ -8,6 +8,9 @@
 
 #include "drivers.h"
 #include "accel-mount-matrix.h"
+#include "device-index.h"
+#include "wakeup-scheduler.h"
+#include "time-source.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -16,77 +19,35 @@
 #include <stdio.h>
 
 #include <linux/input.h>
+#include <sys/ioctl.h>
+
+#include <glib-unix.h>
 
 typedef struct DrvData {
 	guint              timeout_id;
+	guint              watch_id;
 	ReadingsUpdateFunc callback_func;
 	gpointer           user_data;
 
-	GUdevClient *client;
-	GUdevDevice *dev, *parent;
+	GUdevDevice *dev;
 	const char *dev_path;
 	const char *name;
-	AccelVec3 *mount_matrix;
+	int fd;
+	int raw[3];
+	gboolean dropped;
+	gboolean sends_events;
+	AccelTransform transform;
 	AccelLocation location;
-	gboolean sends_kevent;
 } DrvData;
 
 static DrvData *drv_data = NULL;
 
-static void input_accel_set_polling (gboolean state);
-
-/* From src/linux/up-device-supply.c in UPower */
-static GUdevDevice *
-get_sibling_with_subsystem (GUdevDevice *device,
-			    const char *subsystem)
-{
-	GUdevDevice *parent;
-	GUdevClient *client;
-	GUdevDevice *sibling;
-	const char * class[] = { NULL, NULL };
-	const char *parent_path;
-	GList *devices, *l;
-
-	g_return_val_if_fail (device != NULL, NULL);
-	g_return_val_if_fail (subsystem != NULL, NULL);
-
-	parent = g_udev_device_get_parent (device);
-	if (!parent)
-		return NULL;
-	parent_path = g_udev_device_get_sysfs_path (parent);
-
-	sibling = NULL;
-	class[0] = subsystem;
-	client = g_udev_client_new (class);
-	devices = g_udev_client_query_by_subsystem (client, subsystem);
-	for (l = devices; l != NULL && sibling == NULL; l = l->next) {
-		GUdevDevice *d = l->data;
-		GUdevDevice *p;
-		const char *p_path;
-
-		p = g_udev_device_get_parent (d);
-		if (!p)
-			continue;
-		p_path = g_udev_device_get_sysfs_path (p);
-		if (g_strcmp0 (p_path, parent_path) == 0)
-			sibling = g_object_ref (d);
-
-		g_object_unref (p);
-	}
-
-	g_list_free_full (devices, (GDestroyNotify) g_object_unref);
-	g_object_unref (client);
-	g_object_unref (parent);
-
-	return sibling;
-}
-
 static gboolean
 is_part_of_joypad (GUdevDevice *device)
 {
-	g_autoptr(GUdevDevice) sibling;
+	g_autoptr(GUdevDevice) sibling = NULL;
 
-	sibling = get_sibling_with_subsystem (device, "input");
+	sibling = device_index_get_sibling (device_index_get_default (), device, "input");
 	if (!sibling)
 		return FALSE;
 	return g_udev_device_get_property_as_boolean (sibling, "ID_INPUT_JOYSTICK");
@@ -115,77 +76,175 @@ input_accel_discover (GUdevDevice *device)
 	return TRUE;
 }
 
-#define READ_AXIS(axis, var) { memzero(&abs_info, sizeof(abs_info)); r = ioctl(fd, EVIOCGABS(axis), &abs_info); if (r < 0) return; var = abs_info.value; }
+#define READ_AXIS(axis, var) { memzero(&abs_info, sizeof(abs_info)); r = ioctl(drv_data->fd, EVIOCGABS(axis), &abs_info); if (r < 0) return FALSE; var = abs_info.value; }
 #define memzero(x,l) (memset((x), 0, (l)))
 
-static void
-accelerometer_changed (void)
+/* Read the current state of all the axes, for the first reading,
+ * and to resynchronise after the kernel dropped events */
+static gboolean
+read_axes (void)
 {
 	struct input_absinfo abs_info;
-	int accel_x = 0, accel_y = 0, accel_z = 0;
-	int fd, r;
+	int r;
+
+	READ_AXIS(ABS_X, drv_data->raw[0]);
+	READ_AXIS(ABS_Y, drv_data->raw[1]);
+	READ_AXIS(ABS_Z, drv_data->raw[2]);
+
+	return TRUE;
+}
+
+static void
+send_readings (void)
+{
+	double accel[3];
 	AccelReadings readings;
-	AccelVec3 tmp;
 
-	fd = open (drv_data->dev_path, O_RDONLY|O_CLOEXEC);
-	if (fd < 0) {
-		g_warning ("Could not open input accel '%s': %s",
+	apply_accel_transform (&drv_data->transform, drv_data->raw, accel);
+
+	g_debug ("Accel read from input on '%s': %d, %d, %d (%lf, %lf, %lf m/s²)", drv_data->name,
+		 drv_data->raw[0], drv_data->raw[1], drv_data->raw[2],
+		 accel[0], accel[1], accel[2]);
+
+	readings.accel_x = accel[0];
+	readings.accel_y = accel[1];
+	readings.accel_z = accel[2];
+
+	drv_data->callback_func (&input_accel, (gpointer) &readings, drv_data->user_data);
+}
+
+static void
+accelerometer_changed (void)
+{
+	if (!read_axes ()) {
+		g_warning ("Could not read axes from input accel '%s': %s",
 			   drv_data->dev_path, g_strerror (errno));
 		return;
 	}
 
-	READ_AXIS(ABS_X, accel_x);
-	READ_AXIS(ABS_Y, accel_y);
-	READ_AXIS(ABS_Z, accel_z);
+	send_readings ();
+}
 
-	close (fd);
+static void
+handle_event (const struct input_event *ev)
+{
+	if (ev->type == EV_SYN) {
+		switch (ev->code) {
+		case SYN_DROPPED:
+			drv_data->dropped = TRUE;
+			break;
+		case SYN_REPORT:
+			if (drv_data->dropped) {
+				drv_data->dropped = FALSE;
+				g_debug ("Events dropped on %s, resynchronising", drv_data->dev_path);
+				accelerometer_changed ();
+			} else {
+				send_readings ();
+			}
+			break;
+		default:
+			break;
+		}
+		return;
+	}
 
-	/* Scale from 1G ~= 256 to a value in m/s² */
-	set_accel_scale (&readings.scale, 1.0 / 256 * 9.81);
+	/* Events up to the next SYN_REPORT are incomplete after a drop */
+	if (ev->type != EV_ABS || drv_data->dropped)
+		return;
 
-	g_debug ("Accel read from input on '%s': %d, %d, %d (scale %lf,%lf,%lf)", drv_data->name,
-		 accel_x, accel_y, accel_z,
-		 readings.scale.x, readings.scale.y, readings.scale.z);
+	switch (ev->code) {
+	case ABS_X:
+		drv_data->raw[0] = ev->value;
+		break;
+	case ABS_Y:
+		drv_data->raw[1] = ev->value;
+		break;
+	case ABS_Z:
+		drv_data->raw[2] = ev->value;
+		break;
+	default:
+		break;
+	}
+}
 
-	tmp.x = accel_x;
-	tmp.y = accel_y;
-	tmp.z = accel_z;
+/* Returns FALSE if the device went away */
+static gboolean
+read_events (void)
+{
+	struct input_event ev[64];
+	ssize_t len;
+	guint i;
 
-	if (!apply_mount_matrix (drv_data->mount_matrix, &tmp))
-		g_warning ("Could not apply mount matrix");
+	while ((len = read (drv_data->fd, ev, sizeof (ev))) > 0) {
+		for (i = 0; i < len / sizeof (struct input_event); i++)
+			handle_event (&ev[i]);
+	}
 
-	readings.accel_x = tmp.x;
-	readings.accel_y = tmp.y;
-	readings.accel_z = tmp.z;
+	if (len < 0 && errno != EAGAIN && errno != EINTR) {
+		g_warning ("Could not read events from input accel '%s': %s",
+			   drv_data->dev_path, g_strerror (errno));
+		return FALSE;
+	}
 
-	drv_data->callback_func (&input_accel, (gpointer) &readings, drv_data->user_data);
+	return TRUE;
 }
 
-static void
-uevent_received (GUdevClient *client,
-		 gchar       *action,
-		 GUdevDevice *device,
+static void close_device (void);
+
+static gboolean
+events_received (gint         fd,
+		 GIOCondition condition,
 		 gpointer     user_data)
 {
-	if (g_strcmp0 (action, "change") != 0)
-		return;
+	if (!drv_data->sends_events) {
+		drv_data->sends_events = TRUE;
+		g_debug ("Received input events, let's stop polling for accelerometer data on %s", drv_data->dev_path);
+		g_clear_handle_id (&drv_data->timeout_id, wakeup_scheduler_remove);
+	}
 
-	if (g_strcmp0 (g_udev_device_get_sysfs_path (device), g_udev_device_get_sysfs_path (drv_data->parent)) != 0)
-		return;
+	/* Stop as if released, so that the next claim opens the device again */
+	if (!read_events ()) {
+		drv_data->watch_id = 0;
+		g_clear_handle_id (&drv_data->timeout_id, wakeup_scheduler_remove);
+		close_device ();
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
 
-	if (!drv_data->sends_kevent) {
-		drv_data->sends_kevent = TRUE;
-		g_debug ("Received kevent, let's stop polling for accelerometer data on %s", drv_data->dev_path);
-		input_accel_set_polling (FALSE);
+/* The evdev node is only kept open while the sensor is used, as
+ * input-polldev devices are polled by the kernel while it's open */
+static gboolean
+open_device (void)
+{
+	drv_data->fd = open (drv_data->dev_path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	if (drv_data->fd < 0) {
+		g_warning ("Could not open input accel '%s': %s",
+			   drv_data->dev_path, g_strerror (errno));
+		return FALSE;
 	}
+	return TRUE;
+}
 
-	accelerometer_changed ();
+static void
+close_device (void)
+{
+	if (drv_data->fd < 0)
+		return;
+	close (drv_data->fd);
+	drv_data->fd = -1;
 }
 
 static gboolean
 first_values (gpointer user_data)
 {
-	accelerometer_changed ();
+	if (drv_data->fd >= 0) {
+		accelerometer_changed ();
+	} else if (open_device ()) {
+		accelerometer_changed ();
+		close_device ();
+	}
 	return G_SOURCE_REMOVE;
 }
 
@@ -194,25 +253,27 @@ input_accel_open (GUdevDevice        *device,
 		  ReadingsUpdateFunc  callback_func,
 		  gpointer            user_data)
 {
-	const gchar * const subsystems[] = { "input", NULL };
+	AccelVec3 *mount_matrix;
+	AccelScale scale;
 
 	drv_data = g_new0 (DrvData, 1);
+	drv_data->fd = -1;
 	drv_data->dev = g_object_ref (device);
-	drv_data->parent = g_udev_device_get_parent (drv_data->dev);
 	drv_data->dev_path = g_udev_device_get_device_file (device);
 	drv_data->name = g_udev_device_get_property (device, "NAME");
 	if (!drv_data->name)
 		drv_data->name = g_udev_device_get_property (device, "ID_MODEL");
-	drv_data->client = g_udev_client_new (subsystems);
-	drv_data->mount_matrix = setup_mount_matrix (device);
 	drv_data->location = setup_accel_location (device);
 	drv_data->callback_func = callback_func;
 	drv_data->user_data = user_data;
 
-	g_signal_connect (drv_data->client, "uevent",
-			  G_CALLBACK (uevent_received), NULL);
+	/* Scale from 1G ~= 256 to a value in m/s² */
+	mount_matrix = setup_mount_matrix (device);
+	set_accel_scale (&scale, 1.0 / 256 * 9.81);
+	setup_accel_transform (&drv_data->transform, mount_matrix, scale);
+	g_free (mount_matrix);
 
-	g_idle_add (first_values, NULL);
+	time_source_idle_add (first_values, NULL);
 
 	return TRUE;
 }
@@ -227,30 +288,50 @@ read_accel_poll (gpointer user_data)
 static void
 input_accel_set_polling (gboolean state)
 {
-	if (drv_data->timeout_id > 0 && state)
+	if (drv_data->fd >= 0 && state)
+		return;
+	if (drv_data->fd < 0 && !state)
+		return;
+
+	g_clear_handle_id (&drv_data->timeout_id, wakeup_scheduler_remove);
+	g_clear_handle_id (&drv_data->watch_id, g_source_remove);
+	close_device ();
+
+	if (!state)
 		return;
-	if (drv_data->timeout_id == 0 && !state)
+
+	if (!open_device ())
 		return;
 
-	if (drv_data->timeout_id) {
-		g_source_remove (drv_data->timeout_id);
-		drv_data->timeout_id = 0;
+	/* The stream only carries changed axes, so start from the current state */
+	drv_data->dropped = FALSE;
+	if (!read_axes ()) {
+		g_warning ("Could not read axes from input accel '%s': %s",
+			   drv_data->dev_path, g_strerror (errno));
+		close_device ();
+		return;
 	}
 
-	if (state && !drv_data->sends_kevent) {
-		drv_data->timeout_id = g_timeout_add (700, read_accel_poll, drv_data);
-		g_source_set_name_by_id (drv_data->timeout_id, "[input_accel_set_polling] read_accel_poll");
+	drv_data->watch_id = g_unix_fd_add (drv_data->fd, G_IO_IN, events_received, NULL);
+	g_source_set_name_by_id (drv_data->watch_id, "[input_accel_set_polling] events_received");
+
+	/* Some drivers only update the axes without sending events */
+	if (!drv_data->sends_events) {
+		drv_data->timeout_id = wakeup_scheduler_add (700, WAKEUP_DEFAULT_TOLERANCE (700),
+							     read_accel_poll, drv_data,
+							     "[input_accel_set_polling] read_accel_poll");
 	}
+
+	/* And send a reading straight away */
+	send_readings ();
 }
 
 static void
 input_accel_close (void)
 {
 	input_accel_set_polling (FALSE);
-	g_clear_object (&drv_data->client);
+	close_device ();
 	g_clear_object (&drv_data->dev);
-	g_clear_object (&drv_data->parent);
-	g_clear_pointer (&drv_data->mount_matrix, g_free);
 
 	g_clear_pointer (&drv_data, g_free);
 }
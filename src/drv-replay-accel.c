@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+/*
+ * Replays an accelerometer trace recorded with --record-traces, through
+ * the same transform as the IIO drivers, and the daemon's orientation and
+ * D-Bus code, either at the pace it was recorded at, or as fast as possible.
+ */
+
+#include "drivers.h"
+#include "accel-mount-matrix.h"
+#include "sensor-trace.h"
+#include "time-source.h"
+
+/* How many samples to send per main loop iteration, when replaying fast */
+#define FAST_BATCH_SIZE 64
+
+typedef struct DrvData {
+	ReadingsUpdateFunc  callback_func;
+	gpointer            user_data;
+
+	SensorTraceReader  *reader;
+	AccelTransform      transform;
+	guint               timeout_id;
+
+	/* The next sample to send */
+	gboolean            has_sample;
+	gint64              timestamp;
+	int                 raw[3];
+
+	gint64              first_timestamp;
+	gint64              start_time;
+	guint64             n_samples;
+} DrvData;
+
+static DrvData *drv_data = NULL;
+
+static gboolean
+replay_accel_discover (GUdevDevice *device)
+{
+	if (sensor_trace_get_replay_path () == NULL)
+		return FALSE;
+
+	/* Like the fake sensors, use the power button as the udev device */
+	if (g_strcmp0 (g_udev_device_get_subsystem (device), "input") != 0 ||
+	    g_strcmp0 (g_udev_device_get_property (device, "NAME"), "\"Power Button\"") != 0)
+		return FALSE;
+
+	g_debug ("Found replayed accelerometer at %s", g_udev_device_get_sysfs_path (device));
+	return TRUE;
+}
+
+static void
+send_sample (DrvData *data)
+{
+	double accel[3];
+	AccelReadings readings;
+
+	apply_accel_transform (&data->transform, data->raw, accel);
+
+	readings.accel_x = accel[0];
+	readings.accel_y = accel[1];
+	readings.accel_z = accel[2];
+	data->callback_func (&replay_accel, (gpointer) &readings, data->user_data);
+
+	data->n_samples++;
+	data->has_sample = sensor_trace_reader_next (data->reader, &data->timestamp, data->raw);
+}
+
+static void
+replay_finished (DrvData *data)
+{
+	gint64 elapsed;
+
+	elapsed = MAX (time_source_get_time () - data->start_time, 1);
+	g_debug ("Replayed %" G_GUINT64_FORMAT " samples in %.3f s (%.0f samples/s)",
+		 data->n_samples, (double) elapsed / G_USEC_PER_SEC,
+		 (double) data->n_samples * G_USEC_PER_SEC / elapsed);
+	data->timeout_id = 0;
+}
+
+static gboolean
+replay_fast (gpointer user_data)
+{
+	DrvData *data = user_data;
+	guint i;
+
+	for (i = 0; i < FAST_BATCH_SIZE && data->has_sample; i++)
+		send_sample (data);
+
+	if (data->has_sample)
+		return G_SOURCE_CONTINUE;
+
+	replay_finished (data);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean replay_timed (gpointer user_data);
+
+/* Samples are sent at the same offset from the start of the
+ * replay as they were from the start of the recording */
+static void
+schedule_next_sample (DrvData *data)
+{
+	gint64 delay;
+
+	delay = (data->timestamp - data->first_timestamp) - (time_source_get_time () - data->start_time);
+	data->timeout_id = time_source_timeout_add (MAX (delay, 0) / 1000, replay_timed, data);
+	time_source_set_name (data->timeout_id, "[replay_accel_set_polling] replay_timed");
+}
+
+static gboolean
+replay_timed (gpointer user_data)
+{
+	DrvData *data = user_data;
+	gint64 now;
+
+	/* Catch up with everything that's due */
+	now = time_source_get_time () - data->start_time;
+	do {
+		send_sample (data);
+	} while (data->has_sample &&
+		 data->timestamp - data->first_timestamp <= now);
+
+	if (data->has_sample)
+		schedule_next_sample (data);
+	else
+		replay_finished (data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+replay_accel_open (GUdevDevice        *device,
+		   ReadingsUpdateFunc  callback_func,
+		   gpointer            user_data)
+{
+	g_autoptr(GError) error = NULL;
+	const SensorTraceHeader *header;
+	SensorTraceReader *reader;
+	AccelScale scale;
+
+	reader = sensor_trace_reader_new (sensor_trace_get_replay_path (), &error);
+	if (!reader) {
+		g_warning ("Could not open trace: %s", error->message);
+		return FALSE;
+	}
+
+	header = sensor_trace_reader_get_header (reader);
+	if ((header->type != DRIVER_TYPE_ACCEL && header->type != DRIVER_TYPE_ACCEL_BASE) ||
+	    header->n_channels != 3) {
+		g_warning ("Trace %s is not of an accelerometer", sensor_trace_get_replay_path ());
+		sensor_trace_reader_free (reader);
+		return FALSE;
+	}
+
+	drv_data = g_new0 (DrvData, 1);
+	drv_data->callback_func = callback_func;
+	drv_data->user_data = user_data;
+	drv_data->reader = reader;
+
+	scale.x = header->scales[0];
+	scale.y = header->scales[1];
+	scale.z = header->scales[2];
+	setup_accel_transform (&drv_data->transform, header->mount_matrix, scale);
+
+	g_debug ("Replaying %s, recorded at %.1f Hz, %s", sensor_trace_get_replay_path (),
+		 header->sampling_frequency,
+		 sensor_trace_get_replay_fast () ? "as fast as possible" : "in real time");
+
+	return TRUE;
+}
+
+static void
+replay_accel_set_polling (gboolean state)
+{
+	if (drv_data->timeout_id > 0 && state)
+		return;
+	if (drv_data->timeout_id == 0 && !state)
+		return;
+
+	g_clear_handle_id (&drv_data->timeout_id, time_source_remove);
+
+	if (!state)
+		return;
+
+	/* Each claim replays the trace from the start */
+	sensor_trace_reader_rewind (drv_data->reader);
+	drv_data->n_samples = 0;
+	drv_data->has_sample = sensor_trace_reader_next (drv_data->reader, &drv_data->timestamp, drv_data->raw);
+	if (!drv_data->has_sample) {
+		g_warning ("Trace %s has no samples", sensor_trace_get_replay_path ());
+		return;
+	}
+	drv_data->first_timestamp = drv_data->timestamp;
+	drv_data->start_time = time_source_get_time ();
+
+	if (sensor_trace_get_replay_fast ()) {
+		drv_data->timeout_id = time_source_idle_add (replay_fast, drv_data);
+		time_source_set_name (drv_data->timeout_id, "[replay_accel_set_polling] replay_fast");
+	} else {
+		schedule_next_sample (drv_data);
+	}
+}
+
+static void
+replay_accel_close (void)
+{
+	replay_accel_set_polling (FALSE);
+	sensor_trace_reader_free (drv_data->reader);
+	g_clear_pointer (&drv_data, g_free);
+}
+
+SensorDriver replay_accel = {
+	.name = "Replayed accelerometer",
+	.type = DRIVER_TYPE_ACCEL,
+	.specific_type = DRIVER_TYPE_ACCEL_REPLAY,
+
+	.discover = replay_accel_discover,
+	.open = replay_accel_open,
+	.set_polling = replay_accel_set_polling,
+	.close = replay_accel_close,
+};
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <math.h>
+
+#include "hinge-angle.h"
+
+/* The hinge is along the x axis, so when the readings are mostly along
+ * it, the device is standing on its side, and the angle can't be told */
+#define MIN_HINGE_TILT_RATIO 0.35
+/* Closed and folded all the way back look the same */
+#define FOLDED_MARGIN        20.0 /* degrees */
+/* Hysteresis for tablet mode, so that a laptop opened
+ * flat doesn't keep going in and out of it */
+#define TABLET_MODE_ENTER    200.0 /* degrees */
+#define TABLET_MODE_LEAVE    160.0 /* degrees */
+
+/* The angle of the reading around the hinge, or FALSE
+ * if it's too close to the hinge to tell */
+static gboolean
+angle_around_hinge (const double  v[3],
+		    double       *angle)
+{
+	double norm, tilt;
+
+	norm = sqrt (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	tilt = sqrt (v[1] * v[1] + v[2] * v[2]);
+	if (norm == 0.0 || tilt / norm < MIN_HINGE_TILT_RATIO)
+		return FALSE;
+
+	*angle = atan2 (v[1], v[2]) * 180.0 / G_PI;
+	return TRUE;
+}
+
+/**
+ * hinge_angle_calc:
+ * @display: the display accelerometer's reading, pointing down, with the
+ *   mount matrix applied, as sent by the accelerometer drivers
+ * @base: the base accelerometer's reading, in the base's frame, which is the
+ *   same as the display's when the device is opened flat
+ * @previous: the previous angle, or %HINGE_ANGLE_UNKNOWN
+ * @angle: (out): the angle between the display and the base, in degrees,
+ *   0 when closed, 90 with the display upright on a flat base, 180 when
+ *   opened flat and up to 360 when folded back as a tablet
+ *
+ * The angle is the difference between the rotations of the display and
+ * of the base around the hinge. Closed and folded back can't be told apart
+ * from the readings, so the side @previous was on is kept.
+ *
+ * Returns: %FALSE if the angle can't be computed from the readings
+ **/
+gboolean
+hinge_angle_calc (const double  display[3],
+		  const double  base[3],
+		  double        previous,
+		  double       *angle)
+{
+	double display_angle, base_angle, ret;
+
+	if (!angle_around_hinge (display, &display_angle) ||
+	    !angle_around_hinge (base, &base_angle))
+		return FALSE;
+
+	ret = fmod (180.0 - (display_angle - base_angle) + 720.0, 360.0);
+
+	if (ret < FOLDED_MARGIN || ret > 360.0 - FOLDED_MARGIN) {
+		double other;
+
+		if (previous == HINGE_ANGLE_UNKNOWN)
+			return FALSE;
+		other = ret < 180.0 ? ret + 360.0 : ret - 360.0;
+		if (fabs (other - previous) < fabs (ret - previous))
+			ret = other;
+		ret = CLAMP (ret, 0.0, 360.0);
+	}
+
+	*angle = ret;
+	return TRUE;
+}
+
+/**
+ * hinge_tablet_mode:
+ * @previous: whether the device was in tablet mode
+ * @angle: the hinge angle, from hinge_angle_calc()
+ *
+ * Returns: whether the device is in tablet mode, that is, whether
+ *   the display is folded back past the base
+ **/
+gboolean
+hinge_tablet_mode (gboolean previous,
+		   double   angle)
+{
+	if (previous)
+		return angle > TABLET_MODE_LEAVE;
+	return angle > TABLET_MODE_ENTER;
+}
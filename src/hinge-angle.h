@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* Unknown angle, as exported on D-Bus */
+#define HINGE_ANGLE_UNKNOWN -1.0
+
+gboolean hinge_angle_calc  (const double  display[3],
+			    const double  base[3],
+			    double        previous,
+			    double       *angle);
+gboolean hinge_tablet_mode (gboolean      previous,
+			    double        angle);
@@ -11,14 +11,29 @@
  */
 
 #include "iio-buffer-utils.h"
+#include "device-index.h"
+#include "sysfs-utils.h"
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <glib/gstdio.h>
+#include <sys/utsname.h>
 
 #define IIO_MIN_SAMPLING_FREQUENCY	10 /* Hz */
 
+#define IIO_DEVICES_DIR			"/sys/bus/iio/devices"
+#define HRTIMER_TRIGGERS_DIR		"/sys/kernel/config/iio/triggers/hrtimer"
+
+#define CACHE_DIR			"/var/cache/iio-sensor-proxy"
+#define CACHE_MAGIC			"IIOSPCH2"
+#define CACHE_ALIGN(x)			(((x) + 7) & ~(gsize) 7)
+
 /**
  * iio_channel_info - information about a given channel
  * @name: channel name
@@ -71,13 +86,26 @@ iioutils_break_up_name (const char *name)
 	return ret;
 }
 
+static char *
+get_generic_name (const char *name)
+{
+	char *generic_name;
+
+	generic_name = iioutils_break_up_name (name);
+	if (g_strcmp0 (generic_name, "in_rot_from_north_magnetic_tilt") == 0) {
+		g_free (generic_name);
+		generic_name = g_strdup ("in_rot");
+	}
+	return generic_name;
+}
+
 /**
  * iioutils_get_type() - find and process _type attribute data
  * @is_signed: output whether channel is signed
  * @bytes: output how many bytes the channel storage occupies
  * @mask: output a bit mask for the raw data
  * @be: big endian
- * @device_dir: the iio device directory
+ * @scan_el_fd: the iio device's scan_elements directory
  * @name: the channel name
  *
  * See `struct iio_chan_spec` in the kernel headers.
@@ -89,36 +117,25 @@ iioutils_get_type (unsigned   *is_signed,
 		   unsigned   *shift,
 		   guint64    *mask,
 		   unsigned   *be,
-		   const char *device_dir,
+		   int         scan_el_fd,
 		   const char *name,
 		   const char *generic_name)
 {
 	int ret;
-	char *builtname;
-	char *filename;
+	char filename[NAME_MAX];
+	char type[64];
 	char signchar, endianchar;
 	unsigned padint;
-	FILE *sysfsfp;
 
-	builtname = g_strdup_printf ("%s_type", name);
-	filename = g_build_filename (device_dir, "scan_elements", builtname, NULL);
-	g_free (builtname);
-
-	sysfsfp = fopen (filename, "r");
-	if (sysfsfp == NULL) {
-		builtname = g_strdup_printf ("%s_type", generic_name);
-		filename = g_build_filename (device_dir, "scan_elements", builtname, NULL);
-		g_free (builtname);
-
-		sysfsfp = fopen (filename, "r");
-		if (sysfsfp == NULL) {
-			g_free (filename);
+	g_snprintf (filename, sizeof (filename), "%s_type", name);
+	if (sysfs_read (scan_el_fd, filename, type, sizeof (type)) < 0) {
+		g_snprintf (filename, sizeof (filename), "%s_type", generic_name);
+		if (sysfs_read (scan_el_fd, filename, type, sizeof (type)) < 0)
 			return FALSE;
-		}
 	}
 
 	/* See `iio_show_fixed_type()` in the IIO core for the format */
-	ret = fscanf (sysfsfp,
+	ret = sscanf (type,
 		      "%ce:%c%u/%u>>%u",
 		      &endianchar,
 		      &signchar,
@@ -127,11 +144,8 @@ iioutils_get_type (unsigned   *is_signed,
 
 	if (ret < 0 || ret != 5) {
 		g_warning ("Failed to pass scan type description for %s", filename);
-		fclose (sysfsfp);
-		g_free (filename);
 		return FALSE;
 	}
-	fclose (sysfsfp);
 
 	*be = (endianchar == 'b');
 	*bytes = padint / 8;
@@ -144,63 +158,35 @@ iioutils_get_type (unsigned   *is_signed,
 	g_debug ("Got type for %s: is signed: %d, bytes: %d, bits_used: %d, shift: %d, mask: 0x%" G_GUINT64_FORMAT ", be: %d",
 		 name, *is_signed, *bytes, *bits_used, *shift, *mask, *be);
 
-	g_free (filename);
-
 	return TRUE;
 }
 
 static int
 iioutils_get_param_float (float      *output,
 			  const char *param_name,
-			  const char *device_dir,
+			  int         dir_fd,
 			  const char *name,
 			  const char *generic_name)
 {
-	FILE *sysfsfp;
-	char *builtname, *filename;
-	int ret = 0;
-
-	g_debug ("Trying to read '%s_%s' (name) from dir '%s'", name, param_name, device_dir);
-
-	builtname = g_strdup_printf ("%s_%s", name, param_name);
-	filename = g_build_filename (device_dir, builtname, NULL);
-	g_free (builtname);
+	char filename[NAME_MAX];
+	int ret;
 
-	sysfsfp = fopen (filename, "r");
-	if (sysfsfp) {
-		ret = fscanf (sysfsfp, "%f", output);
-		fclose (sysfsfp);
-		g_free (filename);
-		if (ret == 1)
-			return 0;
-	}
+	g_debug ("Trying to read '%s_%s' (name)", name, param_name);
 
-	ret = -errno;
+	g_snprintf (filename, sizeof (filename), "%s_%s", name, param_name);
+	ret = sysfs_read_float (dir_fd, filename, output);
+	if (ret == 0)
+		return 0;
 	g_debug ("Failed to read float from %s: %s", filename, g_strerror (-ret));
-	g_free (filename);
-
-	g_debug ("Trying to read '%s_%s' (generic name) from dir '%s'", generic_name, param_name, device_dir);
 
-	builtname = g_strdup_printf ("%s_%s", generic_name, param_name);
-	filename = g_build_filename (device_dir, builtname, NULL);
-	g_free (builtname);
-
-	sysfsfp = fopen (filename, "r");
-	if (sysfsfp) {
-		if (fscanf (sysfsfp, "%f", output) != 1) {
-			g_debug ("Failed to read float from %s", filename);
-			ret = -EINVAL;
-		}
-		fclose (sysfsfp);
-	} else {
-		ret = -errno;
-		if (ret != -ENOENT)
-			g_warning ("Failed to read float from %s: %s", filename, g_strerror (-ret));
-		else
-			g_debug ("Failed to read float from %s: %s", filename, g_strerror (-ret));
-	}
+	g_debug ("Trying to read '%s_%s' (generic name)", generic_name, param_name);
 
-	g_free (filename);
+	g_snprintf (filename, sizeof (filename), "%s_%s", generic_name, param_name);
+	ret = sysfs_read_float (dir_fd, filename, output);
+	if (ret == -ENOENT)
+		g_debug ("Failed to read float from %s: %s", filename, g_strerror (-ret));
+	else if (ret < 0)
+		g_warning ("Failed to read float from %s: %s", filename, g_strerror (-ret));
 
 	return ret;
 }
@@ -213,6 +199,36 @@ channel_info_free (iio_channel_info *ci)
 	g_free (ci);
 }
 
+/* Scale and offset can change at runtime, with the range of the device,
+ * so they're always read from sysfs, even with a cached layout */
+static gboolean
+read_channel_params (BufferDrvData    *data,
+		     iio_channel_info *ci)
+{
+	int ret;
+
+	ci->scale = 1.0;
+	ci->offset = 0;
+
+	ret = iioutils_get_param_float (&ci->scale,
+					"scale",
+					data->dir_fd,
+					ci->name,
+					ci->generic_name);
+	if ((ret < 0) && (ret != -ENOENT))
+		return FALSE;
+
+	ret = iioutils_get_param_float (&ci->offset,
+					"offset",
+					data->dir_fd,
+					ci->name,
+					ci->generic_name);
+	if ((ret < 0) && (ret != -ENOENT))
+		return FALSE;
+
+	return TRUE;
+}
+
 static int
 compare_channel_index (gconstpointer a, gconstpointer b)
 {
@@ -224,11 +240,10 @@ compare_channel_index (gconstpointer a, gconstpointer b)
 
 /* build_channel_array() - function to figure out what channels are present */
 static iio_channel_info **
-build_channel_array (const char        *device_dir,
+build_channel_array (BufferDrvData     *data,
 		     int               *counter)
 {
 	GDir *dp;
-	FILE *sysfsfp;
 	int ret;
 	const char *name;
 	char *scan_el_dir;
@@ -237,78 +252,43 @@ build_channel_array (const char        *device_dir,
 	int i;
 
 	*counter = 0;
-	scan_el_dir = g_build_filename (device_dir, "scan_elements", NULL);
+	scan_el_dir = g_build_filename (data->dev_dir_name, "scan_elements", NULL);
 
 	dp = g_dir_open (scan_el_dir, 0, NULL);
 	if (dp == NULL) {
-		ret = -errno;
 		g_debug ("Could not open scan_elements dir '%s'", scan_el_dir);
 		g_free (scan_el_dir);
 		return NULL;
 	}
+	g_free (scan_el_dir);
 
 	array = g_ptr_array_new_full (0, (GDestroyNotify) channel_info_free);
 
 	while ((name = g_dir_read_name (dp)) != NULL) {
 		if (g_str_has_suffix (name, "_en")) {
-			char *filename, *index_name;
+			char index_name[NAME_MAX];
 			iio_channel_info *current;
 
-			filename = g_build_filename (scan_el_dir, name, NULL);
-			sysfsfp = fopen (filename, "r");
-			if (sysfsfp == NULL) {
-				g_debug ("Could not open scan_elements file '%s'", filename);
-				g_free (filename);
-				continue;
-			}
-			if (fscanf (sysfsfp, "%d", &ret) != 1) {
-				fclose (sysfsfp);
-				g_debug ("Could not read from scan_elements file '%s'", filename);
-				g_free (filename);
+			if (sysfs_read_int (data->scan_el_fd, name, &ret) < 0) {
+				g_debug ("Could not read from scan_elements file '%s'", name);
 				continue;
 			}
-			fclose (sysfsfp);
-			g_free (filename);
 
 			current = g_new0 (iio_channel_info, 1);
 
-			current->scale = 1.0;
-			current->offset = 0;
 			current->name = g_strndup (name, strlen(name) - strlen("_en"));
-			current->generic_name = iioutils_break_up_name (current->name);
-			if (g_strcmp0(current->generic_name, "in_rot_from_north_magnetic_tilt") == 0) {
-				current->generic_name = g_strdup ("in_rot");
-			}
-
-			index_name = g_strdup_printf ("%s_index", current->name);
-			filename = g_build_filename (scan_el_dir, index_name, NULL);
-			g_free (index_name);
+			current->generic_name = get_generic_name (current->name);
 
-			sysfsfp = fopen (filename, "r");
-			if (sysfsfp == NULL)
-				goto error;
-			ret = fscanf (sysfsfp, "%u", &current->index);
-			fclose (sysfsfp);
-			g_free (filename);
-			if (ret != 1)
-				goto error;
-
-			/* Find the scale */
-			ret = iioutils_get_param_float (&current->scale,
-							"scale",
-							device_dir,
-							current->name,
-							current->generic_name);
-			if ((ret < 0) && (ret != -ENOENT))
+			g_snprintf (index_name, sizeof (index_name), "%s_index", current->name);
+			if (sysfs_read_uint (data->scan_el_fd, index_name, &current->index) < 0) {
+				channel_info_free (current);
 				goto error;
+			}
 
-			ret = iioutils_get_param_float (&current->offset,
-							"offset",
-							device_dir,
-							current->name,
-							current->generic_name);
-			if ((ret < 0) && (ret != -ENOENT))
+			if (!read_channel_params (data, current)) {
+				channel_info_free (current);
 				goto error;
+			}
 
 			ret = iioutils_get_type (&current->is_signed,
 						 &current->bytes,
@@ -316,20 +296,20 @@ build_channel_array (const char        *device_dir,
 						 &current->shift,
 						 &current->mask,
 						 &current->be,
-						 device_dir,
+						 data->scan_el_fd,
 						 current->name,
 						 current->generic_name);
 
 			if (!ret) {
 				g_warning ("Could not parse name %s, generic name %s",
 					   current->name, current->generic_name);
+				channel_info_free (current);
 			} else {
 				g_ptr_array_add (array, current);
 			}
 		}
 	}
 	g_dir_close (dp);
-	g_free (scan_el_dir);
 
 	g_ptr_array_sort (array, compare_channel_index);
 
@@ -348,119 +328,9 @@ build_channel_array (const char        *device_dir,
 error:
 	g_ptr_array_free (array, TRUE);
 	g_dir_close (dp);
-	g_free (scan_el_dir);
 	return NULL;
 }
 
-static int
-_write_sysfs_int (const char *filename,
-		  const char *basedir,
-		  int         val,
-		  int         verify,
-		  int         type,
-		  int         val2)
-{
-	int ret = 0;
-	FILE *sysfsfp;
-	int test;
-	char *temp;
-	temp = g_build_filename (basedir, filename, NULL);
-	sysfsfp = fopen(temp, "w");
-	if (sysfsfp == NULL) {
-		g_warning ("Could not open for write '%s'", temp);
-		ret = -errno;
-		goto error_free;
-	}
-	if (type)
-		fprintf(sysfsfp, "%d %d", val, val2);
-	else
-		fprintf(sysfsfp, "%d", val);
-
-	fclose(sysfsfp);
-	if (verify) {
-		sysfsfp = fopen(temp, "r");
-		if (sysfsfp == NULL) {
-			g_warning ("Could not open for read '%s'", temp);
-			ret = -errno;
-			goto error_free;
-		}
-		if (fscanf(sysfsfp, "%d", &test) != 1 ||
-		    test != val) {
-			g_warning ("Possible failure in int write %d to %s",
-				   val, temp);
-			ret = -1;
-		}
-		fclose(sysfsfp);
-	}
-error_free:
-	g_free (temp);
-	return ret;
-}
-
-static int write_sysfs_int(const char *filename, const char *basedir, int val) {
-	return _write_sysfs_int(filename, basedir, val, 0, 0, 0);
-}
-
-static int write_sysfs_int_and_verify(const char *filename, const char *basedir, int val) {
-	return _write_sysfs_int(filename, basedir, val, 1, 0, 0);
-}
-
-static int
-_write_sysfs_string (const char *filename,
-		     const char *basedir,
-		     const char *val,
-		     int         verify)
-{
-	int ret = 0;
-	FILE *sysfsfp;
-	char *temp;
-
-	temp = g_build_filename (basedir, filename, NULL);
-	sysfsfp = fopen (temp, "w");
-	if (sysfsfp == NULL) {
-		ret = -errno;
-		goto error_free;
-	}
-	fprintf(sysfsfp, "%s", val);
-	fclose(sysfsfp);
-
-	/* Verify? */
-	if (!verify)
-		goto error_free;
-	sysfsfp = fopen(temp, "r");
-	if (sysfsfp == NULL) {
-		ret = -errno;
-		goto error_free;
-	}
-	if (fscanf(sysfsfp, "%s", temp) != 1 ||
-	    strcmp(temp, val) != 0) {
-		g_warning ("Possible failure in string write of %s Should be %s written to %s\\%s\n",
-			   temp, val, basedir, filename);
-		ret = -1;
-	}
-	fclose(sysfsfp);
-
-error_free:
-	g_free(temp);
-
-	return ret;
-}
-
-/**
- * write_sysfs_string_and_verify() - string write, readback and verify
- * @filename: name of file to write to
- * @basedir: the sysfs directory in which the file is to be found
- * @val: the string to write
- **/
-static int write_sysfs_string_and_verify(const char *filename, const char *basedir, const char *val) {
-	return _write_sysfs_string(filename, basedir, val, 1);
-}
-
-static int write_sysfs_string(const char *filename, const char *basedir, const char *val) {
-	return _write_sysfs_string(filename, basedir, val, 0);
-}
-
-
 /**
  * size_from_channelarray() - calculate the storage size of a scan
  * @channels:           the channel info array
@@ -493,7 +363,7 @@ size_from_channelarray (iio_channel_info **channels,
 {											\
 	guint##bits input;								\
 											\
-	input = *(guint##bits *)(data + info->location);				\
+	input = *(const guint##bits *)(data + info->location);			\
 	input = info->be ? GUINT##bits##_FROM_BE (input) : GUINT##bits##_FROM_LE (input);\
 	input >>= info->shift;								\
 	input &= info->mask;								\
@@ -506,26 +376,129 @@ size_from_channelarray (iio_channel_info **channels,
 	}										\
 }
 
+static void
+process_channel (const char       *data,
+		 iio_channel_info *info,
+		 int              *ch_val)
+{
+	switch (info->bytes) {
+	case 1:
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wduplicated-branches"
+		PROCESS_CHANNEL_BITS(8);
+#pragma GCC diagnostic pop
+		break;
+	case 2:
+		PROCESS_CHANNEL_BITS(16);
+		break;
+	case 4:
+		PROCESS_CHANNEL_BITS(32);
+		break;
+	case 8:
+		PROCESS_CHANNEL_BITS(64);
+		break;
+	default:
+		g_error ("Process %d bytes channels not supported", info->bytes);
+		break;
+	}
+}
+
 /**
- * process_scan_1() - get an integer value for a particular channel
- * @data:               pointer to the start of the scan
+ * process_scans() - get the integer values of channels for a batch of scans
+ * @data:               pointer to the start of the first scan
+ * @n_scans:            the number of scans
  * @buffer_data:        Buffer information
- * ch_name:		name of channel to get
- * ch_val:		value for the channel
- * ch_scale:		scale for the channel
- * ch_present:		whether the channel is present
+ * @channels:           the channel indexes, from buffer_drv_data_get_channel_index()
+ * @n_channels:         the number of channels
+ * @values:             (out): @n_channels values for each scan, one scan after the other
+ *
+ * The channels are only looked up once, at open, which makes decoding
+ * the whole of a buffer cheap.
  **/
 void
-process_scan_1 (char              *data,
-		BufferDrvData     *buffer_data,
-		const char        *ch_name,
-		int               *ch_val,
-		gdouble           *ch_scale,
-		gboolean          *ch_present)
+process_scans (const char        *data,
+	       guint              n_scans,
+	       BufferDrvData     *buffer_data,
+	       const int         *channels,
+	       guint              n_channels,
+	       int               *values)
+{
+	guint i, j;
+
+	for (i = 0; i < n_scans; i++) {
+		const char *scan = data + buffer_data->scan_size * i;
+
+		for (j = 0; j < n_channels; j++)
+			process_channel (scan, buffer_data->channels[channels[j]], &values[i * n_channels + j]);
+	}
+}
+
+/**
+ * process_scan_timestamps() - get the timestamps of a batch of scans
+ * @data:               pointer to the start of the first scan
+ * @n_scans:            the number of scans
+ * @buffer_data:        Buffer information
+ * @channel:            the index of the timestamp channel
+ * @timestamps:         (out): the timestamp of each scan, in ns
+ *
+ * Timestamps don't fit in the integers process_scans() returns.
+ **/
+void
+process_scan_timestamps (const char    *data,
+			 guint          n_scans,
+			 BufferDrvData *buffer_data,
+			 int            channel,
+			 gint64        *timestamps)
+{
+	iio_channel_info *info = buffer_data->channels[channel];
+	guint i;
+
+	g_return_if_fail (info->bytes == sizeof (guint64));
+
+	for (i = 0; i < n_scans; i++) {
+		guint64 input;
+
+		memcpy (&input, data + buffer_data->scan_size * i + info->location, sizeof (input));
+		timestamps[i] = info->be ? GUINT64_FROM_BE (input) : GUINT64_FROM_LE (input);
+	}
+}
+
+/**
+ * buffer_drv_data_get_channel_index() - find a channel
+ * @buffer_data:        Buffer information
+ * ch_name:		name of the channel
+ *
+ * Returns the index of the channel to pass to process_scans(), or -1.
+ **/
+int
+buffer_drv_data_get_channel_index (BufferDrvData *buffer_data,
+				   const char    *ch_name)
 {
 	int k;
 
-	*ch_present = FALSE;
+	for (k = 0; k < buffer_data->channels_count; k++) {
+		if (strcmp (buffer_data->channels[k]->name, ch_name) == 0)
+			return k;
+	}
+
+	return -1;
+}
+
+/**
+ * buffer_drv_data_get_scale() - get the scale of a particular channel
+ * @buffer_data:        Buffer information
+ * ch_name:		name of the channel
+ * ch_scale:		scale for the channel
+ *
+ * Lets drivers precompute conversions at open time rather than
+ * applying the scale for each scan.
+ **/
+gboolean
+buffer_drv_data_get_scale (BufferDrvData *buffer_data,
+			   const char    *ch_name,
+			   gdouble       *ch_scale)
+{
+	int k;
 
 	for (k = 0; k < buffer_data->channels_count; k++) {
 		struct iio_channel_info *info = buffer_data->channels[k];
@@ -533,61 +506,63 @@ process_scan_1 (char              *data,
 		if (strcmp (info->name, ch_name) != 0)
 			continue;
 
-		g_debug ("process_scan_1: channel_index: %d, chan_name: %s, channel_data_index: %d location: %d bytes: %d is_signed: %d be: %d shift: %d bits_used: %d",
-			 k, info->name, info->index, info->location,
-			 info->bytes, info->is_signed, info->be,
-			 info->shift, info->bits_used);
+		*ch_scale = info->scale;
+		return TRUE;
+	}
 
-		switch (info->bytes) {
-		case 1:
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wduplicated-branches"
-			PROCESS_CHANNEL_BITS(8);
-#pragma GCC diagnostic pop
-			break;
-		case 2:
-			PROCESS_CHANNEL_BITS(16);
-			break;
-		case 4:
-			PROCESS_CHANNEL_BITS(32);
-			break;
-		case 8:
-			PROCESS_CHANNEL_BITS(64);
-			break;
-		default:
-			g_error ("Process %d bytes channels not supported", info->bytes);
-			break;
-		}
+	g_warning ("IIO channel '%s' could not be found", ch_name);
+	return FALSE;
+}
 
-		*ch_scale = info->scale;
-		*ch_present = TRUE;
-		break;
+/**
+ * buffer_drv_data_find_channel() - find a channel by type
+ * @buffer_data:        Buffer information
+ * prefix:		the channel type, eg. "in_proximity"
+ *
+ * Returns the name of the first channel called @prefix, or @prefix
+ * followed by a channel number, eg. "in_proximity0", or %NULL.
+ **/
+const char *
+buffer_drv_data_find_channel (BufferDrvData *buffer_data,
+			      const char    *prefix)
+{
+	gsize len;
+	int k;
+
+	len = strlen (prefix);
+	for (k = 0; k < buffer_data->channels_count; k++) {
+		const char *name = buffer_data->channels[k]->name;
+		const char *suffix;
+
+		if (strncmp (name, prefix, len) != 0)
+			continue;
+		for (suffix = name + len; g_ascii_isdigit (*suffix); suffix++)
+			;
+		if (*suffix == '\0')
+			return name;
 	}
 
-	if (!*ch_present)
-		g_warning ("IIO channel '%s' could not be found", ch_name);
+	return NULL;
 }
 
 /**
- * iio_fixup_sampling_frequency: Fixup devices *sampling_frequency attributes
- * @dev: the IIO device to fix the sampling frequencies for
+ * iio_raise_sampling_frequency: Make a device sample at least at a given rate
+ * @dev: the IIO device to set the sampling frequencies for
+ * @min_freq: the lowest acceptable rate, in Hz
  *
- * Make sure devices with *sampling_frequency attributes are sampling at
- * 10Hz or more. This fixes 2 problems:
- * 1) Some buffered devices default their sampling_frequency to 0Hz and then
- * never produce any readings.
- * 2) Some polled devices default to 1Hz and wait for a fresh sample before
- * returning from sysfs *_raw reads, blocking all of iio-sensor-proxy for
- * multiple seconds
+ * Raises all the *sampling_frequency attributes of @dev that are
+ * lower than @min_freq, leaving faster rates as they are.
  **/
 gboolean
-iio_fixup_sampling_frequency (GUdevDevice *dev)
+iio_raise_sampling_frequency (GUdevDevice *dev,
+			      int          min_freq)
 {
 	GDir *dir;
 	const char *device_dir;
 	const char *name;
 	g_autoptr(GError) error = NULL;
 	double sample_freq;
+	int dir_fd;
 
 	device_dir = g_udev_device_get_sysfs_path (dev);
 	dir = g_dir_open (g_udev_device_get_sysfs_path (dev), 0, &error);
@@ -595,31 +570,56 @@ iio_fixup_sampling_frequency (GUdevDevice *dev)
 		g_warning ("Failed to open directory '%s': %s", device_dir, error->message);
 		return FALSE;
 	}
+	dir_fd = sysfs_open_dir (AT_FDCWD, device_dir);
+	if (dir_fd < 0) {
+		g_warning ("Failed to open directory '%s': %s", device_dir, g_strerror (-dir_fd));
+		g_dir_close (dir);
+		return FALSE;
+	}
 
 	while ((name = g_dir_read_name (dir))) {
 		if (g_str_has_suffix (name, "sampling_frequency") == FALSE)
 			continue;
 
 		sample_freq = g_udev_device_get_sysfs_attr_as_double (dev, name);
-		if (sample_freq >= IIO_MIN_SAMPLING_FREQUENCY)
+		if (sample_freq >= min_freq)
 			continue; /* Continue with pre-set sample freq. */
 
-		/* Sample freq too low, set it to 10Hz */
-		if (write_sysfs_int (name, device_dir, IIO_MIN_SAMPLING_FREQUENCY) < 0)
+		/* Sample freq too low, raise it */
+		if (sysfs_write_int (dir_fd, name, min_freq, FALSE) < 0)
 			g_warning ("Could not fix sample-freq for %s/%s", device_dir, name);
 	}
 	g_dir_close (dir);
+	close (dir_fd);
 	return TRUE;
 }
 
+/**
+ * iio_fixup_sampling_frequency: Fixup devices *sampling_frequency attributes
+ * @dev: the IIO device to fix the sampling frequencies for
+ *
+ * Make sure devices with *sampling_frequency attributes are sampling at
+ * 10Hz or more. This fixes 2 problems:
+ * 1) Some buffered devices default their sampling_frequency to 0Hz and then
+ * never produce any readings.
+ * 2) Some polled devices default to 1Hz and wait for a fresh sample before
+ * returning from sysfs *_raw reads, blocking all of iio-sensor-proxy for
+ * multiple seconds
+ **/
+gboolean
+iio_fixup_sampling_frequency (GUdevDevice *dev)
+{
+	return iio_raise_sampling_frequency (dev, IIO_MIN_SAMPLING_FREQUENCY);
+}
+
 /**
  * enable_sensors: enable all the sensors in a device
- * @device_dir: the IIO device directory in sysfs
- * @
+ * @data: the buffer data for the device
+ * @enable: whether to enable or disable the sensors
  **/
 static gboolean
-enable_sensors (GUdevDevice *dev,
-                int          enable)
+enable_sensors (BufferDrvData *data,
+		int            enable)
 {
 	GDir *dir;
 	char *device_dir;
@@ -627,7 +627,7 @@ enable_sensors (GUdevDevice *dev,
 	gboolean ret = FALSE;
 	g_autoptr(GError) error = NULL;
 
-	device_dir = g_build_filename (g_udev_device_get_sysfs_path (dev), "scan_elements", NULL);
+	device_dir = g_build_filename (data->dev_dir_name, "scan_elements", NULL);
 	dir = g_dir_open (device_dir, 0, &error);
 	if (!dir) {
 		g_warning ("Failed to open directory '%s': %s", device_dir, error->message);
@@ -636,36 +636,34 @@ enable_sensors (GUdevDevice *dev,
 	}
 
 	while ((name = g_dir_read_name (dir))) {
-		char *path;
+		int current;
 
 		if (g_str_has_suffix (name, "_en") == FALSE)
 			continue;
 
 		/* Already enabled? */
-		path = g_strdup_printf ("scan_elements/%s", name);
-		if (g_udev_device_get_sysfs_attr_as_boolean (dev, path)) {
-			g_debug ("Already enabled sensor %s/%s", device_dir, name);
+		if (sysfs_read_int (data->scan_el_fd, name, &current) == 0 &&
+		    current == enable) {
+			g_debug ("Already %s sensor %s/%s", enable ? "enabled" : "disabled", device_dir, name);
 			ret = TRUE;
-			g_free (path);
 			continue;
 		}
-		g_free (path);
 
 		/* Enable */
-		if (write_sysfs_int (name, device_dir, enable) < 0) {
+		if (sysfs_write_int (data->scan_el_fd, name, enable, FALSE) < 0) {
 			g_warning ("Could not enable sensor %s/%s", device_dir, name);
 			continue;
 		}
 
 		ret = TRUE;
-		g_debug ("Enabled sensor %s/%s", device_dir, name);
+		g_debug ("%s sensor %s/%s", enable ? "Enabled" : "Disabled", device_dir, name);
 	}
 	g_dir_close (dir);
 	g_free (device_dir);
 
 	if (!ret) {
 		g_warning ("Failed to enable any sensors for device '%s'",
-			   g_udev_device_get_sysfs_path (dev));
+			   data->dev_dir_name);
 	}
 
 	return ret;
@@ -677,13 +675,13 @@ enable_ring_buffer (BufferDrvData *data)
 	int ret;
 
 	/* Setup ring buffer parameters */
-	ret = write_sysfs_int("buffer/length", data->dev_dir_name, 128);
+	ret = sysfs_write_int (data->buffer_fd, "length", 128, FALSE);
 	if (ret < 0) {
 		g_warning ("Failed to set ring buffer length for %s", data->dev_dir_name);
 		return FALSE;
 	}
 	/* Enable the buffer */
-	ret = write_sysfs_int_and_verify("buffer/enable", data->dev_dir_name, 1);
+	ret = sysfs_write_int (data->buffer_fd, "enable", 1, TRUE);
 	if (ret < 0) {
 		g_warning ("Unable to enable ring buffer for %s", data->dev_dir_name);
 		return FALSE;
@@ -696,20 +694,23 @@ static void
 disable_ring_buffer (BufferDrvData *data)
 {
 	/* Stop the buffer */
-	write_sysfs_int ("buffer/enable", data->dev_dir_name, 0);
+	sysfs_write_int (data->buffer_fd, "enable", 0, FALSE);
 
 	/* Disconnect the trigger - just write a dummy name. */
-	write_sysfs_string ("trigger/current_trigger", data->dev_dir_name, "NULL");
+	sysfs_write_string (data->trigger_fd, "current_trigger", "NULL", FALSE);
 }
 
 static gboolean
 enable_trigger (BufferDrvData *data)
 {
+	const char *trigger_name;
 	int ret;
 
-	/* Set the device trigger to be the data ready trigger */
-	ret = write_sysfs_string_and_verify("trigger/current_trigger",
-			data->dev_dir_name, data->trigger_name);
+	/* Set the device trigger to be the data ready trigger,
+	 * or the one shared with its capture group */
+	trigger_name = data->shared_trigger_name ? data->shared_trigger_name : data->trigger_name;
+	ret = sysfs_write_string (data->trigger_fd, "current_trigger",
+				  trigger_name, TRUE);
 	if (ret < 0) {
 		g_warning ("Failed to write current_trigger file %s", g_strerror(-ret));
 		return FALSE;
@@ -718,19 +719,250 @@ enable_trigger (BufferDrvData *data)
 	return TRUE;
 }
 
+/*
+ * The channel layout only changes with the kernel driver, so it's cached
+ * across startups instead of parsing scan_elements every time. Scales
+ * and offsets aren't part of it, see read_channel_params().
+ *
+ * The cache file is made of a CacheHeader, the key (padded to 8 bytes),
+ * then one CacheChannel per channel, in index order.
+ */
+typedef struct {
+	char    magic[8];
+	guint32 key_len;
+	guint32 n_channels;
+} CacheHeader;
+
+typedef struct {
+	char    name[64];
+	guint32 index;
+	guint32 is_signed;
+	guint32 bits_used;
+	guint32 bytes;
+	guint32 shift;
+	guint32 be;
+	guint64 mask;
+} CacheChannel;
+
+static char *
+get_cache_path (GUdevDevice *device)
+{
+	g_autofree char *checksum = NULL;
+	g_autofree char *filename = NULL;
+	const char *cache_dir;
+
+	/* Set by systemd's CacheDirectory= */
+	cache_dir = g_getenv ("CACHE_DIRECTORY");
+	if (!cache_dir)
+		cache_dir = CACHE_DIR;
+
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1,
+						  g_udev_device_get_sysfs_path (device), -1);
+	filename = g_strdup_printf ("%s.channels", checksum);
+	return g_build_filename (cache_dir, filename, NULL);
+}
+
+static int
+compare_strings (const void *a,
+		 const void *b)
+{
+	return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+/* A hash of the udev properties, bar the ones that change every boot,
+ * so that new hwdb entries or rules invalidate the cache */
+static char *
+get_properties_checksum (GUdevDevice *device)
+{
+	g_autoptr(GChecksum) checksum = NULL;
+	g_auto(GStrv) keys = NULL;
+	guint i;
+
+	keys = g_strdupv ((char **) g_udev_device_get_property_keys (device));
+	qsort (keys, g_strv_length (keys), sizeof (char *), compare_strings);
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA1);
+	for (i = 0; keys[i] != NULL; i++) {
+		const char *value;
+
+		if (g_str_equal (keys[i], "USEC_INITIALIZED") ||
+		    g_str_equal (keys[i], "SEQNUM"))
+			continue;
+		value = g_udev_device_get_property (device, keys[i]);
+		g_checksum_update (checksum, (const guchar *) keys[i], -1);
+		g_checksum_update (checksum, (const guchar *) "=", 1);
+		g_checksum_update (checksum, (const guchar *) (value ?: ""), -1);
+		g_checksum_update (checksum, (const guchar *) "\n", 1);
+	}
+
+	return g_strdup (g_checksum_get_string (checksum));
+}
+
+/* The device identity, its udev properties, and the kernel, so that
+ * driver updates invalidate the cache */
+static char *
+get_cache_key (GUdevDevice *device)
+{
+	g_autofree char *properties = NULL;
+	struct utsname uts;
+
+	if (uname (&uts) < 0)
+		return NULL;
+
+	properties = get_properties_checksum (device);
+	return g_strdup_printf ("%s\n%s\n%s\n%s\n%s",
+				g_udev_device_get_sysfs_path (device),
+				g_udev_device_get_sysfs_attr (device, "name") ?: "",
+				g_udev_device_get_property (device, "MODALIAS") ?: "",
+				properties,
+				uts.release);
+}
+
+static iio_channel_info **
+load_channel_cache (GUdevDevice *device,
+		    int         *counter)
+{
+	g_autoptr(GMappedFile) mapped = NULL;
+	g_autofree char *path = NULL;
+	g_autofree char *key = NULL;
+	const CacheHeader *header;
+	const CacheChannel *cached;
+	iio_channel_info **channels;
+	gsize len, offset;
+	guint i;
+
+	*counter = 0;
+	key = get_cache_key (device);
+	if (!key)
+		return NULL;
+
+	path = get_cache_path (device);
+	mapped = g_mapped_file_new (path, FALSE, NULL);
+	if (!mapped)
+		return NULL;
+
+	len = g_mapped_file_get_length (mapped);
+	header = (const CacheHeader *) g_mapped_file_get_contents (mapped);
+	if (len < sizeof (CacheHeader) ||
+	    memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->key_len != strlen (key))
+		goto invalid;
+
+	offset = sizeof (CacheHeader) + CACHE_ALIGN (header->key_len);
+	if (len != offset + header->n_channels * sizeof (CacheChannel) ||
+	    memcmp ((const char *) header + sizeof (CacheHeader), key, header->key_len) != 0)
+		goto invalid;
+
+	cached = (const CacheChannel *) ((const char *) header + offset);
+	channels = g_new0 (iio_channel_info *, header->n_channels);
+	for (i = 0; i < header->n_channels; i++) {
+		iio_channel_info *ci;
+
+		ci = g_new0 (iio_channel_info, 1);
+		ci->name = g_strndup (cached[i].name, sizeof (cached[i].name));
+		ci->generic_name = get_generic_name (ci->name);
+		ci->index = cached[i].index;
+		ci->is_signed = cached[i].is_signed;
+		ci->bits_used = cached[i].bits_used;
+		ci->bytes = cached[i].bytes;
+		ci->shift = cached[i].shift;
+		ci->be = cached[i].be;
+		ci->mask = cached[i].mask;
+		channels[i] = ci;
+	}
+
+	g_debug ("Loaded %u channels for %s from cache", header->n_channels,
+		 g_udev_device_get_sysfs_path (device));
+	*counter = header->n_channels;
+	return channels;
+
+invalid:
+	g_debug ("Ignoring stale channel cache %s", path);
+	return NULL;
+}
+
+static void
+save_channel_cache (BufferDrvData *data)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree char *path = NULL;
+	g_autofree char *key = NULL;
+	g_autofree char *contents = NULL;
+	CacheHeader *header;
+	CacheChannel *cached;
+	gsize len, offset;
+	int i;
+
+	key = get_cache_key (data->device);
+	if (!key)
+		return;
+
+	offset = sizeof (CacheHeader) + CACHE_ALIGN (strlen (key));
+	len = offset + data->channels_count * sizeof (CacheChannel);
+	contents = g_malloc0 (len);
+
+	header = (CacheHeader *) contents;
+	memcpy (header->magic, CACHE_MAGIC, sizeof (header->magic));
+	header->key_len = strlen (key);
+	header->n_channels = data->channels_count;
+	memcpy (contents + sizeof (CacheHeader), key, header->key_len);
+
+	cached = (CacheChannel *) (contents + offset);
+	for (i = 0; i < data->channels_count; i++) {
+		iio_channel_info *ci = data->channels[i];
+
+		if (strlen (ci->name) > sizeof (cached[i].name))
+			return;
+		strncpy (cached[i].name, ci->name, sizeof (cached[i].name));
+		cached[i].index = ci->index;
+		cached[i].is_signed = ci->is_signed;
+		cached[i].bits_used = ci->bits_used;
+		cached[i].bytes = ci->bytes;
+		cached[i].shift = ci->shift;
+		cached[i].be = ci->be;
+		cached[i].mask = ci->mask;
+	}
+
+	path = get_cache_path (data->device);
+	if (!g_file_set_contents (path, contents, len, &error))
+		g_debug ("Could not save channel cache to %s: %s", path, error->message);
+}
+
 static gboolean
 build_channels (BufferDrvData *data)
 {
-	/* Parse the files in scan_elements to identify what channels are present */
-	data->channels = build_channel_array (data->dev_dir_name, &(data->channels_count));
-	if (data->channels == NULL) {
-		g_warning ("Problem reading scan element information: %s", data->dev_dir_name);
-		return FALSE;
+	data->channels = load_channel_cache (data->device, &(data->channels_count));
+	if (data->channels != NULL) {
+		int i;
+
+		for (i = 0; i < data->channels_count; i++) {
+			if (!read_channel_params (data, data->channels[i])) {
+				g_warning ("Could not read scale and offset for %s: %s",
+					   data->channels[i]->name, data->dev_dir_name);
+				return FALSE;
+			}
+		}
+	} else {
+		/* Parse the files in scan_elements to identify what channels are present */
+		data->channels = build_channel_array (data, &(data->channels_count));
+		if (data->channels == NULL) {
+			g_warning ("Problem reading scan element information: %s", data->dev_dir_name);
+			return FALSE;
+		}
+		save_channel_cache (data);
 	}
 	data->scan_size = size_from_channelarray (data->channels, data->channels_count);
 	return TRUE;
 }
 
+static void
+close_fd (int *fd)
+{
+	if (*fd >= 0)
+		close (*fd);
+	*fd = -1;
+}
+
 void
 buffer_drv_data_free (BufferDrvData *buffer_data)
 {
@@ -739,18 +971,216 @@ buffer_drv_data_free (BufferDrvData *buffer_data)
 	if (buffer_data == NULL)
 		return;
 
-	enable_sensors (buffer_data->device, 0);
+	buffer_drv_data_set_enabled (buffer_data, FALSE);
 	g_clear_object (&buffer_data->device);
 
-	disable_ring_buffer (buffer_data);
+	/* Only works once the trigger isn't in use anymore */
+	if (buffer_data->hrtimer_path != NULL && buffer_data->trigger_fd >= 0)
+		sysfs_write_string (buffer_data->trigger_fd, "current_trigger", "NULL", FALSE);
+	if (buffer_data->hrtimer_path != NULL &&
+	    g_rmdir (buffer_data->hrtimer_path) < 0)
+		g_warning ("Could not remove hrtimer trigger %s: %s",
+			   buffer_data->hrtimer_path, g_strerror (errno));
+	g_free (buffer_data->hrtimer_path);
+
+	close_fd (&buffer_data->scan_el_fd);
+	close_fd (&buffer_data->buffer_fd);
+	close_fd (&buffer_data->trigger_fd);
+	close_fd (&buffer_data->dir_fd);
+	close_fd (&buffer_data->dev_fd);
 
 	g_free (buffer_data->trigger_name);
+	g_free (buffer_data->shared_trigger_name);
 
 	for (i = 0; i < buffer_data->channels_count; i++)
 		channel_info_free (buffer_data->channels[i]);
 	g_free (buffer_data->channels);
 }
 
+/* Returns the name of the trigger associated with @device, for example
+ * "accel_3d-dev0" for the "accel_3d" @prefix, or NULL if there isn't one */
+char *
+get_trigger_name (GUdevDevice *device,
+		  const char  *prefix)
+{
+	DeviceIndex *index;
+	char *trigger_name;
+
+	index = device_index_get_default ();
+	g_return_val_if_fail (index != NULL, NULL);
+
+	trigger_name = g_strdup_printf ("%s-dev%s", prefix, g_udev_device_get_number (device));
+	if (device_index_lookup_name (index, trigger_name) != NULL) {
+		g_debug ("Found associated trigger %s", trigger_name);
+		return trigger_name;
+	}
+
+	g_debug ("Could not find trigger name associated with %s",
+		 g_udev_device_get_sysfs_path (device));
+	g_free (trigger_name);
+	return NULL;
+}
+
+static char *
+get_hrtimer_trigger_name (GUdevDevice *device)
+{
+	return g_strdup_printf ("iio-sensor-proxy-dev%s", g_udev_device_get_number (device));
+}
+
+/* Whether an hrtimer trigger could be created through configfs for
+ * @device, which doesn't come with a trigger of its own. This doesn't
+ * touch the device, whether it accepts the trigger is only known once
+ * it's attached, in buffer_drv_data_new() */
+gboolean
+hrtimer_trigger_available (GUdevDevice *device)
+{
+	g_autofree char *trigger_dir = NULL;
+
+	if (g_access (HRTIMER_TRIGGERS_DIR, W_OK) != 0)
+		return FALSE;
+
+	trigger_dir = g_build_filename (g_udev_device_get_sysfs_path (device), "trigger", NULL);
+	return g_file_test (trigger_dir, G_FILE_TEST_IS_DIR);
+}
+
+/* Returns a directory fd for the trigger called @trigger_name */
+static int
+open_trigger_dir (const char *trigger_name)
+{
+	GDir *dir;
+	const char *name;
+	int devices_fd;
+	int ret = -ENOENT;
+
+	dir = g_dir_open (IIO_DEVICES_DIR, 0, NULL);
+	if (!dir)
+		return -ENOENT;
+	devices_fd = sysfs_open_dir (AT_FDCWD, IIO_DEVICES_DIR);
+	if (devices_fd < 0) {
+		g_dir_close (dir);
+		return devices_fd;
+	}
+
+	while ((name = g_dir_read_name (dir))) {
+		char buf[64];
+		int fd;
+
+		if (!g_str_has_prefix (name, "trigger"))
+			continue;
+		fd = sysfs_open_dir (devices_fd, name);
+		if (fd < 0)
+			continue;
+		if (sysfs_read (fd, "name", buf, sizeof (buf)) > 0 &&
+		    g_str_equal (buf, trigger_name)) {
+			ret = fd;
+			break;
+		}
+		close (fd);
+	}
+	g_dir_close (dir);
+	close (devices_fd);
+
+	return ret;
+}
+
+/* The rate the device was set up to sample at, by iio_fixup_sampling_frequency()
+ * or the kernel driver, either shared by all the channels, or per channel type */
+float
+buffer_drv_data_get_sampling_frequency (BufferDrvData *data)
+{
+	g_autofree char *attr = NULL;
+	float freq;
+
+	if (sysfs_read_float (data->dir_fd, "sampling_frequency", &freq) == 0 &&
+	    freq > 0.0)
+		return freq;
+
+	if (data->channels_count > 0) {
+		attr = g_strdup_printf ("%s_sampling_frequency", data->channels[0]->generic_name);
+		if (sysfs_read_float (data->dir_fd, attr, &freq) == 0 &&
+		    freq > 0.0)
+			return freq;
+	}
+
+	return IIO_MIN_SAMPLING_FREQUENCY;
+}
+
+/* Creates an hrtimer trigger ticking at the device's sampling frequency,
+ * which will be removed along with @data */
+static gboolean
+create_hrtimer_trigger (BufferDrvData *data)
+{
+	g_autofree char *path = NULL;
+	char *name;
+	float freq;
+	int fd, ret;
+
+	name = get_hrtimer_trigger_name (data->device);
+	path = g_build_filename (HRTIMER_TRIGGERS_DIR, name, NULL);
+
+	/* Might have been left behind if we crashed */
+	if (g_mkdir (path, 0755) < 0 && errno != EEXIST) {
+		g_warning ("Could not create hrtimer trigger %s: %s", path, g_strerror (errno));
+		g_free (name);
+		return FALSE;
+	}
+	data->hrtimer_path = g_steal_pointer (&path);
+	data->trigger_name = name;
+
+	fd = open_trigger_dir (name);
+	if (fd < 0) {
+		g_warning ("Could not find hrtimer trigger %s: %s", name, g_strerror (-fd));
+		return FALSE;
+	}
+
+	freq = buffer_drv_data_get_sampling_frequency (data);
+	ret = sysfs_write_int (fd, "sampling_frequency", (int) ceilf (freq), TRUE);
+	close (fd);
+	if (ret < 0) {
+		g_warning ("Could not set hrtimer trigger %s frequency to %f Hz: %s",
+			   name, freq, g_strerror (-ret));
+		return FALSE;
+	}
+
+	/* Not all devices accept other devices' triggers */
+	if (!enable_trigger (data)) {
+		g_debug ("%s does not accept hrtimer trigger %s", data->dev_dir_name, name);
+		return FALSE;
+	}
+
+	g_debug ("Created hrtimer trigger %s at %d Hz for %s",
+		 name, (int) ceilf (freq), data->dev_dir_name);
+	return TRUE;
+}
+
+/* The kernel's timestamps are only used when they can be switched to
+ * the same clock as g_get_monotonic_time(), otherwise scans are
+ * timestamped when they're read */
+static void
+find_timestamp_channel (BufferDrvData *data)
+{
+	int ret;
+
+	data->timestamp_channel = buffer_drv_data_get_channel_index (data, "in_timestamp");
+	if (data->timestamp_channel < 0)
+		return;
+
+	ret = sysfs_write_string (data->dir_fd, "current_timestamp_clock", "monotonic", FALSE);
+	if (ret < 0) {
+		g_debug ("Could not use monotonic timestamps for %s: %s",
+			 data->dev_dir_name, g_strerror (-ret));
+		data->timestamp_channel = -1;
+	}
+}
+
+/**
+ * buffer_drv_data_new:
+ * @device: the IIO device
+ * @trigger_name: the name of the device's trigger, or %NULL to
+ *   create an hrtimer trigger, see hrtimer_trigger_available()
+ *
+ * Returns: the buffer data for @device, or %NULL on failure
+ **/
 BufferDrvData *
 buffer_drv_data_new (GUdevDevice *device,
 		     const char  *trigger_name)
@@ -761,16 +1191,110 @@ buffer_drv_data_new (GUdevDevice *device,
 	buffer_data->dev_dir_name = g_udev_device_get_sysfs_path (device);
 	buffer_data->trigger_name = g_strdup (trigger_name);
 	buffer_data->device = g_object_ref (device);
+	buffer_data->dev_fd = -1;
+
+	buffer_data->dir_fd = sysfs_open_dir (AT_FDCWD, buffer_data->dev_dir_name);
+	buffer_data->scan_el_fd = sysfs_open_dir (buffer_data->dir_fd, "scan_elements");
+	buffer_data->buffer_fd = sysfs_open_dir (buffer_data->dir_fd, "buffer");
+	buffer_data->trigger_fd = sysfs_open_dir (buffer_data->dir_fd, "trigger");
+	if (buffer_data->dir_fd < 0 ||
+	    buffer_data->scan_el_fd < 0 ||
+	    buffer_data->buffer_fd < 0 ||
+	    buffer_data->trigger_fd < 0) {
+		g_warning ("Could not open sysfs directories for %s", buffer_data->dev_dir_name);
+		buffer_drv_data_free (buffer_data);
+		return NULL;
+	}
 
+	/* The buffer itself is only enabled when the sensor is used */
 	if (!iio_fixup_sampling_frequency (device) ||
-	    !enable_sensors (device, 1) ||
-	    !enable_trigger (buffer_data) ||
-	    !enable_ring_buffer (buffer_data) ||
-	    !build_channels (buffer_data)) {
+	    !build_channels (buffer_data) ||
+	    (trigger_name == NULL && !create_hrtimer_trigger (buffer_data))) {
 		buffer_drv_data_free (buffer_data);
 		return NULL;
 	}
+	find_timestamp_channel (buffer_data);
 
 	return buffer_data;
 }
 
+/* Throw away the samples nobody read, so that they don't get
+ * sent when the buffer is next enabled */
+static void
+drain_buffer (BufferDrvData *buffer_data)
+{
+	char buf[256];
+
+	if (buffer_data->dev_fd < 0)
+		return;
+	while (read (buffer_data->dev_fd, buf, sizeof (buf)) > 0)
+		;
+}
+
+/* The device node stays open for as long as the buffer is enabled,
+ * rather than being opened on every read, as only one reader can
+ * have it open at a time */
+static gboolean
+open_device_node (BufferDrvData *buffer_data)
+{
+	const char *dev_path;
+
+	dev_path = g_udev_device_get_device_file (buffer_data->device);
+	if (!dev_path) {
+		g_warning ("No device node for %s", buffer_data->dev_dir_name);
+		return FALSE;
+	}
+
+	buffer_data->dev_fd = open (dev_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (buffer_data->dev_fd < 0) {
+		g_warning ("Failed to open %s: %s", dev_path, g_strerror (errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * buffer_drv_data_set_enabled:
+ * @buffer_data: the buffer data for the device
+ * @enabled: whether to enable the buffer
+ *
+ * Enables the scan elements, trigger and ring buffer, so that the
+ * device starts sampling, and opens the device node the scans are read
+ * from. Or drains and disables them all so that it stops, when nobody
+ * uses the sensor.
+ **/
+gboolean
+buffer_drv_data_set_enabled (BufferDrvData *buffer_data,
+			     gboolean       enabled)
+{
+	if (buffer_data->enabled == enabled)
+		return TRUE;
+
+	if (!enabled) {
+		/* Stop sampling first, or the trigger could push
+		 * new scans while the old ones are being drained */
+		disable_ring_buffer (buffer_data);
+		enable_sensors (buffer_data, 0);
+		drain_buffer (buffer_data);
+		close_fd (&buffer_data->dev_fd);
+		buffer_data->enabled = FALSE;
+		g_debug ("Disabled buffer for %s", buffer_data->dev_dir_name);
+		return TRUE;
+	}
+
+	if (!enable_sensors (buffer_data, 1) ||
+	    !enable_trigger (buffer_data) ||
+	    !enable_ring_buffer (buffer_data) ||
+	    !open_device_node (buffer_data)) {
+		disable_ring_buffer (buffer_data);
+		enable_sensors (buffer_data, 0);
+		close_fd (&buffer_data->dev_fd);
+		return FALSE;
+	}
+
+	buffer_data->enabled = TRUE;
+	g_debug ("Enabled buffer for %s", buffer_data->dev_dir_name);
+	return TRUE;
+}
+
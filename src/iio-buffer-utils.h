@@ -10,18 +10,33 @@
  * the Free Software Foundation.
  */
 
+#pragma once
+
 #include <glib.h>
 #include <gudev/gudev.h>
 
+/* How long after enabling a buffer to wait for the first sample */
+#define BUFFER_FIRST_READ_DELAY 100 /* ms */
+
 typedef struct iio_channel_info iio_channel_info;
 
 typedef struct {
 	GUdevDevice       *device;
 	char              *trigger_name;
+	char              *shared_trigger_name;
 	const char        *dev_dir_name;
+	int                dir_fd;
+	int                scan_el_fd;
+	int                buffer_fd;
+	int                trigger_fd;
+	int                dev_fd;
+	char              *hrtimer_path;
+	gboolean           enabled;
 	int                channels_count;
 	iio_channel_info **channels;
 	int                scan_size;
+	/* On the g_get_monotonic_time() clock, or -1 */
+	int                timestamp_channel;
 } BufferDrvData;
 
 typedef struct {
@@ -29,14 +44,34 @@ typedef struct {
 	char    *data;
 } IIOSensorData;
 
-void process_scan_1                    (char              *data,
-				        BufferDrvData     *buffer_data,
+void process_scans                     (const char        *data,
+					guint              n_scans,
+					BufferDrvData     *buffer_data,
+					const int         *channels,
+					guint              n_channels,
+					int               *values);
+void process_scan_timestamps           (const char        *data,
+					guint              n_scans,
+					BufferDrvData     *buffer_data,
+					int                channel,
+					gint64            *timestamps);
+int  buffer_drv_data_get_channel_index (BufferDrvData     *buffer_data,
+					const char        *ch_name);
+gboolean buffer_drv_data_get_scale    (BufferDrvData     *buffer_data,
 				        const char        *ch_name,
-				        int               *ch_val,
-				        gdouble           *ch_scale,
-				        gboolean          *ch_present);
+				        gdouble           *ch_scale);
+const char *buffer_drv_data_find_channel (BufferDrvData  *buffer_data,
+					  const char     *prefix);
 gboolean iio_fixup_sampling_frequency  (GUdevDevice *dev);
+gboolean iio_raise_sampling_frequency  (GUdevDevice *dev,
+					int          min_freq);
+char    *get_trigger_name              (GUdevDevice *device,
+				        const char  *prefix);
+gboolean hrtimer_trigger_available     (GUdevDevice *device);
 
 void           buffer_drv_data_free    (BufferDrvData *buffer_data);
 BufferDrvData *buffer_drv_data_new     (GUdevDevice *device,
 					const char  *trigger_name);
+float          buffer_drv_data_get_sampling_frequency (BufferDrvData *buffer_data);
+gboolean       buffer_drv_data_set_enabled (BufferDrvData *buffer_data,
+					    gboolean       enabled);
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#include "iio-events.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+#include <linux/iio/events.h>
+
+static gboolean
+event_attr_exists (GUdevDevice *device,
+		   const char  *channel,
+		   const char  *attr)
+{
+	g_autofree char *path = NULL;
+
+	path = g_strdup_printf ("%s/events/%s_thresh_%s",
+				g_udev_device_get_sysfs_path (device),
+				channel, attr);
+	return g_file_test (path, G_FILE_TEST_EXISTS);
+}
+
+static gboolean
+write_event_attr (GUdevDevice *device,
+		  const char  *channel,
+		  const char  *attr,
+		  int          value)
+{
+	g_autofree char *path = NULL;
+	char buf[16];
+	int fd, len;
+	gboolean ret = TRUE;
+
+	path = g_strdup_printf ("%s/events/%s_thresh_%s",
+				g_udev_device_get_sysfs_path (device),
+				channel, attr);
+	fd = open (path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_warning ("Could not open for write '%s': %s", path, g_strerror (errno));
+		return FALSE;
+	}
+
+	len = g_snprintf (buf, sizeof (buf), "%d", value);
+	if (write (fd, buf, len) != len) {
+		g_warning ("Could not write %d to '%s': %s", value, path, g_strerror (errno));
+		ret = FALSE;
+	}
+	close (fd);
+
+	return ret;
+}
+
+/**
+ * iio_events_has_threshold:
+ * @device: the IIO device
+ * @channel: the channel prefix, eg. "in_proximity"
+ *
+ * Returns: whether the device can send threshold events for
+ * the channel, with both rising and falling thresholds.
+ **/
+gboolean
+iio_events_has_threshold (GUdevDevice *device,
+			  const char  *channel)
+{
+	if (!event_attr_exists (device, channel, "rising_value") ||
+	    !event_attr_exists (device, channel, "falling_value"))
+		return FALSE;
+
+	return event_attr_exists (device, channel, "either_en") ||
+		(event_attr_exists (device, channel, "rising_en") &&
+		 event_attr_exists (device, channel, "falling_en"));
+}
+
+/**
+ * iio_events_set_threshold:
+ * @device: the IIO device
+ * @channel: the channel prefix, eg. "in_proximity"
+ * @direction: "rising" or "falling"
+ * @value: the threshold, in the same unit as the channel's raw readings
+ **/
+gboolean
+iio_events_set_threshold (GUdevDevice *device,
+			  const char  *channel,
+			  const char  *direction,
+			  int          value)
+{
+	g_autofree char *attr = NULL;
+
+	attr = g_strdup_printf ("%s_value", direction);
+	return write_event_attr (device, channel, attr, value);
+}
+
+/**
+ * iio_events_get_threshold:
+ * @device: the IIO device
+ * @channel: the channel prefix, eg. "in_proximity"
+ * @direction: "rising" or "falling"
+ * @value: (out): the threshold, in the same unit as the channel's raw readings
+ **/
+gboolean
+iio_events_get_threshold (GUdevDevice *device,
+			  const char  *channel,
+			  const char  *direction,
+			  int         *value)
+{
+	g_autofree char *path = NULL;
+	g_autofree char *contents = NULL;
+
+	path = g_strdup_printf ("%s/events/%s_thresh_%s_value",
+				g_udev_device_get_sysfs_path (device),
+				channel, direction);
+	if (!g_file_get_contents (path, &contents, NULL, NULL))
+		return FALSE;
+	*value = atoi (contents);
+	return TRUE;
+}
+
+gboolean
+iio_events_enable_threshold (GUdevDevice *device,
+			     const char  *channel,
+			     gboolean     enable)
+{
+	if (event_attr_exists (device, channel, "either_en"))
+		return write_event_attr (device, channel, "either_en", enable);
+
+	return write_event_attr (device, channel, "rising_en", enable) &&
+		write_event_attr (device, channel, "falling_en", enable);
+}
+
+/**
+ * iio_events_open:
+ * @device: the IIO device
+ *
+ * Returns: a non-blocking file descriptor that becomes readable when
+ * the device sends an event, or -1 on error.
+ **/
+int
+iio_events_open (GUdevDevice *device)
+{
+	const char *dev_path;
+	int fd, event_fd = -1;
+
+	dev_path = g_udev_device_get_device_file (device);
+	if (!dev_path)
+		return -1;
+
+	fd = open (dev_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_warning ("Could not open '%s': %s", dev_path, g_strerror (errno));
+		return -1;
+	}
+
+	if (ioctl (fd, IIO_GET_EVENT_FD_IOCTL, &event_fd) < 0 || event_fd < 0) {
+		g_warning ("Could not get event fd for '%s': %s", dev_path, g_strerror (errno));
+		event_fd = -1;
+	} else if (fcntl (event_fd, F_SETFL, fcntl (event_fd, F_GETFL) | O_NONBLOCK) < 0) {
+		g_warning ("Could not make event fd for '%s' non-blocking: %s", dev_path, g_strerror (errno));
+		close (event_fd);
+		event_fd = -1;
+	}
+	close (fd);
+
+	return event_fd;
+}
+
+/**
+ * iio_events_drain:
+ * @fd: a file descriptor from iio_events_open()
+ *
+ * Reads all the pending events, as only the current value of the
+ * channel matters to callers.
+ *
+ * Returns: the number of events read, or -1 on error.
+ **/
+int
+iio_events_drain (int fd)
+{
+	struct iio_event_data events[8];
+	int num_events = 0;
+	ssize_t len;
+
+	while ((len = read (fd, events, sizeof (events))) > 0)
+		num_events += len / sizeof (struct iio_event_data);
+
+	if (len < 0 && errno != EAGAIN) {
+		g_warning ("Could not read IIO events: %s", g_strerror (errno));
+		return -1;
+	}
+
+	return num_events;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gudev/gudev.h>
+
+gboolean iio_events_has_threshold    (GUdevDevice *device,
+				      const char  *channel);
+gboolean iio_events_set_threshold    (GUdevDevice *device,
+				      const char  *channel,
+				      const char  *direction,
+				      int          value);
+gboolean iio_events_get_threshold    (GUdevDevice *device,
+				      const char  *channel,
+				      const char  *direction,
+				      int         *value);
+gboolean iio_events_enable_threshold (GUdevDevice *device,
+				      const char  *channel,
+				      gboolean     enable);
+int      iio_events_open             (GUdevDevice *device);
+int      iio_events_drain            (int          fd);
@@ -17,21 +17,38 @@
 #include <gio/gio.h>
 #include <gudev/gudev.h>
 #include "drivers.h"
+#include "device-index.h"
 #include "orientation.h"
+#include "compass-fusion.h"
+#include "hinge-angle.h"
+#include "sensor-trace.h"
+#include "time-source.h"
 
 #include "iio-sensor-proxy-resources.h"
 
 #define SENSOR_PROXY_DBUS_NAME          "net.hadess.SensorProxy"
 #define SENSOR_PROXY_DBUS_PATH          "/net/hadess/SensorProxy"
 #define SENSOR_PROXY_COMPASS_DBUS_PATH  "/net/hadess/SensorProxy/Compass"
+#define SENSOR_PROXY_GYRO_DBUS_PATH     "/net/hadess/SensorProxy/Gyroscope"
 #define SENSOR_PROXY_IFACE_NAME         SENSOR_PROXY_DBUS_NAME
 #define SENSOR_PROXY_COMPASS_IFACE_NAME SENSOR_PROXY_DBUS_NAME ".Compass"
+#define SENSOR_PROXY_GYRO_IFACE_NAME    SENSOR_PROXY_DBUS_NAME ".Gyroscope"
 
-#define NUM_SENSOR_TYPES DRIVER_TYPE_PROXIMITY + 1
+/* How long a released sensor keeps running, so that re-claims are instant */
+#define WARM_STANDBY_TIMEOUT 5000 /* ms */
+/* How long the replies to Claim*WithReading() are held waiting for a reading */
+#define CLAIM_REPLY_TIMEOUT  1000 /* ms */
+
+/* Claims the accelerometer for compass tilt compensation. Not a valid
+ * D-Bus name, so it can't clash with a real client */
+#define FUSION_CLIENT "iio-sensor-proxy/compass-fusion"
+/* Claims the display accelerometer for the hinge angle */
+#define HINGE_CLIENT  "iio-sensor-proxy/hinge-angle"
 
 typedef struct {
 	GMainLoop *loop;
 	GUdevClient *client;
+	DeviceIndex *index;
 	GDBusNodeInfo *introspection_data;
 	GDBusConnection *connection;
 	guint name_id;
@@ -40,9 +57,23 @@ typedef struct {
 	SensorDriver *drivers[NUM_SENSOR_TYPES];
 	GUdevDevice  *devices[NUM_SENSOR_TYPES];
 	GHashTable   *clients[NUM_SENSOR_TYPES]; /* key = D-Bus name, value = watch ID */
+	gboolean      opening[NUM_SENSOR_TYPES];
+	gboolean      open_queued[NUM_SENSOR_TYPES];
+	gboolean      has_reading[NUM_SENSOR_TYPES];
+	guint         standby_id[NUM_SENSOR_TYPES];
+	GList        *pending_claims[NUM_SENSOR_TYPES]; /* GDBusMethodInvocation */
+	guint         claim_timeout_id[NUM_SENSOR_TYPES];
 
 	/* Accelerometer */
 	OrientationUp previous_orientation;
+	gdouble gravity[3];
+	gboolean has_gravity;
+
+	/* Hinge */
+	gdouble base_gravity[3];
+	gboolean has_base_gravity;
+	gdouble hinge_angle;
+	gboolean tablet_mode;
 
 	/* Light */
 	gdouble previous_level;
@@ -55,20 +86,6 @@ typedef struct {
 	gboolean previous_prox_near;
 } SensorData;
 
-static const SensorDriver * const drivers[] = {
-	&iio_buffer_accel,
-	&iio_poll_accel,
-	&input_accel,
-	&iio_poll_light,
-	&iio_buffer_light,
-	&hwmon_light,
-	&fake_compass,
-	&fake_light,
-	&iio_buffer_compass,
-	&iio_poll_compass_uncalibrated,
-	&iio_poll_proximity,
-};
-
 static ReadingsUpdateFunc driver_type_to_callback_func (DriverType type);
 
 static const char *
@@ -83,6 +100,10 @@ driver_type_to_str (DriverType type)
 		return "compass";
 	case DRIVER_TYPE_PROXIMITY:
 		return "proximity";
+	case DRIVER_TYPE_GYRO:
+		return "gyroscope";
+	case DRIVER_TYPE_ACCEL_BASE:
+		return "base accelerometer";
 	default:
 		g_assert_not_reached ();
 	}
@@ -96,32 +117,28 @@ static void sensor_changes (GUdevClient *client,
 			    GUdevDevice *device,
 			    SensorData  *data);
 
+/* Whether the driver is opened and ready to use */
 static gboolean
 driver_type_exists (SensorData *data,
 		    DriverType  driver_type)
 {
-	return (DRIVER_FOR_TYPE(driver_type) != NULL);
+	return (DRIVER_FOR_TYPE(driver_type) != NULL &&
+		!data->opening[driver_type]);
 }
 
 static gboolean
-find_sensors (GUdevClient *client,
+find_sensors (DeviceIndex *index,
 	      SensorData  *data)
 {
-	GList *devices, *input, *platform, *l;
+	GList *l;
 	gboolean found = FALSE;
 
-	devices = g_udev_client_query_by_subsystem (client, "iio");
-	input = g_udev_client_query_by_subsystem (client, "input");
-	platform = g_udev_client_query_by_subsystem (client, "platform");
-	devices = g_list_concat (devices, input);
-	devices = g_list_concat (devices, platform);
-
 	/* Find the devices */
-	for (l = devices; l != NULL; l = l->next) {
+	for (l = device_index_get_devices (index); l != NULL; l = l->next) {
 		GUdevDevice *dev = l->data;
 		guint i;
 
-		for (i = 0; i < G_N_ELEMENTS(drivers); i++) {
+		for (i = 0; drivers[i] != NULL; i++) {
 			SensorDriver *driver = (SensorDriver *) drivers[i];
 			if (!driver_type_exists(data, driver->type) &&
 			    driver_discover (driver, dev)) {
@@ -139,11 +156,12 @@ find_sensors (GUdevClient *client,
 		if (driver_type_exists (data, DRIVER_TYPE_ACCEL) &&
 		    driver_type_exists (data, DRIVER_TYPE_LIGHT) &&
 		    driver_type_exists (data, DRIVER_TYPE_PROXIMITY) &&
-		    driver_type_exists (data, DRIVER_TYPE_COMPASS))
+		    driver_type_exists (data, DRIVER_TYPE_COMPASS) &&
+		    driver_type_exists (data, DRIVER_TYPE_GYRO) &&
+		    driver_type_exists (data, DRIVER_TYPE_ACCEL_BASE))
 			break;
 	}
 
-	g_list_free_full (devices, g_object_unref);
 	return found;
 }
 
@@ -157,6 +175,14 @@ free_client_watch (gpointer data)
 	g_bus_unwatch_name (watch_id);
 }
 
+/* Both accelerometers are needed to tell the angle */
+static gboolean
+has_hinge_angle (SensorData *data)
+{
+	return driver_type_exists (data, DRIVER_TYPE_ACCEL) &&
+	       driver_type_exists (data, DRIVER_TYPE_ACCEL_BASE);
+}
+
 static GHashTable *
 create_clients_hash_table (void)
 {
@@ -173,6 +199,9 @@ typedef enum {
 	PROP_COMPASS_HEADING            = 1 << 5,
 	PROP_HAS_PROXIMITY              = 1 << 6,
 	PROP_PROXIMITY_NEAR             = 1 << 7,
+	PROP_HAS_GYROSCOPE              = 1 << 8,
+	PROP_HAS_HINGE                  = 1 << 9,
+	PROP_HINGE_ANGLE                = 1 << 10,
 } PropertiesMask;
 
 #define PROP_ALL (PROP_HAS_ACCELEROMETER | \
@@ -180,9 +209,12 @@ typedef enum {
                   PROP_HAS_AMBIENT_LIGHT | \
                   PROP_LIGHT_LEVEL | \
                   PROP_HAS_PROXIMITY | \
-		  PROP_PROXIMITY_NEAR)
+		  PROP_PROXIMITY_NEAR | \
+		  PROP_HAS_HINGE | \
+		  PROP_HINGE_ANGLE)
 #define PROP_ALL_COMPASS (PROP_HAS_COMPASS | \
 			  PROP_COMPASS_HEADING)
+#define PROP_ALL_GYROSCOPE (PROP_HAS_GYROSCOPE)
 
 static void
 send_dbus_event (SensorData     *data,
@@ -190,13 +222,26 @@ send_dbus_event (SensorData     *data,
 {
 	GVariantBuilder props_builder;
 	GVariant *props_changed = NULL;
+	const char *iface, *path;
 
 	g_assert (data->connection);
 
 	if (mask == 0)
 		return;
 
-	g_assert ((mask & PROP_ALL) == 0 || (mask & PROP_ALL_COMPASS) == 0);
+	/* Each object's properties are sent separately */
+	if (mask & PROP_ALL) {
+		g_assert ((mask & (PROP_ALL_COMPASS | PROP_ALL_GYROSCOPE)) == 0);
+		iface = SENSOR_PROXY_IFACE_NAME;
+		path = SENSOR_PROXY_DBUS_PATH;
+	} else if (mask & PROP_ALL_COMPASS) {
+		g_assert ((mask & PROP_ALL_GYROSCOPE) == 0);
+		iface = SENSOR_PROXY_COMPASS_IFACE_NAME;
+		path = SENSOR_PROXY_COMPASS_DBUS_PATH;
+	} else {
+		iface = SENSOR_PROXY_GYRO_IFACE_NAME;
+		path = SENSOR_PROXY_GYRO_DBUS_PATH;
+	}
 
 	g_variant_builder_init (&props_builder, G_VARIANT_TYPE ("a{sv}"));
 
@@ -272,13 +317,37 @@ send_dbus_event (SensorData     *data,
 				       g_variant_new_boolean (data->previous_prox_near));
 	}
 
-	props_changed = g_variant_new ("(s@a{sv}@as)", (mask & PROP_ALL) ? SENSOR_PROXY_IFACE_NAME : SENSOR_PROXY_COMPASS_IFACE_NAME,
+	if (mask & PROP_HAS_HINGE) {
+		gboolean has_hinge;
+
+		has_hinge = has_hinge_angle (data);
+		g_variant_builder_add (&props_builder, "{sv}", "HasHingeAngle",
+				       g_variant_new_boolean (has_hinge));
+
+		/* Send the angle when the devices appear */
+		if (has_hinge)
+			mask |= PROP_HINGE_ANGLE;
+	}
+
+	if (mask & PROP_HINGE_ANGLE) {
+		g_variant_builder_add (&props_builder, "{sv}", "HingeAngle",
+				       g_variant_new_double (data->hinge_angle));
+		g_variant_builder_add (&props_builder, "{sv}", "TabletMode",
+				       g_variant_new_boolean (data->tablet_mode));
+	}
+
+	if (mask & PROP_HAS_GYROSCOPE) {
+		g_variant_builder_add (&props_builder, "{sv}", "HasGyroscope",
+				       g_variant_new_boolean (driver_type_exists (data, DRIVER_TYPE_GYRO)));
+	}
+
+	props_changed = g_variant_new ("(s@a{sv}@as)", iface,
 				       g_variant_builder_end (&props_builder),
 				       g_variant_new_strv (NULL, 0));
 
 	g_dbus_connection_emit_signal (data->connection,
 				       NULL,
-				       (mask & PROP_ALL) ? SENSOR_PROXY_DBUS_PATH : SENSOR_PROXY_COMPASS_DBUS_PATH,
+				       path,
 				       "org.freedesktop.DBus.Properties",
 				       "PropertiesChanged",
 				       props_changed, NULL);
@@ -289,13 +358,17 @@ send_driver_changed_dbus_event (SensorData   *data,
 				DriverType    driver_type)
 {
 	if (driver_type == DRIVER_TYPE_ACCEL)
-		send_dbus_event (data, PROP_HAS_ACCELEROMETER);
+		send_dbus_event (data, PROP_HAS_ACCELEROMETER | PROP_HAS_HINGE);
+	else if (driver_type == DRIVER_TYPE_ACCEL_BASE)
+		send_dbus_event (data, PROP_HAS_HINGE);
 	else if (driver_type == DRIVER_TYPE_LIGHT)
 		send_dbus_event (data, PROP_HAS_AMBIENT_LIGHT);
 	else if (driver_type == DRIVER_TYPE_PROXIMITY)
 		send_dbus_event (data, PROP_HAS_PROXIMITY);
 	else if (driver_type == DRIVER_TYPE_COMPASS)
 		send_dbus_event (data, PROP_HAS_COMPASS);
+	else if (driver_type == DRIVER_TYPE_GYRO)
+		send_dbus_event (data, PROP_HAS_GYROSCOPE);
 	else
 		g_assert_not_reached ();
 }
@@ -307,7 +380,7 @@ any_sensors_left (SensorData *data)
 	gboolean exists = FALSE;
 
 	for (i = 0; i < NUM_SENSOR_TYPES; i++) {
-		if (driver_type_exists (data, i)) {
+		if (DRIVER_FOR_TYPE(i) != NULL || data->opening[i]) {
 			exists = TRUE;
 			break;
 		}
@@ -316,25 +389,206 @@ any_sensors_left (SensorData *data)
 	return exists;
 }
 
+static void
+reply_pending_claims (SensorData *data,
+		      DriverType  driver_type)
+{
+	GList *l;
+
+	g_clear_handle_id (&data->claim_timeout_id[driver_type], time_source_remove);
+
+	for (l = data->pending_claims[driver_type]; l != NULL; l = l->next)
+		g_dbus_method_invocation_return_value (l->data, NULL);
+	g_clear_pointer (&data->pending_claims[driver_type], g_list_free);
+}
+
+/* Called by drivers' callbacks once the properties reflect a reading */
+static void
+reading_published (SensorData *data,
+		   DriverType  driver_type)
+{
+	data->has_reading[driver_type] = TRUE;
+	reply_pending_claims (data, driver_type);
+}
+
+typedef struct {
+	SensorData *data;
+	DriverType  driver_type;
+} SensorTimeout;
+
+static gboolean
+claim_timeout_cb (gpointer user_data)
+{
+	SensorTimeout *timeout = user_data;
+
+	g_debug ("No reading from %s sensor in time, replying to claims anyway",
+		 driver_type_to_str (timeout->driver_type));
+	timeout->data->claim_timeout_id[timeout->driver_type] = 0;
+	reply_pending_claims (timeout->data, timeout->driver_type);
+	return G_SOURCE_REMOVE;
+}
+
+/* The hinge angle is used to tell closed from folded back when
+ * readings resume, so it can't outlive either accelerometer's */
+static void
+forget_gravity (SensorData *data,
+		DriverType  driver_type)
+{
+	if (driver_type == DRIVER_TYPE_ACCEL)
+		data->has_gravity = FALSE;
+	else if (driver_type == DRIVER_TYPE_ACCEL_BASE)
+		data->has_base_gravity = FALSE;
+	else
+		return;
+
+	data->hinge_angle = HINGE_ANGLE_UNKNOWN;
+	data->tablet_mode = FALSE;
+}
+
+static gboolean
+standby_timeout_cb (gpointer user_data)
+{
+	SensorTimeout *timeout = user_data;
+	SensorData *data = timeout->data;
+
+	g_debug ("Stopping %s sensor after warm standby",
+		 driver_type_to_str (timeout->driver_type));
+	data->standby_id[timeout->driver_type] = 0;
+	data->has_reading[timeout->driver_type] = FALSE;
+	forget_gravity (data, timeout->driver_type);
+	driver_set_polling (DRIVER_FOR_TYPE(timeout->driver_type), FALSE);
+	return G_SOURCE_REMOVE;
+}
+
+static guint
+add_sensor_timeout (SensorData  *data,
+		    DriverType   driver_type,
+		    guint        interval,
+		    GSourceFunc  func,
+		    const char  *name)
+{
+	SensorTimeout *timeout;
+	guint id;
+
+	timeout = g_new0 (SensorTimeout, 1);
+	timeout->data = data;
+	timeout->driver_type = driver_type;
+	id = time_source_timeout_add_full (interval, func, timeout, g_free);
+	time_source_set_name (id, name);
+	return id;
+}
+
+static void update_fusion (SensorData *data);
+static void update_hinge (SensorData *data);
+
+static void
+client_claim (SensorData *data,
+	      const char *sender,
+	      DriverType  driver_type,
+	      guint       watch_id)
+{
+	GHashTable *ht;
+
+	ht = data->clients[driver_type];
+
+	/* No other clients for this sensor? Start it, unless
+	 * it's still running in warm standby */
+	if (driver_type_exists (data, driver_type) &&
+	    g_hash_table_size (ht) == 0) {
+		if (data->standby_id[driver_type] != 0) {
+			g_clear_handle_id (&data->standby_id[driver_type], time_source_remove);
+		} else {
+			data->has_reading[driver_type] = FALSE;
+			driver_set_polling (DRIVER_FOR_TYPE(driver_type), TRUE);
+		}
+	}
+
+	g_hash_table_insert (ht, g_strdup (sender), GUINT_TO_POINTER (watch_id));
+
+	if (driver_type == DRIVER_TYPE_COMPASS)
+		update_fusion (data);
+	else if (driver_type == DRIVER_TYPE_ACCEL_BASE)
+		update_hinge (data);
+}
+
 static void
 client_release (SensorData            *data,
 		const char            *sender,
 		DriverType             driver_type)
 {
 	GHashTable *ht;
-	guint watch_id;
 
 	ht = data->clients[driver_type];
 
-	watch_id = GPOINTER_TO_UINT (g_hash_table_lookup (ht, sender));
-	if (watch_id == 0)
+	if (!g_hash_table_remove (ht, sender))
 		return;
 
-	g_hash_table_remove (ht, sender);
-
+	/* Keep the sensor running for a little while, in case
+	 * a client claims it again soon */
 	if (driver_type_exists (data, driver_type) &&
-	    g_hash_table_size (ht) == 0)
-		driver_set_polling (DRIVER_FOR_TYPE(driver_type), FALSE);
+	    g_hash_table_size (ht) == 0) {
+		g_assert (data->standby_id[driver_type] == 0);
+		data->standby_id[driver_type] = add_sensor_timeout (data, driver_type,
+								    WARM_STANDBY_TIMEOUT,
+								    standby_timeout_cb,
+								    "[client_release] standby_timeout_cb");
+	}
+
+	if (driver_type == DRIVER_TYPE_COMPASS)
+		update_fusion (data);
+	else if (driver_type == DRIVER_TYPE_ACCEL_BASE)
+		update_hinge (data);
+}
+
+/* Magnetometers that only give us the raw field need the accelerometer
+ * running to compensate for the tilt, for as long as the compass is used */
+static void
+update_fusion (SensorData *data)
+{
+	gboolean needed;
+
+	needed = driver_type_exists (data, DRIVER_TYPE_COMPASS) &&
+		 DRIVER_FOR_TYPE(DRIVER_TYPE_COMPASS)->specific_type == DRIVER_TYPE_COMPASS_IIO_UNCALIBRATED &&
+		 g_hash_table_size (data->clients[DRIVER_TYPE_COMPASS]) > 0;
+
+	if (needed == g_hash_table_contains (data->clients[DRIVER_TYPE_ACCEL], FUSION_CLIENT))
+		return;
+
+	g_debug ("%s accelerometer for compass tilt compensation",
+		 needed ? "Claiming" : "Releasing");
+	if (needed)
+		client_claim (data, FUSION_CLIENT, DRIVER_TYPE_ACCEL, 0);
+	else
+		client_release (data, FUSION_CLIENT, DRIVER_TYPE_ACCEL);
+}
+
+/* Clients claim the hinge angle through the base accelerometer, and the
+ * display one is kept running along with it, for as long as it's claimed */
+static void
+update_hinge (SensorData *data)
+{
+	gboolean needed;
+
+	needed = has_hinge_angle (data) &&
+		 g_hash_table_size (data->clients[DRIVER_TYPE_ACCEL_BASE]) > 0;
+
+	if (needed == g_hash_table_contains (data->clients[DRIVER_TYPE_ACCEL], HINGE_CLIENT))
+		return;
+
+	g_debug ("%s accelerometer for the hinge angle",
+		 needed ? "Claiming" : "Releasing");
+	if (needed)
+		client_claim (data, HINGE_CLIENT, DRIVER_TYPE_ACCEL, 0);
+	else
+		client_release (data, HINGE_CLIENT, DRIVER_TYPE_ACCEL);
+}
+
+/* For the sensors that others depend on */
+static void
+update_internal_clients (SensorData *data)
+{
+	update_fusion (data);
+	update_hinge (data);
 }
 
 static void
@@ -352,15 +606,8 @@ client_vanished_cb (GDBusConnection *connection,
 	sender = g_strdup (name);
 
 	for (i = 0; i < NUM_SENSOR_TYPES; i++) {
-		GHashTable *ht;
-		guint watch_id;
-
-		ht = data->clients[i];
-		g_assert (ht);
-
-		watch_id = GPOINTER_TO_UINT (g_hash_table_lookup (ht, sender));
-		if (watch_id > 0)
-			client_release (data, sender, i);
+		g_assert (data->clients[i]);
+		client_release (data, sender, i);
 	}
 
 	g_free (sender);
@@ -385,25 +632,31 @@ handle_generic_method_call (SensorData            *data,
 	ht = data->clients[driver_type];
 
 	if (g_str_has_prefix (method_name, "Claim")) {
-		watch_id = GPOINTER_TO_UINT (g_hash_table_lookup (ht, sender));
-		if (watch_id > 0) {
-			g_dbus_method_invocation_return_value (invocation, NULL);
-			return;
+		if (!g_hash_table_contains (ht, sender)) {
+			watch_id = g_bus_watch_name_on_connection (data->connection,
+								   sender,
+								   G_BUS_NAME_WATCHER_FLAGS_NONE,
+								   NULL,
+								   client_vanished_cb,
+								   data,
+								   NULL);
+			client_claim (data, sender, driver_type, watch_id);
 		}
 
-		/* No other clients for this sensor? Start it */
-		if (driver_type_exists (data, driver_type) &&
-		    g_hash_table_size (ht) == 0)
-			driver_set_polling (DRIVER_FOR_TYPE(driver_type), TRUE);
-
-		watch_id = g_bus_watch_name_on_connection (data->connection,
-							   sender,
-							   G_BUS_NAME_WATCHER_FLAGS_NONE,
-							   NULL,
-							   client_vanished_cb,
-							   data,
-							   NULL);
-		g_hash_table_insert (ht, g_strdup (sender), GUINT_TO_POINTER (watch_id));
+		/* Drivers send a reading as soon as they're started, hold
+		 * the reply until they do for clients that asked for it */
+		if (g_str_has_suffix (method_name, "WithReading") &&
+		    driver_type_exists (data, driver_type) &&
+		    !data->has_reading[driver_type]) {
+			data->pending_claims[driver_type] = g_list_prepend (data->pending_claims[driver_type],
+									    invocation);
+			if (data->claim_timeout_id[driver_type] == 0)
+				data->claim_timeout_id[driver_type] = add_sensor_timeout (data, driver_type,
+											  CLAIM_REPLY_TIMEOUT,
+											  claim_timeout_cb,
+											  "[handle_generic_method_call] claim_timeout_cb");
+			return;
+		}
 
 		g_dbus_method_invocation_return_value (invocation, NULL);
 	} else if (g_str_has_prefix (method_name, "Release")) {
@@ -426,14 +679,21 @@ handle_method_call (GDBusConnection       *connection,
 	DriverType driver_type;
 
 	if (g_strcmp0 (method_name, "ClaimAccelerometer") == 0 ||
+	    g_strcmp0 (method_name, "ClaimAccelerometerWithReading") == 0 ||
 	    g_strcmp0 (method_name, "ReleaseAccelerometer") == 0)
 		driver_type = DRIVER_TYPE_ACCEL;
 	else if (g_strcmp0 (method_name, "ClaimLight") == 0 ||
+		 g_strcmp0 (method_name, "ClaimLightWithReading") == 0 ||
 		 g_strcmp0 (method_name, "ReleaseLight") == 0)
 		driver_type = DRIVER_TYPE_LIGHT;
 	else if (g_strcmp0 (method_name, "ClaimProximity") == 0 ||
+		 g_strcmp0 (method_name, "ClaimProximityWithReading") == 0 ||
 		 g_strcmp0 (method_name, "ReleaseProximity") == 0)
 	        driver_type = DRIVER_TYPE_PROXIMITY;
+	else if (g_strcmp0 (method_name, "ClaimHingeAngle") == 0 ||
+		 g_strcmp0 (method_name, "ClaimHingeAngleWithReading") == 0 ||
+		 g_strcmp0 (method_name, "ReleaseHingeAngle") == 0)
+		driver_type = DRIVER_TYPE_ACCEL_BASE;
 	else {
 		g_dbus_method_invocation_return_error (invocation,
 						       G_DBUS_ERROR,
@@ -475,6 +735,12 @@ handle_get_property (GDBusConnection *connection,
 		return g_variant_new_boolean (driver_type_exists (data, DRIVER_TYPE_PROXIMITY));
 	if (g_strcmp0 (property_name, "ProximityNear") == 0)
 		return g_variant_new_boolean (data->previous_prox_near);
+	if (g_strcmp0 (property_name, "HasHingeAngle") == 0)
+		return g_variant_new_boolean (has_hinge_angle (data));
+	if (g_strcmp0 (property_name, "HingeAngle") == 0)
+		return g_variant_new_double (data->hinge_angle);
+	if (g_strcmp0 (property_name, "TabletMode") == 0)
+		return g_variant_new_boolean (data->tablet_mode);
 
 	return NULL;
 }
@@ -499,6 +765,7 @@ handle_compass_method_call (GDBusConnection       *connection,
 	SensorData *data = user_data;
 
 	if (g_strcmp0 (method_name, "ClaimCompass") != 0 &&
+	    g_strcmp0 (method_name, "ClaimCompassWithReading") != 0 &&
 	    g_strcmp0 (method_name, "ReleaseCompass") != 0) {
 		g_dbus_method_invocation_return_error (invocation,
 						       G_DBUS_ERROR,
@@ -527,7 +794,7 @@ handle_compass_get_property (GDBusConnection *connection,
 	g_assert (data->connection);
 
 	if (g_strcmp0 (property_name, "HasCompass") == 0)
-		return g_variant_new_boolean (data->drivers[DRIVER_TYPE_COMPASS] != NULL);
+		return g_variant_new_boolean (driver_type_exists (data, DRIVER_TYPE_COMPASS));
 	if (g_strcmp0 (property_name, "CompassHeading") == 0)
 		return g_variant_new_double (data->previous_heading);
 
@@ -541,6 +808,59 @@ static const GDBusInterfaceVTable compass_interface_vtable =
 	NULL
 };
 
+static void
+handle_gyro_method_call (GDBusConnection       *connection,
+			 const gchar           *sender,
+			 const gchar           *object_path,
+			 const gchar           *interface_name,
+			 const gchar           *method_name,
+			 GVariant              *parameters,
+			 GDBusMethodInvocation *invocation,
+			 gpointer               user_data)
+{
+	SensorData *data = user_data;
+
+	if (g_strcmp0 (method_name, "ClaimGyroscope") != 0 &&
+	    g_strcmp0 (method_name, "ReleaseGyroscope") != 0) {
+		g_dbus_method_invocation_return_error (invocation,
+						       G_DBUS_ERROR,
+						       G_DBUS_ERROR_UNKNOWN_METHOD,
+						       "Method '%s' does not exist on object %s",
+						       method_name, object_path);
+		return;
+	}
+
+	handle_generic_method_call (data, sender, object_path,
+				    interface_name, method_name,
+				    parameters, invocation, DRIVER_TYPE_GYRO);
+}
+
+static GVariant *
+handle_gyro_get_property (GDBusConnection *connection,
+			  const gchar     *sender,
+			  const gchar     *object_path,
+			  const gchar     *interface_name,
+			  const gchar     *property_name,
+			  GError         **error,
+			  gpointer         user_data)
+{
+	SensorData *data = user_data;
+
+	g_assert (data->connection);
+
+	if (g_strcmp0 (property_name, "HasGyroscope") == 0)
+		return g_variant_new_boolean (driver_type_exists (data, DRIVER_TYPE_GYRO));
+
+	return NULL;
+}
+
+static const GDBusInterfaceVTable gyro_interface_vtable =
+{
+	handle_gyro_method_call,
+	handle_gyro_get_property,
+	NULL
+};
+
 static void
 name_lost_handler (GDBusConnection *connection,
 		   const gchar     *name,
@@ -573,9 +893,136 @@ bus_acquired_handler (GDBusConnection *connection,
 					   NULL,
 					   NULL);
 
+	g_dbus_connection_register_object (connection,
+					   SENSOR_PROXY_GYRO_DBUS_PATH,
+					   data->introspection_data->interfaces[2],
+					   &gyro_interface_vtable,
+					   data,
+					   NULL,
+					   NULL);
+
 	data->connection = g_object_ref (connection);
 }
 
+typedef struct {
+	SensorData   *data;
+	SensorDriver *driver;
+	GUdevDevice  *device;
+} OpenRequest;
+
+static void start_driver_open (SensorData *data, DriverType type);
+
+static gboolean
+same_device (GUdevDevice *a,
+	     GUdevDevice *b)
+{
+	if (!a || !b)
+		return FALSE;
+	return g_strcmp0 (g_udev_device_get_sysfs_path (a), g_udev_device_get_sysfs_path (b)) == 0;
+}
+
+/* The next driver of the same type that can handle @device, after
+ * @driver discovered it, but failed to open it */
+static SensorDriver *
+find_fallback_driver (SensorDriver *driver,
+		      GUdevDevice  *device)
+{
+	gboolean after = FALSE;
+	guint i;
+
+	for (i = 0; drivers[i] != NULL; i++) {
+		SensorDriver *fallback = (SensorDriver *) drivers[i];
+
+		if (fallback == driver) {
+			after = TRUE;
+			continue;
+		}
+		if (after &&
+		    fallback->type == driver->type &&
+		    driver_discover (fallback, device))
+			return fallback;
+	}
+
+	return NULL;
+}
+
+static void
+driver_opened (GObject      *source_object,
+	       GAsyncResult *res,
+	       gpointer      user_data)
+{
+	OpenRequest *req = user_data;
+	SensorData *data = req->data;
+	DriverType type = req->driver->type;
+	SensorDriver *fallback = NULL;
+	gboolean opened;
+	guint i;
+
+	opened = driver_open_finish (res);
+	data->opening[type] = FALSE;
+
+	if (DEVICE_FOR_TYPE(type) != req->device) {
+		g_debug ("Sensor type %s got removed while opening",
+			 driver_type_to_str (type));
+		if (opened)
+			driver_close (req->driver);
+	} else if (!opened &&
+		   (fallback = find_fallback_driver (req->driver, req->device)) != NULL) {
+		g_debug ("Could not open %s at %s, trying %s", req->driver->name,
+			 g_udev_device_get_sysfs_path (req->device), fallback->name);
+		DRIVER_FOR_TYPE(type) = fallback;
+		data->opening[type] = TRUE;
+		start_driver_open (data, type);
+	} else if (!opened) {
+		DRIVER_FOR_TYPE(type) = NULL;
+		g_clear_object (&DEVICE_FOR_TYPE(type));
+	} else {
+		g_debug ("Opened %s at %s", req->driver->name,
+			 g_udev_device_get_sysfs_path (req->device));
+		send_driver_changed_dbus_event (data, type);
+
+		/* Clients claimed the sensor while it was opening */
+		if (g_hash_table_size (data->clients[type]) > 0)
+			driver_set_polling (DRIVER_FOR_TYPE(type), TRUE);
+		update_internal_clients (data);
+	}
+
+	/* Now open the next driver for the same device */
+	for (i = 0; i < NUM_SENSOR_TYPES && fallback == NULL; i++) {
+		if (data->open_queued[i] && same_device (DEVICE_FOR_TYPE(i), req->device)) {
+			start_driver_open (data, i);
+			break;
+		}
+	}
+
+	g_object_unref (req->device);
+	g_free (req);
+
+	if (!any_sensors_left (data)) {
+		data->ret = 0;
+		g_debug ("No sensors or missing kernel drivers for the sensors");
+		g_main_loop_quit (data->loop);
+	}
+}
+
+static void
+start_driver_open (SensorData *data,
+		   DriverType  type)
+{
+	OpenRequest *req;
+
+	data->open_queued[type] = FALSE;
+
+	req = g_new0 (OpenRequest, 1);
+	req->data = data;
+	req->driver = DRIVER_FOR_TYPE(type);
+	req->device = g_object_ref (DEVICE_FOR_TYPE(type));
+
+	driver_open_async (req->driver, req->device,
+			   driver_type_to_callback_func (req->driver->type), data,
+			   driver_opened, req);
+}
+
 static void
 name_acquired_handler (GDBusConnection *connection,
 		       const gchar     *name,
@@ -586,7 +1033,9 @@ name_acquired_handler (GDBusConnection *connection,
 	guint i;
 
 	data->client = g_udev_client_new (subsystems);
-	if (!find_sensors (data->client, data))
+	data->index = device_index_new (data->client, subsystems);
+	device_index_set_default (data->index);
+	if (!find_sensors (data->index, data))
 		goto bail;
 
 	g_signal_connect (G_OBJECT (data->client), "uevent",
@@ -595,21 +1044,31 @@ name_acquired_handler (GDBusConnection *connection,
 	for (i = 0; i < NUM_SENSOR_TYPES; i++) {
 		data->clients[i] = create_clients_hash_table ();
 
-		if (!driver_type_exists (data, i))
+		if (DRIVER_FOR_TYPE(i) != NULL) {
+			data->opening[i] = TRUE;
+			data->open_queued[i] = TRUE;
+		}
+	}
+
+	/* Open all the sensors in parallel, and publish each one as soon
+	 * as it's ready, except for drivers sharing a device, which are
+	 * opened one after the other */
+	for (i = 0; i < NUM_SENSOR_TYPES; i++) {
+		gboolean shared = FALSE;
+		guint j;
+
+		if (!data->open_queued[i])
 			continue;
 
-		if (!driver_open (DRIVER_FOR_TYPE(i), DEVICE_FOR_TYPE(i),
-				  driver_type_to_callback_func (data->drivers[i]->type), data)) {
-			DRIVER_FOR_TYPE(i) = NULL;
-			g_clear_object (&DEVICE_FOR_TYPE(i));
+		for (j = 0; j < i; j++) {
+			if (data->opening[j] && same_device (DEVICE_FOR_TYPE(i), DEVICE_FOR_TYPE(j)))
+				shared = TRUE;
 		}
-	}
 
-	if (!any_sensors_left (data))
-		goto bail;
+		if (!shared)
+			start_driver_open (data, i);
+	}
 
-	send_dbus_event (data, PROP_ALL);
-	send_dbus_event (data, PROP_ALL_COMPASS);
 	return;
 
 bail:
@@ -642,6 +1101,35 @@ setup_dbus (SensorData *data)
 	return TRUE;
 }
 
+/* Only done while the hinge angle is claimed, with both readings */
+static void
+update_hinge_angle (SensorData *data)
+{
+	gdouble angle;
+	gboolean tablet_mode;
+
+	if (g_hash_table_size (data->clients[DRIVER_TYPE_ACCEL_BASE]) == 0 ||
+	    !data->has_gravity || !data->has_base_gravity)
+		return;
+
+	if (!hinge_angle_calc (data->gravity, data->base_gravity, data->hinge_angle, &angle))
+		return;
+
+	tablet_mode = hinge_tablet_mode (data->tablet_mode, angle);
+	if (data->hinge_angle != angle || data->tablet_mode != tablet_mode) {
+		gdouble tmp;
+
+		tmp = data->hinge_angle;
+		data->hinge_angle = angle;
+		data->tablet_mode = tablet_mode;
+		send_dbus_event (data, PROP_HINGE_ANGLE);
+		g_debug ("Emitted hinge angle changed: from %lf to %lf (tablet mode: %d)",
+			 tmp, data->hinge_angle, data->tablet_mode);
+	}
+
+	reading_published (data, DRIVER_TYPE_ACCEL_BASE);
+}
+
 static void
 accel_changed_func (SensorDriver *driver,
 		    gpointer      readings_data,
@@ -652,13 +1140,16 @@ accel_changed_func (SensorDriver *driver,
 	OrientationUp orientation = data->previous_orientation;
 
 	//FIXME handle errors
-	g_debug ("Accel sent by driver (quirk applied): %d, %d, %d (scale: %lf,%lf,%lf)",
-		 readings->accel_x, readings->accel_y, readings->accel_z,
-		 readings->scale.x, readings->scale.y, readings->scale.z);
+	g_debug ("Accel sent by driver (quirk applied): %lf, %lf, %lf m/s²",
+		 readings->accel_x, readings->accel_y, readings->accel_z);
+
+	data->gravity[0] = readings->accel_x;
+	data->gravity[1] = readings->accel_y;
+	data->gravity[2] = readings->accel_z;
+	data->has_gravity = TRUE;
 
 	orientation = orientation_calc (data->previous_orientation,
-					readings->accel_x, readings->accel_y, readings->accel_z,
-					readings->scale);
+					readings->accel_x, readings->accel_y, readings->accel_z);
 
 	if (data->previous_orientation != orientation) {
 		OrientationUp tmp;
@@ -670,6 +1161,29 @@ accel_changed_func (SensorDriver *driver,
 			 orientation_to_string (tmp),
 			 orientation_to_string (data->previous_orientation));
 	}
+
+	reading_published (data, DRIVER_TYPE_ACCEL);
+	update_hinge_angle (data);
+}
+
+static void
+accel_base_changed_func (SensorDriver *driver,
+			 gpointer      readings_data,
+			 gpointer      user_data)
+{
+	SensorData *data = user_data;
+	AccelReadings *readings = (AccelReadings *) readings_data;
+
+	//FIXME handle errors
+	g_debug ("Base accel sent by driver (quirk applied): %lf, %lf, %lf m/s²",
+		 readings->accel_x, readings->accel_y, readings->accel_z);
+
+	data->base_gravity[0] = readings->accel_x;
+	data->base_gravity[1] = readings->accel_y;
+	data->base_gravity[2] = readings->accel_z;
+	data->has_base_gravity = TRUE;
+
+	update_hinge_angle (data);
 }
 
 static void
@@ -697,6 +1211,8 @@ light_changed_func (SensorDriver *driver,
 		g_debug ("Emitted light changed: from %lf to %lf",
 			 tmp, data->previous_level);
 	}
+
+	reading_published (data, DRIVER_TYPE_LIGHT);
 }
 
 static void
@@ -706,21 +1222,39 @@ compass_changed_func (SensorDriver *driver,
 {
 	SensorData *data = user_data;
 	CompassReadings *readings = (CompassReadings *) readings_data;
+	gdouble heading;
 
 	//FIXME handle errors
 	g_debug ("Heading sent by driver (quirk applied): %lf degrees",
 	         readings->heading);
 
-	if (data->previous_heading != readings->heading) {
+	/* Use the accelerometer reading taken along with the magnetometer's,
+	 * when they're read together, or the latest one otherwise */
+	heading = readings->heading;
+	if (readings->has_field && (readings->has_gravity || data->has_gravity)) {
+		double field[3] = { readings->field_x, readings->field_y, readings->field_z };
+		double gravity[3] = { readings->gravity_x, readings->gravity_y, readings->gravity_z };
+
+		if (!readings->has_gravity)
+			memcpy (gravity, data->gravity, sizeof (gravity));
+		if (compass_fusion_get_heading (gravity, field, &heading))
+			g_debug ("Tilt-compensated heading: %lf degrees", heading);
+		else
+			heading = readings->heading;
+	}
+
+	if (data->previous_heading != heading) {
 		gdouble tmp;
 
 		tmp = data->previous_heading;
-		data->previous_heading = readings->heading;
+		data->previous_heading = heading;
 
 		send_dbus_event (data, PROP_COMPASS_HEADING);
 		g_debug ("Emitted heading changed: from %lf to %lf",
 			 tmp, data->previous_heading);
 	}
+
+	reading_published (data, DRIVER_TYPE_COMPASS);
 }
 
 static void
@@ -747,6 +1281,48 @@ proximity_changed_func (SensorDriver *driver,
 		g_debug ("Emitted proximity changed: from %d to %d",
 			 tmp, near);
 	}
+
+	reading_published (data, DRIVER_TYPE_PROXIMITY);
+}
+
+/* Samples are only sent to the clients that claimed the gyroscope,
+ * in a single signal for each batch the driver read */
+static void
+gyro_changed_func (SensorDriver *driver,
+		   gpointer      readings_data,
+		   gpointer      user_data)
+{
+	SensorData *data = user_data;
+	GyroReadings *readings = (GyroReadings *) readings_data;
+	GVariantBuilder builder;
+	GVariant *samples;
+	GHashTableIter iter;
+	const char *client;
+	guint i;
+
+	g_debug ("%u gyroscope samples sent by driver", readings->n_samples);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xddd)"));
+	for (i = 0; i < readings->n_samples; i++) {
+		const GyroSample *sample = &readings->samples[i];
+
+		g_variant_builder_add (&builder, "(xddd)",
+				       sample->timestamp, sample->x, sample->y, sample->z);
+	}
+	samples = g_variant_ref_sink (g_variant_new ("(@a(xddd))", g_variant_builder_end (&builder)));
+
+	g_hash_table_iter_init (&iter, data->clients[DRIVER_TYPE_GYRO]);
+	while (g_hash_table_iter_next (&iter, (gpointer *) &client, NULL)) {
+		g_dbus_connection_emit_signal (data->connection,
+					       client,
+					       SENSOR_PROXY_GYRO_DBUS_PATH,
+					       SENSOR_PROXY_GYRO_IFACE_NAME,
+					       "Samples",
+					       samples, NULL);
+	}
+	g_variant_unref (samples);
+
+	reading_published (data, DRIVER_TYPE_GYRO);
 }
 
 static ReadingsUpdateFunc
@@ -761,6 +1337,10 @@ driver_type_to_callback_func (DriverType type)
 		return compass_changed_func;
 	case DRIVER_TYPE_PROXIMITY:
 		return proximity_changed_func;
+	case DRIVER_TYPE_GYRO:
+		return gyro_changed_func;
+	case DRIVER_TYPE_ACCEL_BASE:
+		return accel_base_changed_func;
 	default:
 		g_assert_not_reached ();
 	}
@@ -780,6 +1360,8 @@ free_sensor_data (SensorData *data)
 	}
 
 	for (i = 0; i < NUM_SENSOR_TYPES; i++) {
+		g_clear_handle_id (&data->standby_id[i], time_source_remove);
+		reply_pending_claims (data, i);
 		if (driver_type_exists (data, i))
 			driver_close (DRIVER_FOR_TYPE(i));
 		g_clear_object (&DEVICE_FOR_TYPE(i));
@@ -788,6 +1370,7 @@ free_sensor_data (SensorData *data)
 
 	g_clear_pointer (&data->introspection_data, g_dbus_node_info_unref);
 	g_clear_object (&data->connection);
+	g_clear_pointer (&data->index, device_index_free);
 	g_clear_object (&data->client);
 	g_clear_pointer (&data->loop, g_main_loop_unref);
 	g_free (data);
@@ -819,38 +1402,57 @@ sensor_changes (GUdevClient *client,
 				g_clear_object (&DEVICE_FOR_TYPE(i));
 				DRIVER_FOR_TYPE(i) = NULL;
 
+				/* Never started opening */
+				if (data->open_queued[i]) {
+					data->open_queued[i] = FALSE;
+					data->opening[i] = FALSE;
+				}
+
+				g_clear_handle_id (&data->standby_id[i], time_source_remove);
+				data->has_reading[i] = FALSE;
+				forget_gravity (data, i);
+				reply_pending_claims (data, i);
+
 				g_clear_pointer (&data->clients[i], g_hash_table_unref);
 				data->clients[i] = create_clients_hash_table ();
 
 				send_driver_changed_dbus_event (data, i);
 			}
 		}
+		update_internal_clients (data);
+
+		device_index_remove (data->index, device);
 
 		if (!any_sensors_left (data))
 			g_main_loop_quit (data->loop);
 	} else if (g_strcmp0 (action, "add") == 0) {
-		for (i = 0; i < G_N_ELEMENTS(drivers); i++) {
+		device_index_add (data->index, device);
+
+		for (i = 0; drivers[i] != NULL; i++) {
 			SensorDriver *driver = (SensorDriver *) drivers[i];
-			if (!driver_type_exists (data, driver->type) &&
+			if (DRIVER_FOR_TYPE(driver->type) == NULL &&
+			    !data->opening[driver->type] &&
 			    driver_discover (driver, device)) {
 				g_debug ("Found hotplugged device %s of type %s at %s",
 					 g_udev_device_get_sysfs_path (device),
 					 driver_type_to_str (driver->type),
 					 driver->name);
 
-				if (driver_open (driver, device,
-						 driver_type_to_callback_func (driver->type), data)) {
-					GHashTable *ht;
-
-					DEVICE_FOR_TYPE(driver->type) = g_object_ref (device);
-					DRIVER_FOR_TYPE(driver->type) = (SensorDriver *) driver;
-					send_driver_changed_dbus_event (data, driver->type);
+				/* Fall back to the next driver of the same type */
+				if (!driver_open (driver, device,
+						  driver_type_to_callback_func (driver->type), data)) {
+					g_debug ("Could not open %s at %s", driver->name,
+						 g_udev_device_get_sysfs_path (device));
+					continue;
+				}
 
-					ht = data->clients[driver->type];
+				DEVICE_FOR_TYPE(driver->type) = g_object_ref (device);
+				DRIVER_FOR_TYPE(driver->type) = (SensorDriver *) driver;
+				send_driver_changed_dbus_event (data, driver->type);
 
-					if (g_hash_table_size (ht) > 0)
-						driver_set_polling (DRIVER_FOR_TYPE(driver->type), TRUE);
-				}
+				if (g_hash_table_size (data->clients[driver->type]) > 0)
+					driver_set_polling (DRIVER_FOR_TYPE(driver->type), TRUE);
+				update_internal_clients (data);
 				break;
 			}
 		}
@@ -860,10 +1462,32 @@ sensor_changes (GUdevClient *client,
 int main (int argc, char **argv)
 {
 	SensorData *data;
+	g_autoptr(GOptionContext) option_context = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autofree char *record_traces = NULL;
+	g_autofree char *replay_trace = NULL;
+	gboolean replay_fast = FALSE;
 	int ret = 0;
+	const GOptionEntry options[] = {
+		{ "record-traces", 0, 0, G_OPTION_ARG_FILENAME, &record_traces, "Record traces of the sensors' raw values to DIRECTORY", "DIRECTORY" },
+		{ "replay-trace", 0, 0, G_OPTION_ARG_FILENAME, &replay_trace, "Replay an accelerometer trace as a sensor", "FILE" },
+		{ "replay-fast", 0, 0, G_OPTION_ARG_NONE, &replay_fast, "Replay the trace as fast as possible, instead of in real time", NULL },
+		{ NULL}
+	};
+
+	option_context = g_option_context_new ("");
+	g_option_context_add_main_entries (option_context, options, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+		g_warning ("Failed to parse arguments: %s", error->message);
+		return 1;
+	}
+
+	sensor_trace_set_record_directory (record_traces);
+	sensor_trace_set_replay (replay_trace, replay_fast);
 
 	data = g_new0 (SensorData, 1);
 	data->previous_orientation = ORIENTATION_UNDEFINED;
+	data->hinge_angle = HINGE_ANGLE_UNKNOWN;
 	data->uses_lux = TRUE;
 
 	/* Set up D-Bus */
@@ -67,6 +67,24 @@ properties_changed (GDBusProxy *proxy,
 		g_print ("    Proximity value changed: %d\n", g_variant_get_boolean (v));
 		g_variant_unref (v);
 	}
+	if (g_variant_dict_contains (&dict, "HasHingeAngle")) {
+		v = g_dbus_proxy_get_cached_property (iio_proxy, "HasHingeAngle");
+		if (g_variant_get_boolean (v))
+			g_print ("+++ Hinge angle appeared\n");
+		else
+			g_print ("--- Hinge angle disappeared\n");
+		g_variant_unref (v);
+	}
+	if (g_variant_dict_contains (&dict, "HingeAngle")) {
+		GVariant *tablet_mode;
+
+		v = g_dbus_proxy_get_cached_property (iio_proxy, "HingeAngle");
+		tablet_mode = g_dbus_proxy_get_cached_property (iio_proxy, "TabletMode");
+		g_print ("    Hinge angle changed: %lf (tablet mode: %d)\n", g_variant_get_double (v),
+			 g_variant_get_boolean (tablet_mode));
+		g_variant_unref (v);
+		g_variant_unref (tablet_mode);
+	}
 	if (g_variant_dict_contains (&dict, "HasCompass")) {
 		v = g_dbus_proxy_get_cached_property (iio_proxy_compass, "HasCompass");
 		if (g_variant_get_boolean (v))
@@ -127,6 +145,21 @@ print_initial_values (void)
 	}
 	g_variant_unref (v);
 
+	v = g_dbus_proxy_get_cached_property (iio_proxy, "HasHingeAngle");
+	if (v && g_variant_get_boolean (v)) {
+		GVariant *tablet_mode;
+
+		g_variant_unref (v);
+		v = g_dbus_proxy_get_cached_property (iio_proxy, "HingeAngle");
+		tablet_mode = g_dbus_proxy_get_cached_property (iio_proxy, "TabletMode");
+		g_print ("=== Has hinge angle (angle: %lf, tablet mode: %d)\n",
+			 g_variant_get_double (v), g_variant_get_boolean (tablet_mode));
+		g_variant_unref (tablet_mode);
+	} else {
+		g_print ("=== No hinge angle\n");
+	}
+	g_clear_pointer (&v, g_variant_unref);
+
 	if (!iio_proxy_compass)
 		return;
 
@@ -227,6 +260,21 @@ appeared_cb (GDBusConnection *connection,
 	}
 	g_clear_pointer (&ret, g_variant_unref);
 
+	/* Hinge angle */
+	ret = g_dbus_proxy_call_sync (iio_proxy,
+				      "ClaimHingeAngle",
+				      NULL,
+				      G_DBUS_CALL_FLAGS_NONE,
+				      -1,
+				      NULL, &error);
+	if (!ret) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to claim hinge angle: %s", error->message);
+		g_main_loop_quit (loop);
+		return;
+	}
+	g_clear_pointer (&ret, g_variant_unref);
+
 	/* Compass */
 	if (g_strcmp0 (g_get_user_name (), "geoclue") == 0) {
 		ret = g_dbus_proxy_call_sync (iio_proxy_compass,
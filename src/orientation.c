@@ -56,25 +56,16 @@ string_to_orientation (const char *orientation)
 #define THRESHOLD_LANDSCAPE  35
 #define THRESHOLD_PORTRAIT  35
 
-/* First apply scale to get m/s², then
- * convert to 1G ~= 256 as the code expects */
-#define SCALE(a) ((int) ((double) in_##a * scale.a * 256.0 / 9.81))
-
 OrientationUp
 orientation_calc (OrientationUp prev,
-                  int in_x, int in_y, int in_z,
-                  AccelScale scale)
+                  double x, double y, double z)
 {
         OrientationUp ret = prev;
-        int x, y, z;
         int portrait_rotation;
         int landscape_rotation;
 
-        /* this code expects 1G ~= 256 */
-        x = SCALE(x);
-        y = SCALE(y);
-        z = SCALE(z);
-
+        /* Only the angles matter, so the readings are used in m/s²
+         * as they are, rather than being converted to 1G ~= 256 */
         portrait_rotation  = round(atan2(x, sqrt(y * y + z * z)) * RADIANS_TO_DEGREES);
         landscape_rotation = round(atan2(y, sqrt(x * x + z * z)) * RADIANS_TO_DEGREES);
 
@@ -14,8 +14,6 @@
  *
  */
 
-#include "accel-scale.h"
-
 typedef enum {
         ORIENTATION_UNDEFINED,
         ORIENTATION_NORMAL,
@@ -29,8 +27,8 @@ typedef enum {
 const char    *orientation_to_string (OrientationUp o);
 OrientationUp  string_to_orientation (const char *orientation);
 
+/* x, y and z are corrected readings in m/s², see apply_accel_transform() */
 OrientationUp  orientation_calc      (OrientationUp prev,
-				      int           x,
-				      int           y,
-				      int           z,
-				      AccelScale    scale);
+				      double        x,
+				      double        y,
+				      double        z);
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include "proximity.h"
+
+gint
+get_proximity_near_level (GUdevDevice *device)
+{
+	gint near_level;
+
+	near_level = g_udev_device_get_property_as_int (device, PROXIMITY_NEAR_LEVEL);
+	if (!near_level)
+		near_level = g_udev_device_get_sysfs_attr_as_int (device, "in_proximity_nearlevel");
+
+	if (!near_level) {
+		g_warning ("Found proximity sensor but no " PROXIMITY_NEAR_LEVEL " udev property");
+		g_warning ("See https://gitlab.freedesktop.org/hadess/iio-sensor-proxy/blob/master/README.md");
+		return 0;
+	}
+
+	g_debug ("Near level: %d", near_level);
+	return near_level;
+}
+
+ProximityNear
+get_proximity_near (gint level,
+		    gint last_level,
+		    gint near_level)
+{
+	gdouble threshold = near_level;
+
+	threshold *= (last_level > near_level) ? PROXIMITY_WATER_MARK_LOW : PROXIMITY_WATER_MARK_HIGH;
+	return (level > threshold) ? PROXIMITY_NEAR_TRUE : PROXIMITY_NEAR_FALSE;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include "drivers.h"
+
+#define PROXIMITY_NEAR_LEVEL "PROXIMITY_NEAR_LEVEL"
+
+/* Use a margin around the near level so we don't trigger too often */
+#define PROXIMITY_WATER_MARK_LOW  0.9
+#define PROXIMITY_WATER_MARK_HIGH 1.1
+
+gint          get_proximity_near_level (GUdevDevice *device);
+ProximityNear get_proximity_near       (gint         level,
+					gint         last_level,
+					gint         near_level);
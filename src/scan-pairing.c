@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+/*
+ * Decides which scans of the sensors in a capture group were taken
+ * at the same time, see capture-group.c. Kept apart from reading the
+ * buffers, so that it can be tested without any hardware.
+ */
+
+#include "scan-pairing.h"
+
+/* Scans on the same trigger are in lockstep, so the most
+ * recent ones go together, and so on backwards */
+static guint
+match_lockstep (const guint *n_scans,
+		guint        n_members,
+		guint       *tuples)
+{
+	guint n_tuples = G_MAXUINT;
+	guint i, k;
+
+	for (i = 0; i < n_members; i++)
+		n_tuples = MIN (n_tuples, n_scans[i]);
+
+	for (k = 0; k < n_tuples; k++) {
+		for (i = 0; i < n_members; i++)
+			tuples[k * n_members + i] = n_scans[i] - n_tuples + k;
+	}
+
+	return n_tuples;
+}
+
+/* Each scan of the first member goes with the closest scan in time of
+ * every other member, if they're all close enough. Timestamps only
+ * ever go up, so the search carries on from the previous match */
+static guint
+match_timestamps (const guint          *n_scans,
+		  const gint64 * const *timestamps,
+		  guint                 n_members,
+		  gint64                max_skew,
+		  guint                *tuples)
+{
+	g_autofree guint *closest = NULL;
+	guint n_tuples = 0;
+	guint i, j;
+
+	closest = g_new0 (guint, n_members);
+
+	for (j = 0; j < n_scans[0]; j++) {
+		gint64 time = timestamps[0][j];
+		gboolean matched = TRUE;
+
+		for (i = 1; i < n_members; i++) {
+			const gint64 *member_timestamps = timestamps[i];
+
+			while (closest[i] + 1 < n_scans[i] &&
+			       ABS (member_timestamps[closest[i] + 1] - time) <= ABS (member_timestamps[closest[i]] - time))
+				closest[i]++;
+			if (ABS (member_timestamps[closest[i]] - time) > max_skew)
+				matched = FALSE;
+		}
+		if (!matched)
+			continue;
+
+		tuples[n_tuples * n_members] = j;
+		for (i = 1; i < n_members; i++)
+			tuples[n_tuples * n_members + i] = closest[i];
+		n_tuples++;
+	}
+
+	return n_tuples;
+}
+
+/**
+ * scan_pairing_match:
+ * @n_scans: the number of scans read from each member
+ * @timestamps: the time of each scan of each member, in the same unit as
+ *   @max_skew, or %NULL if the members don't all have timestamps
+ * @n_members: the number of members
+ * @lockstep: whether all the members sample on the same trigger
+ * @max_skew: how far apart scans from different triggers can be
+ * @tuples: (out): room for @n_members indices per scan of the first member,
+ *   filled with the index of each member's scan in each tuple, oldest first
+ * @aligned: (out): whether the scans in each tuple were taken at the
+ *   same time, rather than being the latest ones of each member
+ *
+ * Returns: the number of tuples
+ **/
+guint
+scan_pairing_match (const guint          *n_scans,
+		    const gint64 * const *timestamps,
+		    guint                 n_members,
+		    gboolean              lockstep,
+		    gint64                max_skew,
+		    guint                *tuples,
+		    gboolean             *aligned)
+{
+	guint n_tuples;
+	guint i;
+
+	*aligned = FALSE;
+	for (i = 0; i < n_members; i++) {
+		if (n_scans[i] == 0)
+			return 0;
+	}
+
+	if (lockstep) {
+		*aligned = TRUE;
+		return match_lockstep (n_scans, n_members, tuples);
+	}
+
+	if (timestamps != NULL) {
+		n_tuples = match_timestamps (n_scans, timestamps, n_members, max_skew, tuples);
+		if (n_tuples > 0) {
+			*aligned = TRUE;
+			return n_tuples;
+		}
+	}
+
+	/* Nothing better than the latest scan of each */
+	for (i = 0; i < n_members; i++)
+		tuples[i] = n_scans[i] - 1;
+	return 1;
+}
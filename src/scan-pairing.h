@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+guint scan_pairing_match (const guint          *n_scans,
+			  const gint64 * const *timestamps,
+			  guint                 n_members,
+			  gboolean              lockstep,
+			  gint64                max_skew,
+			  guint                *tuples,
+			  gboolean             *aligned);
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+/*
+ * Sensor traces are recordings of the raw channel values of a sensor,
+ * along with what's needed to turn them into readings, so that what
+ * a device saw can be replayed through the same code paths elsewhere.
+ *
+ * A trace file is a TraceHeader, in host byte order like the channel
+ * cache, then one record per scan: the time since the previous scan,
+ * in µs, then each channel's difference with its previous value, all
+ * of them zigzag-encoded varints. Sensors change slowly compared to
+ * their sampling rate, so most records fit in a handful of bytes.
+ */
+
+#include "sensor-trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_MAGIC     "IIOSPTR1"
+/* A 64-bit varint is at most 10 bytes */
+#define MAX_RECORD_SIZE ((1 + SENSOR_TRACE_MAX_CHANNELS) * 10)
+
+typedef struct {
+	char    magic[8];
+	guint8  type;
+	guint8  location;
+	guint8  n_channels;
+	guint8  reserved;
+	float   sampling_frequency;
+	char    channels[SENSOR_TRACE_MAX_CHANNELS][SENSOR_TRACE_CHANNEL_NAME_LEN];
+	double  scales[SENSOR_TRACE_MAX_CHANNELS];
+	float   mount_matrix[9];
+} TraceHeader;
+
+struct SensorTraceWriter {
+	FILE              *file;
+	char              *path;
+	guint              n_channels;
+	gint64             timestamp;
+	gint64             values[SENSOR_TRACE_MAX_CHANNELS];
+	guint64            n_samples;
+};
+
+struct SensorTraceReader {
+	GMappedFile       *mapped;
+	const guint8      *data;
+	gsize              len;
+	gsize              offset;
+	SensorTraceHeader  header;
+	gint64             timestamp;
+	gint64             values[SENSOR_TRACE_MAX_CHANNELS];
+};
+
+static char *record_directory = NULL;
+static char *replay_path = NULL;
+static gboolean replay_fast = FALSE;
+
+static guint
+put_varint (guint8 *buf,
+	    gint64  value)
+{
+	guint64 zigzag;
+	guint len = 0;
+
+	zigzag = ((guint64) value << 1) ^ (guint64) (value >> 63);
+	do {
+		buf[len] = zigzag & 0x7f;
+		zigzag >>= 7;
+		if (zigzag)
+			buf[len] |= 0x80;
+		len++;
+	} while (zigzag);
+
+	return len;
+}
+
+static gboolean
+get_varint (SensorTraceReader *reader,
+	    gint64            *value)
+{
+	guint64 zigzag = 0;
+	guint shift = 0;
+
+	while (reader->offset < reader->len && shift < 64) {
+		guint8 byte = reader->data[reader->offset++];
+
+		zigzag |= (guint64) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = (gint64) (zigzag >> 1) ^ -(gint64) (zigzag & 1);
+			return TRUE;
+		}
+		shift += 7;
+	}
+
+	return FALSE;
+}
+
+SensorTraceWriter *
+sensor_trace_writer_new (const char               *path,
+			 const SensorTraceHeader  *header,
+			 GError                  **error)
+{
+	SensorTraceWriter *writer;
+	TraceHeader file_header;
+	FILE *file;
+	guint i;
+
+	g_return_val_if_fail (header->n_channels <= SENSOR_TRACE_MAX_CHANNELS, NULL);
+
+	memset (&file_header, 0, sizeof (file_header));
+	memcpy (file_header.magic, TRACE_MAGIC, sizeof (file_header.magic));
+	file_header.type = header->type;
+	file_header.location = header->location;
+	file_header.n_channels = header->n_channels;
+	file_header.sampling_frequency = header->sampling_frequency;
+	for (i = 0; i < header->n_channels; i++) {
+		g_strlcpy (file_header.channels[i], header->channels[i], SENSOR_TRACE_CHANNEL_NAME_LEN);
+		file_header.scales[i] = header->scales[i];
+	}
+	for (i = 0; i < 3; i++) {
+		file_header.mount_matrix[i * 3] = header->mount_matrix[i].x;
+		file_header.mount_matrix[i * 3 + 1] = header->mount_matrix[i].y;
+		file_header.mount_matrix[i * 3 + 2] = header->mount_matrix[i].z;
+	}
+
+	file = fopen (path, "we");
+	if (!file) {
+		int errsv = errno;
+		g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+			     "Could not create trace %s: %s", path, g_strerror (errsv));
+		return NULL;
+	}
+
+	if (fwrite (&file_header, sizeof (file_header), 1, file) != 1) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "Could not write trace header to %s", path);
+		fclose (file);
+		return NULL;
+	}
+
+	writer = g_new0 (SensorTraceWriter, 1);
+	writer->file = file;
+	writer->path = g_strdup (path);
+	writer->n_channels = header->n_channels;
+
+	return writer;
+}
+
+/* Records are flushed after each batch, so that a trace is still
+ * usable if the daemon doesn't exit cleanly */
+void
+sensor_trace_writer_add (SensorTraceWriter *writer,
+			 const gint64      *timestamps,
+			 const int         *values,
+			 guint              n_samples)
+{
+	guint8 buf[MAX_RECORD_SIZE];
+	guint i, j;
+
+	for (i = 0; i < n_samples; i++) {
+		guint len;
+
+		len = put_varint (buf, timestamps[i] - writer->timestamp);
+		writer->timestamp = timestamps[i];
+		for (j = 0; j < writer->n_channels; j++) {
+			gint64 value = values[i * writer->n_channels + j];
+
+			len += put_varint (buf + len, value - writer->values[j]);
+			writer->values[j] = value;
+		}
+		fwrite (buf, 1, len, writer->file);
+	}
+
+	writer->n_samples += n_samples;
+	if (fflush (writer->file) != 0)
+		g_warning ("Could not write to trace %s: %s", writer->path, g_strerror (errno));
+}
+
+void
+sensor_trace_writer_free (SensorTraceWriter *writer)
+{
+	g_debug ("Recorded %" G_GUINT64_FORMAT " samples to %s", writer->n_samples, writer->path);
+	fclose (writer->file);
+	g_free (writer->path);
+	g_free (writer);
+}
+
+SensorTraceReader *
+sensor_trace_reader_new (const char  *path,
+			 GError     **error)
+{
+	SensorTraceReader *reader;
+	const TraceHeader *file_header;
+	GMappedFile *mapped;
+	guint i;
+
+	mapped = g_mapped_file_new (path, FALSE, error);
+	if (!mapped)
+		return NULL;
+
+	file_header = (const TraceHeader *) g_mapped_file_get_contents (mapped);
+	if (g_mapped_file_get_length (mapped) < sizeof (TraceHeader) ||
+	    memcmp (file_header->magic, TRACE_MAGIC, sizeof (file_header->magic)) != 0 ||
+	    file_header->n_channels == 0 ||
+	    file_header->n_channels > SENSOR_TRACE_MAX_CHANNELS ||
+	    file_header->type >= NUM_SENSOR_TYPES) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			     "%s is not a sensor trace", path);
+		g_mapped_file_unref (mapped);
+		return NULL;
+	}
+
+	reader = g_new0 (SensorTraceReader, 1);
+	reader->mapped = mapped;
+	reader->data = (const guint8 *) g_mapped_file_get_contents (mapped);
+	reader->len = g_mapped_file_get_length (mapped);
+
+	reader->header.type = file_header->type;
+	reader->header.location = file_header->location;
+	reader->header.n_channels = file_header->n_channels;
+	reader->header.sampling_frequency = file_header->sampling_frequency;
+	for (i = 0; i < file_header->n_channels; i++) {
+		memcpy (reader->header.channels[i], file_header->channels[i], SENSOR_TRACE_CHANNEL_NAME_LEN);
+		reader->header.channels[i][SENSOR_TRACE_CHANNEL_NAME_LEN - 1] = '\0';
+		reader->header.scales[i] = file_header->scales[i];
+	}
+	for (i = 0; i < 3; i++) {
+		reader->header.mount_matrix[i].x = file_header->mount_matrix[i * 3];
+		reader->header.mount_matrix[i].y = file_header->mount_matrix[i * 3 + 1];
+		reader->header.mount_matrix[i].z = file_header->mount_matrix[i * 3 + 2];
+	}
+
+	sensor_trace_reader_rewind (reader);
+
+	return reader;
+}
+
+const SensorTraceHeader *
+sensor_trace_reader_get_header (SensorTraceReader *reader)
+{
+	return &reader->header;
+}
+
+/* Returns FALSE at the end of the trace, or if it was cut short */
+gboolean
+sensor_trace_reader_next (SensorTraceReader *reader,
+			  gint64            *timestamp,
+			  int               *values)
+{
+	gint64 delta;
+	guint i;
+
+	if (!get_varint (reader, &delta))
+		return FALSE;
+	reader->timestamp += delta;
+
+	for (i = 0; i < reader->header.n_channels; i++) {
+		if (!get_varint (reader, &delta))
+			return FALSE;
+		reader->values[i] += delta;
+		values[i] = reader->values[i];
+	}
+
+	*timestamp = reader->timestamp;
+	return TRUE;
+}
+
+void
+sensor_trace_reader_rewind (SensorTraceReader *reader)
+{
+	reader->offset = sizeof (TraceHeader);
+	reader->timestamp = 0;
+	memset (reader->values, 0, sizeof (reader->values));
+}
+
+void
+sensor_trace_reader_free (SensorTraceReader *reader)
+{
+	g_mapped_file_unref (reader->mapped);
+	g_free (reader);
+}
+
+static const char *
+trace_type_to_str (DriverType type)
+{
+	switch (type) {
+	case DRIVER_TYPE_ACCEL:
+		return "accel";
+	case DRIVER_TYPE_LIGHT:
+		return "light";
+	case DRIVER_TYPE_COMPASS:
+		return "compass";
+	case DRIVER_TYPE_PROXIMITY:
+		return "proximity";
+	case DRIVER_TYPE_GYRO:
+		return "gyro";
+	case DRIVER_TYPE_ACCEL_BASE:
+		return "accel-base";
+	default:
+		g_assert_not_reached ();
+	}
+}
+
+void
+sensor_trace_set_record_directory (const char *directory)
+{
+	g_free (record_directory);
+	record_directory = g_strdup (directory);
+}
+
+/**
+ * sensor_trace_start_recording:
+ * @device: the sensor's device
+ * @header: how to interpret the sensor's raw values
+ *
+ * Starts recording a trace of the sensor, if traces were requested
+ * with sensor_trace_set_record_directory().
+ *
+ * Returns: a writer to add the raw values to, or %NULL
+ **/
+SensorTraceWriter *
+sensor_trace_start_recording (GUdevDevice             *device,
+			      const SensorTraceHeader *header)
+{
+	g_autoptr(GError) error = NULL;
+	g_autofree char *filename = NULL;
+	g_autofree char *path = NULL;
+	SensorTraceWriter *writer;
+
+	if (!record_directory)
+		return NULL;
+
+	filename = g_strdup_printf ("%s-%s.trace", g_udev_device_get_name (device),
+				    trace_type_to_str (header->type));
+	path = g_build_filename (record_directory, filename, NULL);
+	writer = sensor_trace_writer_new (path, header, &error);
+	if (!writer) {
+		g_warning ("%s", error->message);
+		return NULL;
+	}
+
+	g_debug ("Recording trace of %s to %s", g_udev_device_get_sysfs_path (device), path);
+	return writer;
+}
+
+void
+sensor_trace_set_replay (const char *path,
+			 gboolean    fast)
+{
+	g_free (replay_path);
+	replay_path = g_strdup (path);
+	replay_fast = fast;
+}
+
+const char *
+sensor_trace_get_replay_path (void)
+{
+	return replay_path;
+}
+
+gboolean
+sensor_trace_get_replay_fast (void)
+{
+	return replay_fast;
+}
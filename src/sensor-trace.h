@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gudev/gudev.h>
+
+#include "drivers.h"
+#include "accel-mount-matrix.h"
+
+#define SENSOR_TRACE_MAX_CHANNELS     3
+#define SENSOR_TRACE_CHANNEL_NAME_LEN 32
+
+/* What's needed to turn the raw values back into readings */
+typedef struct {
+	DriverType     type;
+	AccelLocation  location;
+	guint          n_channels;
+	char           channels[SENSOR_TRACE_MAX_CHANNELS][SENSOR_TRACE_CHANNEL_NAME_LEN];
+	double         scales[SENSOR_TRACE_MAX_CHANNELS];
+	AccelVec3      mount_matrix[3];
+	float          sampling_frequency;
+} SensorTraceHeader;
+
+typedef struct SensorTraceWriter SensorTraceWriter;
+typedef struct SensorTraceReader SensorTraceReader;
+
+void                     sensor_trace_set_record_directory (const char              *directory);
+SensorTraceWriter       *sensor_trace_start_recording      (GUdevDevice             *device,
+							    const SensorTraceHeader *header);
+
+SensorTraceWriter       *sensor_trace_writer_new           (const char              *path,
+							    const SensorTraceHeader *header,
+							    GError                 **error);
+void                     sensor_trace_writer_add           (SensorTraceWriter       *writer,
+							    const gint64            *timestamps,
+							    const int               *values,
+							    guint                    n_samples);
+void                     sensor_trace_writer_free          (SensorTraceWriter       *writer);
+
+SensorTraceReader       *sensor_trace_reader_new           (const char              *path,
+							    GError                 **error);
+const SensorTraceHeader *sensor_trace_reader_get_header    (SensorTraceReader       *reader);
+gboolean                 sensor_trace_reader_next          (SensorTraceReader       *reader,
+							    gint64                  *timestamp,
+							    int                     *values);
+void                     sensor_trace_reader_rewind        (SensorTraceReader       *reader);
+void                     sensor_trace_reader_free          (SensorTraceReader       *reader);
+
+void                     sensor_trace_set_replay           (const char              *path,
+							    gboolean                 fast);
+const char              *sensor_trace_get_replay_path      (void);
+gboolean                 sensor_trace_get_replay_fast      (void);
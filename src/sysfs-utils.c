@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+/*
+ * Helpers to access single-value sysfs attributes relative to an
+ * already opened directory, without building paths or going through
+ * stdio buffering.
+ */
+
+#include "sysfs-utils.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+/* Large enough for any single value attribute we read */
+#define SYSFS_BUF_SIZE 128
+
+int
+sysfs_open_dir (int         dirfd,
+		const char *path)
+{
+	int fd;
+
+	fd = openat (dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	return fd;
+}
+
+/* Reads @name into @buf, NUL-terminated and without the trailing
+ * newline, and returns its length */
+int
+sysfs_read (int         dirfd,
+	    const char *name,
+	    char       *buf,
+	    gsize       len)
+{
+	ssize_t r;
+	int fd;
+
+	g_return_val_if_fail (len > 0, -EINVAL);
+
+	fd = openat (dirfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	do {
+		r = read (fd, buf, len - 1);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		r = -errno;
+		close (fd);
+		return r;
+	}
+	close (fd);
+
+	buf[r] = '\0';
+	if (r > 0 && buf[r - 1] == '\n')
+		buf[--r] = '\0';
+
+	return r;
+}
+
+int
+sysfs_read_int (int         dirfd,
+		const char *name,
+		int        *value)
+{
+	char buf[SYSFS_BUF_SIZE];
+	char *end;
+	long val;
+	int ret;
+
+	ret = sysfs_read (dirfd, name, buf, sizeof (buf));
+	if (ret < 0)
+		return ret;
+
+	errno = 0;
+	val = strtol (buf, &end, 10);
+	if (errno != 0 || end == buf || val < G_MININT || val > G_MAXINT)
+		return -EINVAL;
+
+	*value = val;
+	return 0;
+}
+
+int
+sysfs_read_uint (int         dirfd,
+		 const char *name,
+		 unsigned   *value)
+{
+	char buf[SYSFS_BUF_SIZE];
+	char *end;
+	guint64 val;
+	int ret;
+
+	ret = sysfs_read (dirfd, name, buf, sizeof (buf));
+	if (ret < 0)
+		return ret;
+
+	errno = 0;
+	val = g_ascii_strtoull (buf, &end, 10);
+	if (errno != 0 || end == buf || val > G_MAXUINT)
+		return -EINVAL;
+
+	*value = val;
+	return 0;
+}
+
+int
+sysfs_read_float (int         dirfd,
+		  const char *name,
+		  float      *value)
+{
+	char buf[SYSFS_BUF_SIZE];
+	char *end;
+	double val;
+	int ret;
+
+	ret = sysfs_read (dirfd, name, buf, sizeof (buf));
+	if (ret < 0)
+		return ret;
+
+	/* sysfs always uses the C locale */
+	errno = 0;
+	val = g_ascii_strtod (buf, &end);
+	if (errno != 0 || end == buf)
+		return -EINVAL;
+
+	*value = val;
+	return 0;
+}
+
+static int
+write_buf (int         dirfd,
+	   const char *name,
+	   const char *buf,
+	   gsize       len)
+{
+	ssize_t r;
+	int fd;
+
+	fd = openat (dirfd, name, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	do {
+		r = write (fd, buf, len);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		r = -errno;
+		close (fd);
+		return r;
+	}
+	close (fd);
+
+	return 0;
+}
+
+int
+sysfs_write_int (int         dirfd,
+		 const char *name,
+		 int         value,
+		 gboolean    verify)
+{
+	char buf[SYSFS_BUF_SIZE];
+	int len, ret, test;
+
+	len = g_snprintf (buf, sizeof (buf), "%d", value);
+	ret = write_buf (dirfd, name, buf, len);
+	if (ret < 0 || !verify)
+		return ret;
+
+	ret = sysfs_read_int (dirfd, name, &test);
+	if (ret < 0)
+		return ret;
+	if (test != value) {
+		g_warning ("Possible failure in int write %d to %s", value, name);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+int
+sysfs_write_string (int         dirfd,
+		    const char *name,
+		    const char *value,
+		    gboolean    verify)
+{
+	char buf[SYSFS_BUF_SIZE];
+	int ret;
+
+	ret = write_buf (dirfd, name, value, strlen (value));
+	if (ret < 0 || !verify)
+		return ret;
+
+	ret = sysfs_read (dirfd, name, buf, sizeof (buf));
+	if (ret < 0)
+		return ret;
+	if (strcmp (buf, value) != 0) {
+		g_warning ("Possible failure in string write of %s Should be %s written to %s",
+			   buf, value, name);
+		return -EIO;
+	}
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* All functions return a negative errno on failure */
+int sysfs_open_dir     (int         dirfd,
+			const char *path);
+int sysfs_read         (int         dirfd,
+			const char *name,
+			char       *buf,
+			gsize       len);
+int sysfs_read_int     (int         dirfd,
+			const char *name,
+			int        *value);
+int sysfs_read_uint    (int         dirfd,
+			const char *name,
+			unsigned   *value);
+int sysfs_read_float   (int         dirfd,
+			const char *name,
+			float      *value);
+int sysfs_write_int    (int         dirfd,
+			const char *name,
+			int         value,
+			gboolean    verify);
+int sysfs_write_string (int         dirfd,
+			const char *name,
+			const char *value,
+			gboolean    verify);
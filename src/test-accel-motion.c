@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include "accel-motion.h"
+
+#define MIN_INTERVAL 700
+#define MAX_INTERVAL 5600
+
+static void
+add_still_samples (AccelMotion *motion,
+		   guint        n_samples)
+{
+	double sample[3] = { 0.0, -9.81, 0.0 };
+	guint i;
+
+	for (i = 0; i < n_samples; i++) {
+		/* A little bit of sensor noise */
+		sample[0] = (i % 2) ? 0.02 : -0.02;
+		accel_motion_add_samples (motion, sample, 1);
+	}
+}
+
+static void
+test_accel_motion_backoff (void)
+{
+	AccelMotion motion;
+
+	accel_motion_init (&motion, MIN_INTERVAL, MAX_INTERVAL);
+
+	/* Not enough readings to know yet */
+	add_still_samples (&motion, ACCEL_MOTION_WINDOW - 1);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MIN_INTERVAL);
+
+	/* Still, back off until the maximum */
+	add_still_samples (&motion, 1);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MIN_INTERVAL * 2);
+	add_still_samples (&motion, 1);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MIN_INTERVAL * 4);
+	add_still_samples (&motion, 1);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MAX_INTERVAL);
+	add_still_samples (&motion, 1);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MAX_INTERVAL);
+}
+
+static void
+test_accel_motion_snap (void)
+{
+	AccelMotion motion;
+	double rotated[3] = { 9.81, 0.0, 0.0 };
+	double shaking[6] = { 0.0, -9.81, 0.0, 0.0, -9.0, 0.0 };
+	guint i;
+
+	accel_motion_init (&motion, MIN_INTERVAL, MAX_INTERVAL);
+	add_still_samples (&motion, ACCEL_MOTION_WINDOW);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MIN_INTERVAL * 2);
+
+	/* Rotating the device keeps the magnitude, but is a large delta */
+	accel_motion_add_samples (&motion, rotated, 1);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MIN_INTERVAL);
+
+	/* Small but constant movements keep the variance up */
+	for (i = 0; i < ACCEL_MOTION_WINDOW; i++)
+		accel_motion_add_samples (&motion, shaking, 2);
+	g_assert_cmpuint (accel_motion_next_interval (&motion), ==, MIN_INTERVAL);
+}
+
+int main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/iio-sensor-proxy/accel-motion/backoff", test_accel_motion_backoff);
+	g_test_add_func ("/iio-sensor-proxy/accel-motion/snap", test_accel_motion_snap);
+
+	return g_test_run ();
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <glib/gstdio.h>
+
+#include "compass-calibration.h"
+#include "time-source.h"
+
+#define DEVICE_ID "/sys/devices/platform/magn-test/iio:device1"
+
+/* Raw readings of a magnetometer with a hard-iron offset of (100, -200, 50),
+ * and axes of different sensitivities, turned to face each direction */
+static const int samples[][3] = {
+	{  100 + 400,  -200,        50 },
+	{  100 - 400,  -200,        50 },
+	{  100,        -200 + 300,  50 },
+	{  100,        -200 - 300,  50 },
+	{  100,        -200,        50 + 350 },
+	{  100,        -200,        50 - 350 },
+};
+
+static void
+add_samples (CompassCalibration *calibration)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (samples); i++)
+		compass_calibration_add_sample (calibration, samples[i][0], samples[i][1], samples[i][2]);
+}
+
+static void
+test_compass_calibration_online (void)
+{
+	CompassCalibration calibration;
+	double out[3];
+
+	compass_calibration_init (&calibration, DEVICE_ID);
+	g_assert_false (calibration.is_calibrated);
+
+	/* Raw readings until the device was turned around */
+	compass_calibration_apply (&calibration, 500, -200, 50, out);
+	g_assert_cmpfloat (out[0], ==, 500);
+	compass_calibration_add_sample (&calibration, 500, -200, 50);
+	compass_calibration_add_sample (&calibration, -300, -200, 50);
+	g_assert_false (calibration.is_calibrated);
+
+	add_samples (&calibration);
+	g_assert_true (calibration.is_calibrated);
+
+	/* Offset removed, and all the axes scaled to the same range */
+	compass_calibration_apply (&calibration, 100, -200, 50, out);
+	g_assert_cmpfloat_with_epsilon (out[0], 0.0, 0.001);
+	g_assert_cmpfloat_with_epsilon (out[1], 0.0, 0.001);
+	g_assert_cmpfloat_with_epsilon (out[2], 0.0, 0.001);
+	compass_calibration_apply (&calibration, 500, -200, 50, out);
+	g_assert_cmpfloat_with_epsilon (out[0], 350.0, 0.001);
+	compass_calibration_apply (&calibration, 100, 100, 50, out);
+	g_assert_cmpfloat_with_epsilon (out[1], 350.0, 0.001);
+	compass_calibration_apply (&calibration, 100, -200, 400, out);
+	g_assert_cmpfloat_with_epsilon (out[2], 350.0, 0.001);
+
+	calibration.dirty = FALSE;
+	compass_calibration_clear (&calibration);
+}
+
+static void
+test_compass_calibration_persist (void)
+{
+	CompassCalibration calibration;
+	double out[3];
+
+	compass_calibration_init (&calibration, DEVICE_ID);
+	g_assert_false (calibration.is_calibrated);
+	add_samples (&calibration);
+	g_assert_true (calibration.is_calibrated);
+	compass_calibration_clear (&calibration);
+
+	/* Calibrated straight away for the same device */
+	compass_calibration_init (&calibration, DEVICE_ID);
+	g_assert_true (calibration.is_calibrated);
+	g_assert_false (calibration.dirty);
+	compass_calibration_apply (&calibration, 100, -200, 50, out);
+	g_assert_cmpfloat_with_epsilon (out[0], 0.0, 0.001);
+	compass_calibration_clear (&calibration);
+
+	/* But not for another one */
+	compass_calibration_init (&calibration, DEVICE_ID "0");
+	g_assert_false (calibration.is_calibrated);
+	compass_calibration_clear (&calibration);
+}
+
+static void
+test_compass_calibration_outliers (void)
+{
+	CompassCalibration calibration;
+	guint i;
+
+	compass_calibration_init (&calibration, DEVICE_ID "-outliers");
+	add_samples (&calibration);
+	g_assert_true (calibration.is_calibrated);
+	compass_calibration_clear (&calibration);
+
+	/* A passing magnet doesn't change the calibration, or get saved */
+	compass_calibration_init (&calibration, DEVICE_ID "-outliers");
+	for (i = 0; i < 10; i++)
+		compass_calibration_add_sample (&calibration, 100 + 5000, -200, 50);
+	g_assert_true (calibration.is_calibrated);
+	g_assert_cmpint (calibration.x_max, ==, 100 + 400);
+	g_assert_false (calibration.dirty);
+
+	/* But the calibration starts over if the readings stay out */
+	for (i = 0; i < 200; i++)
+		compass_calibration_add_sample (&calibration, 100 + 5000, -200, 50);
+	g_assert_false (calibration.is_calibrated);
+	compass_calibration_clear (&calibration);
+
+	compass_calibration_init (&calibration, DEVICE_ID "-outliers");
+	g_assert_false (calibration.is_calibrated);
+	compass_calibration_clear (&calibration);
+}
+
+static void
+test_compass_calibration_decay (void)
+{
+	CompassCalibration calibration;
+	guint i;
+
+	/* A transient before the calibration was complete
+	 * inflated the X axis too much to ever complete it */
+	compass_calibration_init (&calibration, DEVICE_ID "-decay");
+	compass_calibration_add_sample (&calibration, 100 + 2000, -200, 50);
+	add_samples (&calibration);
+	g_assert_false (calibration.is_calibrated);
+
+	/* Until it shrinks back with use */
+	for (i = 0; i < 200 && !calibration.is_calibrated; i++) {
+		time_source_advance ((gint64) 5 * 60 * G_USEC_PER_SEC);
+		add_samples (&calibration);
+	}
+	g_assert_true (calibration.is_calibrated);
+	g_assert_cmpint (calibration.x_max, <, 100 + 2000);
+
+	calibration.dirty = FALSE;
+	compass_calibration_clear (&calibration);
+}
+
+int main (int argc, char **argv)
+{
+	g_autofree char *state_dir = NULL;
+	g_autoptr(GDir) dir = NULL;
+	const char *name;
+	int ret;
+
+	g_test_init (&argc, &argv, NULL);
+
+	state_dir = g_dir_make_tmp ("iio-sensor-proxy-XXXXXX", NULL);
+	g_assert_nonnull (state_dir);
+	g_setenv ("STATE_DIRECTORY", state_dir, TRUE);
+	time_source_set_virtual (G_GINT64_CONSTANT (1000) * G_USEC_PER_SEC);
+
+	g_test_add_func ("/iio-sensor-proxy/compass-calibration/online", test_compass_calibration_online);
+	g_test_add_func ("/iio-sensor-proxy/compass-calibration/persist", test_compass_calibration_persist);
+	g_test_add_func ("/iio-sensor-proxy/compass-calibration/outliers", test_compass_calibration_outliers);
+	g_test_add_func ("/iio-sensor-proxy/compass-calibration/decay", test_compass_calibration_decay);
+
+	ret = g_test_run ();
+
+	dir = g_dir_open (state_dir, 0, NULL);
+	while (dir && (name = g_dir_read_name (dir)) != NULL) {
+		g_autofree char *path = NULL;
+
+		path = g_build_filename (state_dir, name, NULL);
+		g_remove (path);
+	}
+	g_rmdir (state_dir);
+
+	return ret;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <math.h>
+
+#include "compass-fusion.h"
+
+#define EPSILON 0.01
+
+/* Device frame: x to the right of the screen, y to the top, z out of
+ * the screen, with the field pointing North, and down into the ground */
+
+static void
+rotate_x (double v[3], double degrees)
+{
+	double a = degrees * G_PI / 180.0;
+	double y = v[1], z = v[2];
+
+	v[1] = y * cos (a) - z * sin (a);
+	v[2] = y * sin (a) + z * cos (a);
+}
+
+static void
+rotate_y (double v[3], double degrees)
+{
+	double a = degrees * G_PI / 180.0;
+	double x = v[0], z = v[2];
+
+	v[0] = x * cos (a) + z * sin (a);
+	v[2] = -x * sin (a) + z * cos (a);
+}
+
+static double
+get_heading (const double gravity[3],
+	     const double field[3])
+{
+	double heading = -1.0;
+
+	g_assert_true (compass_fusion_get_heading (gravity, field, &heading));
+	return heading;
+}
+
+static void
+test_compass_fusion_flat (void)
+{
+	double gravity[3] = { 0.0, 0.0, -9.81 };
+	double north[3] = { 0.0, 20.0, -40.0 };
+	double east[3] = { -20.0, 0.0, -40.0 };
+	double west[3] = { 20.0, 0.0, -40.0 };
+
+	g_assert_cmpfloat_with_epsilon (get_heading (gravity, north), 0.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_heading (gravity, east), 90.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_heading (gravity, west), 270.0, EPSILON);
+}
+
+static void
+test_compass_fusion_upright (void)
+{
+	double gravity[3] = { 0.0, -9.81, 0.0 };
+	/* The back of the device facing North, then South */
+	double north[3] = { 0.0, -40.0, -20.0 };
+	double south[3] = { 0.0, -40.0, 20.0 };
+
+	g_assert_cmpfloat_with_epsilon (get_heading (gravity, north), 0.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_heading (gravity, south), 180.0, EPSILON);
+}
+
+static void
+test_compass_fusion_tilted (void)
+{
+	double gravity[3] = { 0.0, 0.0, -9.81 };
+	double field[3] = { -20.0, 0.0, -40.0 };
+
+	/* Same heading as lying flat, facing East, even when tilted */
+	rotate_x (gravity, 30.0);
+	rotate_x (field, 30.0);
+	g_assert_cmpfloat_with_epsilon (get_heading (gravity, field), 90.0, EPSILON);
+	rotate_y (gravity, -20.0);
+	rotate_y (field, -20.0);
+	g_assert_cmpfloat_with_epsilon (get_heading (gravity, field), 90.0, EPSILON);
+}
+
+static void
+test_compass_fusion_invalid (void)
+{
+	double falling[3] = { 0.0, 0.0, 0.0 };
+	double gravity[3] = { 0.0, 0.0, -9.81 };
+	double field[3] = { 0.0, 20.0, -40.0 };
+	double vertical[3] = { 0.0, 0.0, -40.0 };
+	double heading;
+
+	g_assert_false (compass_fusion_get_heading (falling, field, &heading));
+	g_assert_false (compass_fusion_get_heading (gravity, vertical, &heading));
+}
+
+int main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/iio-sensor-proxy/compass-fusion/flat", test_compass_fusion_flat);
+	g_test_add_func ("/iio-sensor-proxy/compass-fusion/upright", test_compass_fusion_upright);
+	g_test_add_func ("/iio-sensor-proxy/compass-fusion/tilted", test_compass_fusion_tilted);
+	g_test_add_func ("/iio-sensor-proxy/compass-fusion/invalid", test_compass_fusion_invalid);
+
+	return g_test_run ();
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <math.h>
+
+#include "hinge-angle.h"
+
+#define EPSILON 0.01
+
+/* A reading pointing down, with the part rotated by @degrees
+ * around the hinge from lying flat, face up */
+static void
+down_at (double v[3], double degrees)
+{
+	double a = degrees * G_PI / 180.0;
+
+	v[0] = 0.0;
+	v[1] = -9.81 * sin (a);
+	v[2] = -9.81 * cos (a);
+}
+
+static double
+get_angle (double display_rotation,
+	   double base_rotation,
+	   double previous)
+{
+	double display[3], base[3];
+	double angle = HINGE_ANGLE_UNKNOWN;
+
+	down_at (display, display_rotation);
+	down_at (base, base_rotation);
+	g_assert_true (hinge_angle_calc (display, base, previous, &angle));
+	return angle;
+}
+
+static void
+test_hinge_angle_base_flat (void)
+{
+	g_assert_cmpfloat_with_epsilon (get_angle (90.0, 0.0, HINGE_ANGLE_UNKNOWN), 90.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_angle (70.0, 0.0, HINGE_ANGLE_UNKNOWN), 110.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_angle (0.0, 0.0, HINGE_ANGLE_UNKNOWN), 180.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_angle (-60.0, 0.0, HINGE_ANGLE_UNKNOWN), 240.0, EPSILON);
+}
+
+static void
+test_hinge_angle_tent (void)
+{
+	/* Standing as a tent, both halves at 60 degrees from the table */
+	g_assert_cmpfloat_with_epsilon (get_angle (-60.0, 60.0, HINGE_ANGLE_UNKNOWN), 300.0, EPSILON);
+	/* Same angle, turned by 30 degrees around the hinge */
+	g_assert_cmpfloat_with_epsilon (get_angle (-30.0, 90.0, HINGE_ANGLE_UNKNOWN), 300.0, EPSILON);
+}
+
+static void
+test_hinge_angle_folded (void)
+{
+	double display[3], base[3];
+	double angle;
+
+	/* Closed or folded back, depending on where it came from */
+	down_at (display, 175.0);
+	down_at (base, 0.0);
+	g_assert_false (hinge_angle_calc (display, base, HINGE_ANGLE_UNKNOWN, &angle));
+	g_assert_cmpfloat_with_epsilon (get_angle (175.0, 0.0, 30.0), 5.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_angle (175.0, 0.0, 330.0), 360.0, EPSILON);
+	g_assert_cmpfloat_with_epsilon (get_angle (-175.0, 0.0, 330.0), 355.0, EPSILON);
+}
+
+static void
+test_hinge_angle_invalid (void)
+{
+	double on_side[3] = { -9.81, 0.5, 0.5 };
+	double base[3] = { 0.0, 0.0, -9.81 };
+	double angle;
+
+	g_assert_false (hinge_angle_calc (on_side, base, 90.0, &angle));
+	g_assert_false (hinge_angle_calc (base, on_side, 90.0, &angle));
+}
+
+static void
+test_hinge_tablet_mode (void)
+{
+	g_assert_false (hinge_tablet_mode (FALSE, 110.0));
+	g_assert_false (hinge_tablet_mode (FALSE, 190.0));
+	g_assert_true (hinge_tablet_mode (FALSE, 300.0));
+	g_assert_true (hinge_tablet_mode (TRUE, 190.0));
+	g_assert_false (hinge_tablet_mode (TRUE, 150.0));
+}
+
+int main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/iio-sensor-proxy/hinge-angle/base-flat", test_hinge_angle_base_flat);
+	g_test_add_func ("/iio-sensor-proxy/hinge-angle/tent", test_hinge_angle_tent);
+	g_test_add_func ("/iio-sensor-proxy/hinge-angle/folded", test_hinge_angle_folded);
+	g_test_add_func ("/iio-sensor-proxy/hinge-angle/invalid", test_hinge_angle_invalid);
+	g_test_add_func ("/iio-sensor-proxy/hinge-angle/tablet-mode", test_hinge_tablet_mode);
+
+	return g_test_run ();
+}
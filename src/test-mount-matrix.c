@@ -61,11 +61,41 @@ test_mount_matrix (void)
 	g_test_assert_expected_messages ();
 }
 
+static void
+test_accel_transform (void)
+{
+	AccelVec3 *vecs;
+	AccelTransform transform;
+	AccelScale scale = { 0.5, 2.0, 4.0 };
+	int raw[6] = { 2, -3, 5, 100, 0, -1 };
+	double single[3], batch[6];
+	guint i;
+
+	/* Swap Y/Z matrix, with the scale following the raw axis */
+	g_assert_true (parse_mount_matrix (SWAP_Y_Z_MATRIX, &vecs));
+	setup_accel_transform (&transform, vecs, scale);
+	g_free (vecs);
+
+	apply_accel_transform (&transform, raw, single);
+	g_assert_cmpfloat (single[0], ==, 1.0);
+	g_assert_cmpfloat (single[1], ==, 20.0);
+	g_assert_cmpfloat (single[2], ==, -6.0);
+
+	/* The batched version gives the same results */
+	apply_accel_transform_n (&transform, raw, batch, 2);
+	for (i = 0; i < 3; i++)
+		g_assert_cmpfloat (batch[i], ==, single[i]);
+	g_assert_cmpfloat (batch[3], ==, 50.0);
+	g_assert_cmpfloat (batch[4], ==, -4.0);
+	g_assert_cmpfloat (batch[5], ==, 0.0);
+}
+
 int main (int argc, char **argv)
 {
 	g_test_init (&argc, &argv, NULL);
 
 	g_test_add_func ("/iio-sensor-proxy/mount-matrix", test_mount_matrix);
+	g_test_add_func ("/iio-sensor-proxy/accel-transform", test_accel_transform);
 
 	return g_test_run ();
 }
@@ -9,24 +9,49 @@
 
 #include <glib.h>
 #include <stdlib.h>
+#include <math.h>
 #include "orientation.h"
 #include "accel-mount-matrix.h"
+#include "time-source.h"
 
 #define ONEG 256
 
+/* The accelerometer polling interval, in ms */
+#define POLL_INTERVAL 700
+/* How long the device takes to do a full turn, in ms */
+#define ROTATION_PERIOD (10 * 60 * 1000)
+
+static OrientationUp
+calc_orientation (OrientationUp  prev,
+		  const int      raw[3],
+		  gdouble        scale,
+		  const char    *mount_matrix)
+{
+	AccelVec3 *vecs;
+	AccelTransform transform;
+	AccelScale scale_vec;
+	double accel[3];
+
+	g_assert_true (parse_mount_matrix (mount_matrix, &vecs));
+	set_accel_scale (&scale_vec, scale);
+	setup_accel_transform (&transform, vecs, scale_vec);
+	g_free (vecs);
+
+	apply_accel_transform (&transform, raw, accel);
+	return orientation_calc (prev, accel[0], accel[1], accel[2]);
+}
+
 static void
 test_orientation (void)
 {
 	static struct {
-		int x;
-		int y;
-		int z;
+		int readings[3];
 		OrientationUp expected;
 	} orientations[] = {
-		{ 0, -ONEG, 0, ORIENTATION_NORMAL },
-		{ -ONEG, 0, 0, ORIENTATION_RIGHT_UP },
-		{ ONEG, 0, 0, ORIENTATION_LEFT_UP },
-		{ 0, ONEG, 0, ORIENTATION_BOTTOM_UP }
+		{ { 0, -ONEG, 0 }, ORIENTATION_NORMAL },
+		{ { -ONEG, 0, 0 }, ORIENTATION_RIGHT_UP },
+		{ { ONEG, 0, 0 }, ORIENTATION_LEFT_UP },
+		{ { 0, ONEG, 0 }, ORIENTATION_BOTTOM_UP }
 	};
 	guint i, num_failures;
 
@@ -35,14 +60,11 @@ test_orientation (void)
 	for (i = 0; i < G_N_ELEMENTS (orientations); i++) {
 		OrientationUp o;
 		const char *expected, *result;
-		AccelScale scale;
-
-		set_accel_scale (&scale, 9.81 / ONEG);
-		o = orientation_calc (ORIENTATION_UNDEFINED,
-				      orientations[i].x,
-				      orientations[i].y,
-				      orientations[i].z,
-				      scale);
+
+		o = calc_orientation (ORIENTATION_UNDEFINED,
+				      orientations[i].readings,
+				      9.81 / ONEG,
+				      NULL);
 		result = orientation_to_string (o);
 		expected = orientation_to_string (orientations[i].expected);
 		/* Fail straight away when not verbose */
@@ -64,15 +86,13 @@ static void
 test_orientation_threshold (void)
 {
 	static struct {
-		int x;
-		int y;
-		int z;
+		int readings[3];
 		OrientationUp expected;
 	} orientations[] = {
-		{ 0, -ONEG, 0, ORIENTATION_NORMAL },
-		{ 183, -ONEG, 0, ORIENTATION_NORMAL },
-		{ 176, -ONEG, 0, ORIENTATION_NORMAL },
-		{ 183, -ONEG, 0, ORIENTATION_NORMAL },
+		{ { 0, -ONEG, 0 }, ORIENTATION_NORMAL },
+		{ { 183, -ONEG, 0 }, ORIENTATION_NORMAL },
+		{ { 176, -ONEG, 0 }, ORIENTATION_NORMAL },
+		{ { 183, -ONEG, 0 }, ORIENTATION_NORMAL },
 	};
 	guint i, num_failures;
 	OrientationUp prev;
@@ -83,14 +103,11 @@ test_orientation_threshold (void)
 	for (i = 0; i < G_N_ELEMENTS (orientations); i++) {
 		OrientationUp o;
 		const char *expected, *result;
-		AccelScale scale;
-
-		set_accel_scale (&scale, 9.81 / ONEG);
-		o = orientation_calc (prev,
-				      orientations[i].x,
-				      orientations[i].y,
-				      orientations[i].z,
-				      scale);
+
+		o = calc_orientation (prev,
+				      orientations[i].readings,
+				      9.81 / ONEG,
+				      NULL);
 		result = orientation_to_string (o);
 		expected = orientation_to_string (orientations[i].expected);
 		/* Fail straight away when not verbose */
@@ -115,7 +132,7 @@ test_mount_matrix_orientation (void)
 {
 	guint i;
 	struct {
-		AccelVec3 readings;
+		int readings[3];
 		gdouble scale;
 		const char *mount_matrix;
 		OrientationUp expected;
@@ -129,26 +146,68 @@ test_mount_matrix_orientation (void)
 	};
 
 	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
-		AccelVec3 *vecs;
 		const char *result, *expected;
 		OrientationUp o;
-		AccelScale scale;
-
-		g_assert_true (parse_mount_matrix (tests[i].mount_matrix, &vecs));
-		g_assert_true (apply_mount_matrix (vecs, &tests[i].readings));
-		set_accel_scale (&scale, tests[i].scale);
-		o = orientation_calc (ORIENTATION_UNDEFINED,
-				      tests[i].readings.x,
-				      tests[i].readings.y,
-				      tests[i].readings.z,
-				      scale);
+
+		o = calc_orientation (ORIENTATION_UNDEFINED,
+				      tests[i].readings,
+				      tests[i].scale,
+				      tests[i].mount_matrix);
 		result = orientation_to_string (o);
 		expected = orientation_to_string (tests[i].expected);
 		g_assert_cmpstr (result, ==, expected);
-		g_free (vecs);
 	}
 }
 
+typedef struct {
+	gint64        start_time;
+	OrientationUp orientation;
+	guint         n_readings;
+	guint         n_changes;
+} Rotation;
+
+static gboolean
+read_rotation (gpointer user_data)
+{
+	Rotation *rotation = user_data;
+	OrientationUp o;
+	double angle;
+	int raw[3];
+
+	/* Turning in the plane of the screen */
+	angle = 2 * G_PI * (time_source_get_time () - rotation->start_time) / (ROTATION_PERIOD * 1000.0);
+	raw[0] = ONEG * sin (angle);
+	raw[1] = -ONEG * cos (angle);
+	raw[2] = 0;
+
+	o = calc_orientation (rotation->orientation, raw, 9.81 / ONEG, NULL);
+	if (o != rotation->orientation)
+		rotation->n_changes++;
+	rotation->orientation = o;
+	rotation->n_readings++;
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_orientation_rotation (void)
+{
+	Rotation rotation = { 0, };
+	guint id;
+
+	/* Two hours of polling, checked on the virtual clock */
+	rotation.start_time = time_source_get_time ();
+	rotation.orientation = ORIENTATION_UNDEFINED;
+	id = time_source_timeout_add (POLL_INTERVAL, read_rotation, &rotation);
+	time_source_advance ((gint64) 12 * ROTATION_PERIOD * 1000);
+	time_source_remove (id);
+
+	g_assert_cmpuint (rotation.n_readings, ==, 12 * ROTATION_PERIOD / POLL_INTERVAL);
+	/* The first reading, then all 4 orientations, 12 times over */
+	g_assert_cmpuint (rotation.n_changes, ==, 1 + 12 * 4);
+	g_assert_cmpint (rotation.orientation, ==, ORIENTATION_NORMAL);
+}
+
 static gboolean
 print_orientation (const char *x_str,
 		   const char *y_str,
@@ -156,51 +215,37 @@ print_orientation (const char *x_str,
 		   const char *scale_str,
 		   const char *mount_matrix)
 {
-	int x, y, z;
+	int raw[3];
+	double accel[3];
 	gdouble scale;
 	OrientationUp o;
 	AccelScale scale_vec;
+	AccelTransform transform;
+	AccelVec3 *vecs;
 
 	if (scale_str == NULL)
 		scale = 1.0;
 	else
 		scale = g_strtod (scale_str, NULL);
 
-	x = atoi (x_str);
-	y = atoi (y_str);
-	z = atoi (z_str);
-
-	if (mount_matrix) {
-		AccelVec3 *vecs;
-		AccelVec3 readings;
+	raw[0] = atoi (x_str);
+	raw[1] = atoi (y_str);
+	raw[2] = atoi (z_str);
 
-		if (!parse_mount_matrix (mount_matrix, &vecs)) {
-			g_printerr ("Could not parse mount matrix '%s'\n",
-				    mount_matrix);
-			return FALSE;
-		}
-
-		readings.x = x;
-		readings.y = y;
-		readings.z = z;
-
-		if (!apply_mount_matrix (vecs, &readings)) {
-			g_printerr ("Could not apply mount matrix '%s'\n",
-				    mount_matrix);
-			return FALSE;
-		}
-
-		x = readings.x;
-		y = readings.y;
-		z = readings.z;
-
-		g_free (vecs);
+	if (!parse_mount_matrix (mount_matrix, &vecs)) {
+		g_printerr ("Could not parse mount matrix '%s'\n",
+			    mount_matrix);
+		return FALSE;
 	}
 
 	set_accel_scale (&scale_vec, scale);
-	o = orientation_calc (ORIENTATION_UNDEFINED, x, y, z, scale_vec);
+	setup_accel_transform (&transform, vecs, scale_vec);
+	g_free (vecs);
+
+	apply_accel_transform (&transform, raw, accel);
+	o = orientation_calc (ORIENTATION_UNDEFINED, accel[0], accel[1], accel[2]);
 	g_print ("Orientation for %d,%d,%d (scale: %lf) is '%s'\n",
-		 x, y, z, scale, orientation_to_string (o));
+		 raw[0], raw[1], raw[2], scale, orientation_to_string (o));
 
 	return TRUE;
 }
@@ -229,5 +274,8 @@ int main (int argc, char **argv)
 	g_test_add_func ("/iio-sensor-proxy/quirking", test_mount_matrix_orientation);
 	g_test_add_func ("/iio-sensor-proxy/threshold", test_orientation_threshold);
 
+	time_source_set_virtual (0);
+	g_test_add_func ("/iio-sensor-proxy/rotation", test_orientation_rotation);
+
 	return g_test_run ();
 }
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include "scan-pairing.h"
+
+#define MAX_TUPLES 8
+
+static void
+test_scan_pairing_lockstep (void)
+{
+	/* Two sensors on one trigger, one of which was read
+	 * just after a tick that the other missed */
+	guint n_scans[] = { 3, 4 };
+	guint tuples[MAX_TUPLES * 2];
+	gboolean aligned;
+	guint n_tuples;
+
+	n_tuples = scan_pairing_match (n_scans, NULL, 2, TRUE, 0, tuples, &aligned);
+	g_assert_true (aligned);
+	g_assert_cmpuint (n_tuples, ==, 3);
+
+	/* Oldest first, and both ending with their latest scans */
+	g_assert_cmpuint (tuples[0], ==, 0);
+	g_assert_cmpuint (tuples[1], ==, 1);
+	g_assert_cmpuint (tuples[4], ==, 2);
+	g_assert_cmpuint (tuples[5], ==, 3);
+
+	/* Nothing to pair if one of them has no scans */
+	n_scans[1] = 0;
+	n_tuples = scan_pairing_match (n_scans, NULL, 2, TRUE, 0, tuples, &aligned);
+	g_assert_cmpuint (n_tuples, ==, 0);
+}
+
+static void
+test_scan_pairing_timestamps (void)
+{
+	/* A HID sensor hub, with an accelerometer at 10 Hz and a
+	 * magnetometer at 5 Hz, each on its own trigger, in µs */
+	const gint64 accel[] = { 1000000, 1100000, 1200000, 1300000 };
+	const gint64 magn[] = { 1030000, 1230000 };
+	const gint64 * const timestamps[] = { accel, magn };
+	guint n_scans[] = { G_N_ELEMENTS (accel), G_N_ELEMENTS (magn) };
+	guint tuples[MAX_TUPLES * 2];
+	gboolean aligned;
+	guint n_tuples;
+
+	/* Half the magnetometer's period */
+	n_tuples = scan_pairing_match (n_scans, timestamps, 2, FALSE, 100000, tuples, &aligned);
+	g_assert_true (aligned);
+	g_assert_cmpuint (n_tuples, ==, 4);
+	g_assert_cmpuint (tuples[1], ==, 0);
+	g_assert_cmpuint (tuples[3], ==, 0);
+	g_assert_cmpuint (tuples[5], ==, 1);
+	g_assert_cmpuint (tuples[7], ==, 1);
+
+	/* Only the scans close enough to each other */
+	n_tuples = scan_pairing_match (n_scans, timestamps, 2, FALSE, 30000, tuples, &aligned);
+	g_assert_true (aligned);
+	g_assert_cmpuint (n_tuples, ==, 2);
+	g_assert_cmpuint (tuples[0], ==, 0);
+	g_assert_cmpuint (tuples[1], ==, 0);
+	g_assert_cmpuint (tuples[2], ==, 2);
+	g_assert_cmpuint (tuples[3], ==, 1);
+
+	/* Otherwise the latest ones, which aren't aligned */
+	n_tuples = scan_pairing_match (n_scans, timestamps, 2, FALSE, 10000, tuples, &aligned);
+	g_assert_false (aligned);
+	g_assert_cmpuint (n_tuples, ==, 1);
+	g_assert_cmpuint (tuples[0], ==, 3);
+	g_assert_cmpuint (tuples[1], ==, 1);
+
+	/* Or without timestamps */
+	n_tuples = scan_pairing_match (n_scans, NULL, 2, FALSE, 100000, tuples, &aligned);
+	g_assert_false (aligned);
+	g_assert_cmpuint (n_tuples, ==, 1);
+}
+
+int main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/iio-sensor-proxy/scan-pairing/lockstep", test_scan_pairing_lockstep);
+	g_test_add_func ("/iio-sensor-proxy/scan-pairing/timestamps", test_scan_pairing_timestamps);
+
+	return g_test_run ();
+}
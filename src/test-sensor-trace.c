@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "sensor-trace.h"
+
+#define N_SAMPLES 1000
+
+static char *trace_dir = NULL;
+
+static void
+fill_header (SensorTraceHeader *header)
+{
+	memset (header, 0, sizeof (*header));
+	header->type = DRIVER_TYPE_ACCEL;
+	header->location = ACCEL_LOCATION_DISPLAY;
+	header->n_channels = 3;
+	header->sampling_frequency = 100.0;
+	g_strlcpy (header->channels[0], "in_accel_x", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	g_strlcpy (header->channels[1], "in_accel_y", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	g_strlcpy (header->channels[2], "in_accel_z", SENSOR_TRACE_CHANNEL_NAME_LEN);
+	header->scales[0] = header->scales[1] = header->scales[2] = 0.009582;
+	header->mount_matrix[0].y = -1.0;
+	header->mount_matrix[1].x = 1.0;
+	header->mount_matrix[2].z = 1.0;
+}
+
+static void
+test_sensor_trace_header (void)
+{
+	g_autofree char *path = NULL;
+	SensorTraceHeader header;
+	const SensorTraceHeader *read_header;
+	SensorTraceWriter *writer;
+	SensorTraceReader *reader;
+	gint64 timestamp;
+	int values[3];
+
+	path = g_build_filename (trace_dir, "header.trace", NULL);
+	fill_header (&header);
+	writer = sensor_trace_writer_new (path, &header, NULL);
+	g_assert_nonnull (writer);
+	sensor_trace_writer_free (writer);
+
+	reader = sensor_trace_reader_new (path, NULL);
+	g_assert_nonnull (reader);
+	read_header = sensor_trace_reader_get_header (reader);
+	g_assert_cmpint (read_header->type, ==, DRIVER_TYPE_ACCEL);
+	g_assert_cmpint (read_header->location, ==, ACCEL_LOCATION_DISPLAY);
+	g_assert_cmpuint (read_header->n_channels, ==, 3);
+	g_assert_cmpfloat (read_header->sampling_frequency, ==, 100.0);
+	g_assert_cmpstr (read_header->channels[2], ==, "in_accel_z");
+	g_assert_cmpfloat (read_header->scales[1], ==, 0.009582);
+	g_assert_cmpfloat (read_header->mount_matrix[0].y, ==, -1.0);
+	g_assert_cmpfloat (read_header->mount_matrix[1].x, ==, 1.0);
+	g_assert_cmpfloat (read_header->mount_matrix[2].z, ==, 1.0);
+
+	/* No samples */
+	g_assert_false (sensor_trace_reader_next (reader, &timestamp, values));
+	sensor_trace_reader_free (reader);
+}
+
+static void
+test_sensor_trace_round_trip (void)
+{
+	g_autofree char *path = NULL;
+	g_autofree gint64 *timestamps = NULL;
+	g_autofree int *values = NULL;
+	SensorTraceHeader header;
+	SensorTraceWriter *writer;
+	SensorTraceReader *reader;
+	GStatBuf st;
+	gint64 timestamp;
+	int read_values[3];
+	guint i, pass;
+
+	timestamps = g_new (gint64, N_SAMPLES);
+	values = g_new (int, N_SAMPLES * 3);
+	for (i = 0; i < N_SAMPLES; i++) {
+		timestamps[i] = G_GINT64_CONSTANT (123456789012) + i * 10000 + (i % 7);
+		values[i * 3] = 1024 - (i % 13);
+		values[i * 3 + 1] = -512 + (i % 5);
+		values[i * 3 + 2] = (i % 100 == 0) ? G_MININT32 : (i % 100 == 1) ? G_MAXINT32 : 0;
+	}
+
+	path = g_build_filename (trace_dir, "round-trip.trace", NULL);
+	fill_header (&header);
+	writer = sensor_trace_writer_new (path, &header, NULL);
+	g_assert_nonnull (writer);
+	/* In batches, like the buffered drivers */
+	for (i = 0; i < N_SAMPLES; i += 100)
+		sensor_trace_writer_add (writer, timestamps + i, values + i * 3, 100);
+	sensor_trace_writer_free (writer);
+
+	reader = sensor_trace_reader_new (path, NULL);
+	g_assert_nonnull (reader);
+
+	/* And it's the same after a rewind */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < N_SAMPLES; i++) {
+			g_assert_true (sensor_trace_reader_next (reader, &timestamp, read_values));
+			g_assert_cmpint (timestamp, ==, timestamps[i]);
+			g_assert_cmpint (read_values[0], ==, values[i * 3]);
+			g_assert_cmpint (read_values[1], ==, values[i * 3 + 1]);
+			g_assert_cmpint (read_values[2], ==, values[i * 3 + 2]);
+		}
+		g_assert_false (sensor_trace_reader_next (reader, &timestamp, read_values));
+		sensor_trace_reader_rewind (reader);
+	}
+	sensor_trace_reader_free (reader);
+
+	/* Small deltas only take a byte each */
+	g_assert_cmpint (g_stat (path, &st), ==, 0);
+	g_assert_cmpint (st.st_size, <, 6 * N_SAMPLES + 1024);
+}
+
+static void
+test_sensor_trace_invalid (void)
+{
+	g_autofree char *path = NULL;
+	g_autoptr(GError) error = NULL;
+	SensorTraceReader *reader;
+
+	path = g_build_filename (trace_dir, "invalid.trace", NULL);
+	g_assert_true (g_file_set_contents (path, "IIOSPCH1 not a trace", -1, NULL));
+	reader = sensor_trace_reader_new (path, &error);
+	g_assert_null (reader);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+}
+
+int main (int argc, char **argv)
+{
+	g_autoptr(GDir) dir = NULL;
+	const char *name;
+	int ret;
+
+	g_test_init (&argc, &argv, NULL);
+
+	trace_dir = g_dir_make_tmp ("iio-sensor-proxy-XXXXXX", NULL);
+	g_assert_nonnull (trace_dir);
+
+	g_test_add_func ("/iio-sensor-proxy/sensor-trace/header", test_sensor_trace_header);
+	g_test_add_func ("/iio-sensor-proxy/sensor-trace/round-trip", test_sensor_trace_round_trip);
+	g_test_add_func ("/iio-sensor-proxy/sensor-trace/invalid", test_sensor_trace_invalid);
+
+	ret = g_test_run ();
+
+	dir = g_dir_open (trace_dir, 0, NULL);
+	while (dir && (name = g_dir_read_name (dir)) != NULL) {
+		g_autofree char *path = NULL;
+
+		path = g_build_filename (trace_dir, name, NULL);
+		g_remove (path);
+	}
+	g_rmdir (trace_dir);
+	g_free (trace_dir);
+
+	return ret;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "sysfs-utils.h"
+
+typedef struct {
+	char *path;
+	int   dir_fd;
+} Fixture;
+
+static void
+set_attr (Fixture    *fixture,
+	  const char *name,
+	  const char *contents)
+{
+	g_autofree char *path = NULL;
+
+	path = g_build_filename (fixture->path, name, NULL);
+	g_assert_true (g_file_set_contents (path, contents, -1, NULL));
+}
+
+static void
+remove_tree (const char *path)
+{
+	GDir *dir;
+	const char *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			g_autofree char *child = NULL;
+
+			child = g_build_filename (path, name, NULL);
+			remove_tree (child);
+		}
+		g_dir_close (dir);
+	}
+	g_remove (path);
+}
+
+static void
+fixture_setup (Fixture       *fixture,
+	       gconstpointer  user_data)
+{
+	g_autofree char *scan_elements = NULL;
+
+	fixture->path = g_dir_make_tmp ("iio-sensor-proxy-XXXXXX", NULL);
+	g_assert_nonnull (fixture->path);
+	scan_elements = g_build_filename (fixture->path, "scan_elements", NULL);
+	g_assert_cmpint (g_mkdir (scan_elements, 0700), ==, 0);
+
+	set_attr (fixture, "in_accel_scale", "0.009576806\n");
+	set_attr (fixture, "in_accel_x_raw", "-42\n");
+	set_attr (fixture, "scan_elements/in_accel_x_index", "0\n");
+	set_attr (fixture, "scan_elements/in_accel_x_type", "le:s12/16>>4\n");
+	set_attr (fixture, "scan_elements/in_accel_x_en", "0\n");
+	set_attr (fixture, "garbage", "not a number\n");
+
+	fixture->dir_fd = sysfs_open_dir (AT_FDCWD, fixture->path);
+	g_assert_cmpint (fixture->dir_fd, >=, 0);
+}
+
+static void
+fixture_teardown (Fixture       *fixture,
+		  gconstpointer  user_data)
+{
+	close (fixture->dir_fd);
+	remove_tree (fixture->path);
+	g_free (fixture->path);
+}
+
+static void
+test_sysfs_read (Fixture       *fixture,
+		 gconstpointer  user_data)
+{
+	char buf[32];
+	int scan_el_fd, val;
+	unsigned uval;
+	float fval;
+
+	g_assert_cmpint (sysfs_read_float (fixture->dir_fd, "in_accel_scale", &fval), ==, 0);
+	g_assert_cmpfloat_with_epsilon (fval, 0.009576806, 0.0000001);
+	g_assert_cmpint (sysfs_read_int (fixture->dir_fd, "in_accel_x_raw", &val), ==, 0);
+	g_assert_cmpint (val, ==, -42);
+
+	/* Relative to a sub-directory */
+	scan_el_fd = sysfs_open_dir (fixture->dir_fd, "scan_elements");
+	g_assert_cmpint (scan_el_fd, >=, 0);
+	g_assert_cmpint (sysfs_read_uint (scan_el_fd, "in_accel_x_index", &uval), ==, 0);
+	g_assert_cmpuint (uval, ==, 0);
+	g_assert_cmpint (sysfs_read (scan_el_fd, "in_accel_x_type", buf, sizeof (buf)), ==, strlen ("le:s12/16>>4"));
+	g_assert_cmpstr (buf, ==, "le:s12/16>>4");
+
+	/* Truncated to the buffer */
+	g_assert_cmpint (sysfs_read (scan_el_fd, "in_accel_x_type", buf, 3), ==, 2);
+	g_assert_cmpstr (buf, ==, "le");
+	close (scan_el_fd);
+
+	/* Errors */
+	g_assert_cmpint (sysfs_read_int (fixture->dir_fd, "missing", &val), ==, -ENOENT);
+	g_assert_cmpint (sysfs_read_int (fixture->dir_fd, "garbage", &val), ==, -EINVAL);
+	g_assert_cmpint (sysfs_read_float (fixture->dir_fd, "garbage", &fval), ==, -EINVAL);
+	g_assert_cmpint (sysfs_open_dir (fixture->dir_fd, "in_accel_scale"), ==, -ENOTDIR);
+}
+
+static void
+test_sysfs_write (Fixture       *fixture,
+		  gconstpointer  user_data)
+{
+	char buf[32];
+	int val;
+
+	g_assert_cmpint (sysfs_write_int (fixture->dir_fd, "scan_elements/in_accel_x_en", 1, TRUE), ==, 0);
+	g_assert_cmpint (sysfs_read_int (fixture->dir_fd, "scan_elements/in_accel_x_en", &val), ==, 0);
+	g_assert_cmpint (val, ==, 1);
+
+	g_assert_cmpint (sysfs_write_string (fixture->dir_fd, "garbage", "accel_3d-dev0", TRUE), ==, 0);
+	g_assert_cmpint (sysfs_read (fixture->dir_fd, "garbage", buf, sizeof (buf)), >, 0);
+	g_assert_cmpstr (buf, ==, "accel_3d-dev0");
+
+	/* Attributes are never created */
+	g_assert_cmpint (sysfs_write_int (fixture->dir_fd, "missing", 1, FALSE), ==, -ENOENT);
+
+	/* Regular files keep the tail of longer contents, which the
+	 * verification catches, unlike sysfs attributes */
+	g_assert_cmpint (sysfs_write_int (fixture->dir_fd, "in_accel_x_raw", 7, FALSE), ==, 0);
+	g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Possible failure in int write 7 to in_accel_x_raw");
+	g_assert_cmpint (sysfs_write_int (fixture->dir_fd, "in_accel_x_raw", 7, TRUE), ==, -EIO);
+	g_test_assert_expected_messages ();
+}
+
+int main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add ("/iio-sensor-proxy/sysfs-read", Fixture, NULL,
+		    fixture_setup, test_sysfs_read, fixture_teardown);
+	g_test_add ("/iio-sensor-proxy/sysfs-write", Fixture, NULL,
+		    fixture_setup, test_sysfs_write, fixture_teardown);
+
+	return g_test_run ();
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#include "time-source.h"
+#include "wakeup-scheduler.h"
+
+#define START_TIME (G_GINT64_CONSTANT (1000) * G_USEC_PER_SEC)
+
+typedef struct {
+	guint  n_calls;
+	gint64 last_call;
+	guint  max_calls;
+} CallCount;
+
+static gboolean
+count_call (gpointer user_data)
+{
+	CallCount *count = user_data;
+
+	count->n_calls++;
+	count->last_call = time_source_get_time ();
+	if (count->max_calls > 0 && count->n_calls >= count->max_calls)
+		return G_SOURCE_REMOVE;
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_time_source_timeouts (void)
+{
+	CallCount every_second = { 0, };
+	CallCount three_times = { 0, 0, 3 };
+	CallCount idle = { 0, 0, 1 };
+	guint id;
+
+	id = time_source_timeout_add (1000, count_call, &every_second);
+	time_source_timeout_add_seconds (2, count_call, &three_times);
+	time_source_idle_add (count_call, &idle);
+
+	/* Nothing happens without the clock moving */
+	g_assert_cmpuint (every_second.n_calls, ==, 0);
+	g_assert_cmpuint (idle.n_calls, ==, 0);
+
+	time_source_advance (0);
+	g_assert_cmpuint (idle.n_calls, ==, 1);
+	g_assert_cmpint (idle.last_call, ==, time_source_get_time ());
+
+	/* Two hours go by in no time */
+	time_source_advance ((gint64) 2 * 3600 * G_USEC_PER_SEC);
+	g_assert_cmpuint (every_second.n_calls, ==, 2 * 3600);
+	g_assert_cmpint (every_second.last_call, ==, time_source_get_time ());
+	g_assert_cmpuint (three_times.n_calls, ==, 3);
+	g_assert_cmpuint (idle.n_calls, ==, 1);
+
+	time_source_remove (id);
+	time_source_advance (10 * G_USEC_PER_SEC);
+	g_assert_cmpuint (every_second.n_calls, ==, 2 * 3600);
+}
+
+static void
+test_time_source_idle (void)
+{
+	CallCount idle = { 0, };
+	guint id;
+
+	/* An idle that never stops runs once per step, rather than
+	 * keeping the clock from ever getting to the end of the step */
+	id = time_source_idle_add (count_call, &idle);
+	time_source_advance (0);
+	g_assert_cmpuint (idle.n_calls, ==, 1);
+	time_source_advance (G_USEC_PER_SEC);
+	g_assert_cmpuint (idle.n_calls, ==, 2);
+	g_assert_cmpint (idle.last_call, ==, time_source_get_time () - G_USEC_PER_SEC);
+
+	time_source_remove (id);
+	time_source_advance (0);
+	g_assert_cmpuint (idle.n_calls, ==, 2);
+}
+
+static gboolean
+remove_itself (gpointer user_data)
+{
+	guint *id = user_data;
+
+	time_source_remove (*id);
+	*id = 0;
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_time_source_remove (void)
+{
+	CallCount count = { 0, };
+	guint id;
+
+	/* Removing a timeout from its own callback stops it */
+	id = time_source_timeout_add (10, remove_itself, &id);
+	time_source_advance (G_USEC_PER_SEC);
+	g_assert_cmpuint (id, ==, 0);
+
+	/* One-off timeouts run when the time is reached */
+	time_source_timeout_add_at (time_source_get_time () + 1500, count_call, &count);
+	count.max_calls = 1;
+	time_source_advance (1000);
+	g_assert_cmpuint (count.n_calls, ==, 0);
+	time_source_advance (1000);
+	g_assert_cmpuint (count.n_calls, ==, 1);
+	g_assert_cmpint (count.last_call, ==, time_source_get_time () - 500);
+}
+
+typedef struct {
+	guint  n_calls;
+	guint  n_wakeups;
+	gint64 last_call;
+} WakeupCount;
+
+static gboolean
+count_wakeup (gpointer user_data)
+{
+	WakeupCount *count = user_data;
+
+	if (count->last_call != time_source_get_time ())
+		count->n_wakeups++;
+	count->last_call = time_source_get_time ();
+	count->n_calls++;
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_time_source_wakeup_scheduler (void)
+{
+	WakeupCount count = { 0, };
+	guint id1, id2;
+
+	/* Slightly different intervals are read in the same
+	 * wake-up, at the latest time that suits both */
+	id1 = wakeup_scheduler_add (1000, WAKEUP_DEFAULT_TOLERANCE (1000), count_wakeup, &count, "first");
+	id2 = wakeup_scheduler_add (900, WAKEUP_DEFAULT_TOLERANCE (900), count_wakeup, &count, "second");
+
+	/* Every 900 + 225 ms for an hour */
+	time_source_advance ((gint64) 3600 * G_USEC_PER_SEC);
+	g_assert_cmpuint (count.n_wakeups, ==, 3200);
+	g_assert_cmpuint (count.n_calls, ==, 2 * count.n_wakeups);
+
+	wakeup_scheduler_remove (id1);
+	wakeup_scheduler_remove (id2);
+	count.n_calls = 0;
+	time_source_advance ((gint64) 3600 * G_USEC_PER_SEC);
+	g_assert_cmpuint (count.n_calls, ==, 0);
+}
+
+static void
+test_time_source_wakeup_stats (void)
+{
+	WakeupCount separate = { 0, };
+	WakeupCount scheduled = { 0, };
+	guint64 n_wakeups, n_calls;
+	guint64 start_wakeups, start_calls;
+	guint id1, id2;
+
+	/* Before: each reading with its own timeout */
+	id1 = time_source_timeout_add (1000, count_wakeup, &separate);
+	id2 = time_source_timeout_add (900, count_wakeup, &separate);
+	time_source_advance ((gint64) 3600 * G_USEC_PER_SEC);
+	time_source_remove (id1);
+	time_source_remove (id2);
+	/* Both only coincide every 9 seconds */
+	g_assert_cmpuint (separate.n_calls, ==, 3600 + 4000);
+	g_assert_cmpuint (separate.n_wakeups, ==, 3600 + 4000 - 400);
+
+	/* After: the same readings through the scheduler */
+	wakeup_scheduler_get_stats (&start_wakeups, &start_calls);
+	id1 = wakeup_scheduler_add (1000, WAKEUP_DEFAULT_TOLERANCE (1000), count_wakeup, &scheduled, "first");
+	id2 = wakeup_scheduler_add (900, WAKEUP_DEFAULT_TOLERANCE (900), count_wakeup, &scheduled, "second");
+	time_source_advance ((gint64) 3600 * G_USEC_PER_SEC);
+	wakeup_scheduler_remove (id1);
+	wakeup_scheduler_remove (id2);
+
+	wakeup_scheduler_get_stats (&n_wakeups, &n_calls);
+	n_wakeups -= start_wakeups;
+	n_calls -= start_calls;
+	g_assert_cmpuint (n_wakeups, ==, 3200);
+	g_assert_cmpuint (n_calls, ==, 2 * n_wakeups);
+	g_assert_cmpuint (n_calls, ==, scheduled.n_calls);
+	/* Fewer than half the wake-ups, for fewer readings */
+	g_assert_cmpuint (n_wakeups * 2, <, separate.n_wakeups);
+}
+
+int main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	time_source_set_virtual (START_TIME);
+
+	g_test_add_func ("/iio-sensor-proxy/time-source/timeouts", test_time_source_timeouts);
+	g_test_add_func ("/iio-sensor-proxy/time-source/idle", test_time_source_idle);
+	g_test_add_func ("/iio-sensor-proxy/time-source/remove", test_time_source_remove);
+	g_test_add_func ("/iio-sensor-proxy/time-source/wakeup-scheduler", test_time_source_wakeup_scheduler);
+	g_test_add_func ("/iio-sensor-proxy/time-source/wakeup-stats", test_time_source_wakeup_stats);
+
+	return g_test_run ();
+}
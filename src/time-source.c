@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+/*
+ * All the timing decisions of the daemon and drivers go through here.
+ * By default, this is the monotonic clock and the GLib main loop, but
+ * tests can switch to a virtual clock, which only moves forward with
+ * time_source_advance(), running the timeouts that are due in order,
+ * so that hours of readings can be checked in milliseconds.
+ */
+
+#include "time-source.h"
+
+typedef struct {
+	guint           id;
+	gint64          deadline;	/* µs */
+	gint64          interval;	/* µs */
+	guint           last_step;
+	GSourceFunc     func;
+	gpointer        user_data;
+	GDestroyNotify  notify;
+} VirtualTimeout;
+
+typedef struct {
+	gint64          now;
+	GPtrArray      *timeouts;
+	VirtualTimeout *dispatching;
+	gboolean        dispatching_removed;
+	guint           next_id;
+	guint           step;
+} VirtualClock;
+
+static VirtualClock *virtual_clock = NULL;
+
+static void
+virtual_timeout_free (VirtualTimeout *timeout)
+{
+	if (timeout->notify)
+		timeout->notify (timeout->user_data);
+	g_free (timeout);
+}
+
+static guint
+virtual_timeout_add (gint64          deadline,
+		     gint64          interval,
+		     GSourceFunc     func,
+		     gpointer        user_data,
+		     GDestroyNotify  notify)
+{
+	VirtualTimeout *timeout;
+
+	timeout = g_new0 (VirtualTimeout, 1);
+	timeout->id = virtual_clock->next_id++;
+	timeout->deadline = deadline;
+	timeout->interval = interval;
+	timeout->func = func;
+	timeout->user_data = user_data;
+	timeout->notify = notify;
+	g_ptr_array_add (virtual_clock->timeouts, timeout);
+
+	return timeout->id;
+}
+
+/* The earliest timeout due by @time, the first one added if several are
+ * due at the same time, like GLib does for sources of the same priority.
+ * Timeouts without an interval, such as idles, don't move the clock
+ * forward, so they only run once per time_source_advance() */
+static VirtualTimeout *
+next_due_timeout (gint64 time)
+{
+	VirtualTimeout *next = NULL;
+	guint i;
+
+	for (i = 0; i < virtual_clock->timeouts->len; i++) {
+		VirtualTimeout *timeout = g_ptr_array_index (virtual_clock->timeouts, i);
+
+		if (timeout->deadline > time)
+			continue;
+		if (timeout->interval == 0 && timeout->last_step == virtual_clock->step)
+			continue;
+		if (next == NULL ||
+		    timeout->deadline < next->deadline ||
+		    (timeout->deadline == next->deadline && timeout->id < next->id))
+			next = timeout;
+	}
+
+	return next;
+}
+
+/* Microseconds, on the g_get_monotonic_time() clock */
+gint64
+time_source_get_time (void)
+{
+	if (virtual_clock)
+		return virtual_clock->now;
+	return g_get_monotonic_time ();
+}
+
+/* @interval is in ms, as for g_timeout_add() */
+guint
+time_source_timeout_add_full (guint           interval,
+			      GSourceFunc     func,
+			      gpointer        user_data,
+			      GDestroyNotify  notify)
+{
+	if (virtual_clock)
+		return virtual_timeout_add (virtual_clock->now + interval * (gint64) 1000,
+					    interval * (gint64) 1000, func, user_data, notify);
+	return g_timeout_add_full (G_PRIORITY_DEFAULT, interval, func, user_data, notify);
+}
+
+guint
+time_source_timeout_add (guint        interval,
+			 GSourceFunc  func,
+			 gpointer     user_data)
+{
+	return time_source_timeout_add_full (interval, func, user_data, NULL);
+}
+
+guint
+time_source_timeout_add_seconds (guint        interval,
+				 GSourceFunc  func,
+				 gpointer     user_data)
+{
+	if (virtual_clock)
+		return time_source_timeout_add (interval * 1000, func, user_data);
+	return g_timeout_add_seconds (interval, func, user_data);
+}
+
+/* Calls @func once @time, from time_source_get_time(), is reached.
+ * @func is expected to return %G_SOURCE_REMOVE */
+guint
+time_source_timeout_add_at (gint64       time,
+			    GSourceFunc  func,
+			    gpointer     user_data)
+{
+	gint64 delay;
+
+	if (virtual_clock)
+		return virtual_timeout_add (time, 1000, func, user_data, NULL);
+
+	delay = time - g_get_monotonic_time ();
+	return g_timeout_add (delay > 0 ? (delay + 999) / 1000 : 0, func, user_data);
+}
+
+/* With the virtual clock, idle callbacks run at the current time, once
+ * per time_source_advance(), until they return %G_SOURCE_REMOVE */
+guint
+time_source_idle_add (GSourceFunc func,
+		      gpointer    user_data)
+{
+	if (virtual_clock)
+		return virtual_timeout_add (virtual_clock->now, 0, func, user_data, NULL);
+	return g_idle_add (func, user_data);
+}
+
+void
+time_source_set_name (guint       id,
+		      const char *name)
+{
+	if (virtual_clock)
+		return;
+	g_source_set_name_by_id (id, name);
+}
+
+void
+time_source_remove (guint id)
+{
+	guint i;
+
+	if (!virtual_clock) {
+		g_source_remove (id);
+		return;
+	}
+
+	for (i = 0; i < virtual_clock->timeouts->len; i++) {
+		VirtualTimeout *timeout = g_ptr_array_index (virtual_clock->timeouts, i);
+
+		if (timeout->id != id)
+			continue;
+
+		/* Freed once its callback returns */
+		if (timeout == virtual_clock->dispatching)
+			virtual_clock->dispatching_removed = TRUE;
+		else
+			g_ptr_array_remove_index (virtual_clock->timeouts, i);
+		return;
+	}
+
+	g_warning ("Virtual timeout %u not found", id);
+}
+
+/**
+ * time_source_set_virtual:
+ * @start_time: the initial time, in µs
+ *
+ * Switches to a virtual clock, which needs to be done before
+ * any timeouts are added.
+ **/
+void
+time_source_set_virtual (gint64 start_time)
+{
+	g_return_if_fail (virtual_clock == NULL);
+
+	virtual_clock = g_new0 (VirtualClock, 1);
+	virtual_clock->now = start_time;
+	virtual_clock->timeouts = g_ptr_array_new_with_free_func ((GDestroyNotify) virtual_timeout_free);
+	virtual_clock->next_id = 1;
+}
+
+gboolean
+time_source_is_virtual (void)
+{
+	return virtual_clock != NULL;
+}
+
+/**
+ * time_source_advance:
+ * @usecs: how far to move the virtual clock, in µs
+ *
+ * Moves the virtual clock forward, running every timeout due
+ * on the way, at the time it was due.
+ **/
+void
+time_source_advance (gint64 usecs)
+{
+	VirtualTimeout *timeout;
+	gint64 target;
+
+	g_return_if_fail (virtual_clock != NULL);
+	g_return_if_fail (virtual_clock->dispatching == NULL);
+	g_return_if_fail (usecs >= 0);
+
+	target = virtual_clock->now + usecs;
+	virtual_clock->step++;
+	while ((timeout = next_due_timeout (target)) != NULL) {
+		gboolean again;
+
+		virtual_clock->now = MAX (virtual_clock->now, timeout->deadline);
+		virtual_clock->dispatching = timeout;
+		virtual_clock->dispatching_removed = FALSE;
+		timeout->last_step = virtual_clock->step;
+		again = timeout->func (timeout->user_data);
+		virtual_clock->dispatching = NULL;
+
+		if (again == G_SOURCE_CONTINUE && !virtual_clock->dispatching_removed)
+			timeout->deadline = virtual_clock->now + timeout->interval;
+		else
+			g_ptr_array_remove (virtual_clock->timeouts, timeout);
+	}
+
+	virtual_clock->now = target;
+}
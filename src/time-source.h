@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+gint64   time_source_get_time            (void);
+
+guint    time_source_timeout_add         (guint           interval,
+					  GSourceFunc     func,
+					  gpointer        user_data);
+guint    time_source_timeout_add_full    (guint           interval,
+					  GSourceFunc     func,
+					  gpointer        user_data,
+					  GDestroyNotify  notify);
+guint    time_source_timeout_add_seconds (guint           interval,
+					  GSourceFunc     func,
+					  gpointer        user_data);
+guint    time_source_timeout_add_at      (gint64          time,
+					  GSourceFunc     func,
+					  gpointer        user_data);
+guint    time_source_idle_add            (GSourceFunc     func,
+					  gpointer        user_data);
+void     time_source_set_name            (guint           id,
+					  const char     *name);
+void     time_source_remove              (guint           id);
+
+/* For tests */
+void     time_source_set_virtual         (gint64          start_time);
+gboolean time_source_is_virtual          (void);
+void     time_source_advance             (gint64          usecs);
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+/*
+ * The periodic readings of all the drivers are serviced from a single
+ * timer. Each reading has a deadline, and a tolerance either side of it,
+ * and the timer fires at the latest time that still suits the most urgent
+ * reading, taking every reading that can be done then along with it.
+ * Readings done together get their next deadline at the same time, so
+ * sensors with the same interval stay in step, instead of each waking up
+ * the process at its own phase.
+ *
+ * The timer is a timerfd, for its precision, or a timeout of the
+ * virtual clock in tests, see time-source.c.
+ *
+ * A timerfd fires exactly when asked to, so the tolerance is applied by
+ * choosing when to arm it. The timer slack of the main thread is set to
+ * the smallest tolerance as well, so that the kernel can put the main
+ * loop's other timeouts in the same wake-up as the periodic readings.
+ */
+
+#include "wakeup-scheduler.h"
+#include "time-source.h"
+
+#include <glib-unix.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/* How often to log the number of wake-ups */
+#define STATS_INTERVAL (60 * G_USEC_PER_SEC)
+
+typedef struct {
+	guint        id;
+	guint        interval;	/* ms */
+	guint        tolerance;	/* ms */
+	gint64       deadline;	/* µs, monotonic */
+	GSourceFunc  func;
+	gpointer     user_data;
+	char        *name;
+} WakeupEntry;
+
+typedef struct {
+	int          timer_fd;
+	guint        watch_id;
+	guint        virtual_timer_id;
+	GPtrArray   *entries;
+	gboolean     dispatching;
+	gulong       timer_slack;	/* ns, 0 for the default */
+
+	gint64       stats_start;
+	guint        n_wakeups;
+	guint        n_calls;
+} WakeupScheduler;
+
+static WakeupScheduler *scheduler = NULL;
+static guint next_id = 1;
+
+/* Since the start of the process, for wakeup_scheduler_get_stats() */
+static guint64 total_wakeups = 0;
+static guint64 total_calls = 0;
+
+static void
+wakeup_entry_free (WakeupEntry *entry)
+{
+	g_free (entry->name);
+	g_free (entry);
+}
+
+static void
+set_timer_slack (gulong slack)
+{
+	if (slack == scheduler->timer_slack)
+		return;
+
+	/* 0 goes back to the default slack */
+	if (prctl (PR_SET_TIMERSLACK, slack, 0, 0, 0) < 0) {
+		g_debug ("Could not set timer slack to %lu ns: %s", slack, g_strerror (errno));
+		return;
+	}
+	scheduler->timer_slack = slack;
+}
+
+static void
+scheduler_free (void)
+{
+	set_timer_slack (0);
+	g_clear_handle_id (&scheduler->watch_id, g_source_remove);
+	g_clear_handle_id (&scheduler->virtual_timer_id, time_source_remove);
+	if (scheduler->timer_fd >= 0)
+		close (scheduler->timer_fd);
+	g_ptr_array_free (scheduler->entries, TRUE);
+	g_clear_pointer (&scheduler, g_free);
+}
+
+static WakeupEntry *
+find_entry (guint id)
+{
+	guint i;
+
+	for (i = 0; i < scheduler->entries->len; i++) {
+		WakeupEntry *entry = g_ptr_array_index (scheduler->entries, i);
+
+		if (entry->id == id)
+			return entry;
+	}
+	return NULL;
+}
+
+static gint64
+latest_time (WakeupEntry *entry)
+{
+	return entry->deadline + entry->tolerance * (gint64) 1000;
+}
+
+static gint64
+earliest_time (WakeupEntry *entry)
+{
+	return entry->deadline - entry->tolerance * (gint64) 1000;
+}
+
+/* Entries are removed once the dispatch is over, so that
+ * callbacks can add and remove any of them */
+static void
+prune_entries (void)
+{
+	guint i = 0;
+
+	while (i < scheduler->entries->len) {
+		WakeupEntry *entry = g_ptr_array_index (scheduler->entries, i);
+
+		if (entry->func == NULL)
+			g_ptr_array_remove_index (scheduler->entries, i);
+		else
+			i++;
+	}
+}
+
+static gboolean virtual_timer_fired (gpointer user_data);
+
+static void
+rearm (void)
+{
+	struct itimerspec spec;
+	gint64 wakeup = G_MAXINT64;
+	guint tolerance = G_MAXUINT;
+	guint i;
+
+	if (scheduler->dispatching)
+		return;
+
+	prune_entries ();
+	if (scheduler->entries->len == 0) {
+		g_debug ("No more periodic readings, stopping wake-up timer");
+		scheduler_free ();
+		return;
+	}
+
+	for (i = 0; i < scheduler->entries->len; i++) {
+		WakeupEntry *entry = g_ptr_array_index (scheduler->entries, i);
+
+		wakeup = MIN (wakeup, latest_time (entry));
+		tolerance = MIN (tolerance, entry->tolerance);
+	}
+
+	if (time_source_is_virtual ()) {
+		g_clear_handle_id (&scheduler->virtual_timer_id, time_source_remove);
+		scheduler->virtual_timer_id = time_source_timeout_add_at (wakeup, virtual_timer_fired, NULL);
+		return;
+	}
+
+	set_timer_slack (tolerance * 1000000UL);
+
+	memset (&spec, 0, sizeof (spec));
+	spec.it_value.tv_sec = wakeup / G_USEC_PER_SEC;
+	spec.it_value.tv_nsec = (wakeup % G_USEC_PER_SEC) * 1000;
+	/* A zero it_value would disarm the timer */
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+		spec.it_value.tv_nsec = 1;
+
+	if (timerfd_settime (scheduler->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+		g_warning ("Could not arm wake-up timer: %s", g_strerror (errno));
+}
+
+static void
+update_stats (gint64 now,
+	      guint  n_calls)
+{
+	scheduler->n_wakeups++;
+	scheduler->n_calls += n_calls;
+	total_wakeups++;
+	total_calls += n_calls;
+
+	if (now - scheduler->stats_start < STATS_INTERVAL)
+		return;
+
+	g_debug ("%u wake-ups for %u periodic readings in the last %d seconds",
+		 scheduler->n_wakeups, scheduler->n_calls,
+		 (int) ((now - scheduler->stats_start) / G_USEC_PER_SEC));
+	scheduler->stats_start = now;
+	scheduler->n_wakeups = 0;
+	scheduler->n_calls = 0;
+}
+
+static void
+dispatch_due (void)
+{
+	g_autoptr(GArray) due = NULL;
+	gint64 now;
+	guint i;
+
+	now = time_source_get_time ();
+
+	/* Everything that can be read now, most urgent first, as
+	 * the callbacks might add or remove entries */
+	due = g_array_new (FALSE, FALSE, sizeof (guint));
+	for (i = 0; i < scheduler->entries->len; i++) {
+		WakeupEntry *entry = g_ptr_array_index (scheduler->entries, i);
+
+		if (entry->func != NULL && earliest_time (entry) <= now)
+			g_array_append_val (due, entry->id);
+	}
+
+	scheduler->dispatching = TRUE;
+	for (i = 0; i < due->len; i++) {
+		WakeupEntry *entry;
+
+		entry = find_entry (g_array_index (due, guint, i));
+		if (entry == NULL || entry->func == NULL)
+			continue;
+
+		entry->deadline = now + entry->interval * (gint64) 1000;
+		if (entry->func (entry->user_data) == G_SOURCE_REMOVE)
+			entry->func = NULL;
+	}
+	scheduler->dispatching = FALSE;
+
+	update_stats (now, due->len);
+
+	/* The scheduler might be freed from there */
+	rearm ();
+}
+
+static gboolean
+timer_fired (gint         fd,
+	     GIOCondition condition,
+	     gpointer     user_data)
+{
+	guint64 expirations;
+
+	if (read (fd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN)
+		g_warning ("Could not read wake-up timer: %s", g_strerror (errno));
+
+	dispatch_due ();
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+virtual_timer_fired (gpointer user_data)
+{
+	scheduler->virtual_timer_id = 0;
+	dispatch_due ();
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+ensure_scheduler (void)
+{
+	int fd = -1;
+
+	if (scheduler != NULL)
+		return TRUE;
+
+	if (!time_source_is_virtual ()) {
+		fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0) {
+			g_warning ("Could not create wake-up timer: %s", g_strerror (errno));
+			return FALSE;
+		}
+	}
+
+	scheduler = g_new0 (WakeupScheduler, 1);
+	scheduler->timer_fd = fd;
+	scheduler->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) wakeup_entry_free);
+	scheduler->stats_start = time_source_get_time ();
+	if (fd >= 0) {
+		scheduler->watch_id = g_unix_fd_add (fd, G_IO_IN, timer_fired, NULL);
+		g_source_set_name_by_id (scheduler->watch_id, "[wakeup_scheduler] timer_fired");
+	}
+
+	return TRUE;
+}
+
+/**
+ * wakeup_scheduler_add:
+ * @interval: the time between calls, in ms
+ * @tolerance: how much earlier or later than @interval calls can be, in ms,
+ *   usually WAKEUP_DEFAULT_TOLERANCE()
+ * @func: the function to call, which returns %G_SOURCE_REMOVE to stop
+ * @user_data: data to pass to @func
+ * @name: a name for debugging
+ *
+ * Calls @func every @interval ms, in the same wake-up as the
+ * other periodic readings that are due around the same time.
+ *
+ * Returns: an ID to pass to wakeup_scheduler_remove(), or 0 on error
+ **/
+guint
+wakeup_scheduler_add (guint        interval,
+		      guint        tolerance,
+		      GSourceFunc  func,
+		      gpointer     user_data,
+		      const char  *name)
+{
+	WakeupEntry *entry;
+
+	g_return_val_if_fail (func != NULL, 0);
+	g_return_val_if_fail (interval > 0, 0);
+
+	if (!ensure_scheduler ())
+		return 0;
+
+	entry = g_new0 (WakeupEntry, 1);
+	entry->id = next_id++;
+	entry->interval = interval;
+	entry->tolerance = MIN (tolerance, interval / 2);
+	entry->deadline = time_source_get_time () + interval * (gint64) 1000;
+	entry->func = func;
+	entry->user_data = user_data;
+	entry->name = g_strdup (name);
+	g_ptr_array_add (scheduler->entries, entry);
+
+	g_debug ("Scheduling %s every %u ms (± %u ms)", name, interval, entry->tolerance);
+	rearm ();
+
+	return entry->id;
+}
+
+/* The new interval applies from the last call */
+void
+wakeup_scheduler_set_interval (guint id,
+			       guint interval)
+{
+	WakeupEntry *entry;
+
+	g_return_if_fail (scheduler != NULL);
+	g_return_if_fail (interval > 0);
+
+	entry = find_entry (id);
+	g_return_if_fail (entry != NULL);
+
+	entry->deadline += (interval - (gint64) entry->interval) * 1000;
+	entry->tolerance = entry->tolerance * interval / entry->interval;
+	entry->interval = interval;
+	rearm ();
+}
+
+void
+wakeup_scheduler_remove (guint id)
+{
+	WakeupEntry *entry;
+
+	g_return_if_fail (scheduler != NULL);
+
+	entry = find_entry (id);
+	g_return_if_fail (entry != NULL);
+
+	entry->func = NULL;
+	rearm ();
+}
+
+/**
+ * wakeup_scheduler_get_stats:
+ * @n_wakeups: (out) (optional): the number of times the timer fired
+ * @n_calls: (out) (optional): the number of periodic readings done
+ *
+ * Gets the number of wake-ups since the start of the process, and the
+ * number of readings done in them, to measure how many are saved.
+ **/
+void
+wakeup_scheduler_get_stats (guint64 *n_wakeups,
+			    guint64 *n_calls)
+{
+	if (n_wakeups)
+		*n_wakeups = total_wakeups;
+	if (n_calls)
+		*n_calls = total_calls;
+}
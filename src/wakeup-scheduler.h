@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2021 Bastien Nocera <hadess@hadess.net>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published by
+ * the Free Software Foundation.
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* How late, or early, a periodic reading can be by default */
+#define WAKEUP_DEFAULT_TOLERANCE(interval) ((interval) / 4)
+
+guint wakeup_scheduler_add          (guint        interval,
+				     guint        tolerance,
+				     GSourceFunc  func,
+				     gpointer     user_data,
+				     const char  *name);
+void  wakeup_scheduler_set_interval (guint        id,
+				     guint        interval);
+void  wakeup_scheduler_remove       (guint        id);
+void  wakeup_scheduler_get_stats    (guint64     *n_wakeups,
+				     guint64     *n_calls);